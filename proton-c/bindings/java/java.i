@@ -32,6 +32,7 @@
 #include <proton/driver.h>
 #include <proton/driver_extras.h>
 #include <proton/messenger.h>
+#include <proton/event.h>
 %}
 /* Swig makes the assumption that all char[x] definitions have 0 as their last element... this is not true for Proton */
 %typemap(memberin) char [ANY] {
@@ -6,6 +6,7 @@
 #include <proton/sasl.h>
 #include <proton/driver.h>
 #include <proton/messenger.h>
+#include <proton/event.h>
 #include <proton/ssl.h>
 #include <proton/driver_extras.h>
 %}
@@ -30,6 +30,7 @@
 #include <proton/driver.h>
 #include <proton/driver_extras.h>
 #include <proton/messenger.h>
+#include <proton/event.h>
 #include <proton/ssl.h>
 
 #define zend_error_noreturn zend_error
@@ -355,6 +355,19 @@ have been accepted or rejected. Defaults to zero.
 The outgoing tracking window for the messenger. The messenger will
 track the remote status of this many outgoing deliveries after calling
 send. Defaults to zero.
+""")
+
+  def _get_txn_batch(self):
+    return pn_messenger_get_txn_batch(self._mng)
+
+  def _set_txn_batch(self, batch):
+    self._check(pn_messenger_set_txn_batch(self._mng, batch))
+
+  txn_batch = property(_get_txn_batch, _set_txn_batch,
+                       doc="""
+The number of messages sent, accepted or rejected on a connection that
+the messenger groups into one transaction before it is discharged.
+Defaults to zero, which does not use transactions.
 """)
 
   def start(self):
@@ -447,6 +460,13 @@ send. Defaults to zero.
     """
     self._check(pn_messenger_send(self._mng, n))
 
+  def commit(self):
+    """
+    Discharges the transactions in progress without waiting for them
+    to reach L{txn_batch} and blocks until they are committed.
+    """
+    self._check(pn_messenger_commit(self._mng))
+
   def recv(self, n=None):
     """
     Receives up to I{n} messages into the incoming queue of the
@@ -1899,8 +1919,8 @@ def obj2cond(obj, cond):
   if obj:
     pn_condition_set_name(cond, str(obj.name))
     pn_condition_set_description(cond, obj.description)
-    info = Data(pn_condition_info(cond))
     if obj.info:
+      info = Data(pn_condition_info(cond))
       info.put_object(obj.info)
 
 def cond2obj(cond):
@@ -2029,6 +2049,12 @@ class Connection(Endpoint):
   def work_head(self):
     return wrap_delivery(pn_work_head(self._conn))
 
+  def collect(self, collector):
+    if collector is None:
+      pn_connection_collect(self._conn, None)
+    else:
+      pn_connection_collect(self._conn, collector._impl)
+
   @property
   def error(self):
     return pn_error_code(pn_connection_error(self._conn))
@@ -2079,6 +2105,10 @@ class Session(Endpoint):
   def incoming_bytes(self):
     return pn_session_incoming_bytes(self._ssn)
 
+  @property
+  def window_stalls(self):
+    return pn_session_window_stalls(self._ssn)
+
   def open(self):
     pn_session_open(self._ssn)
 
@@ -2128,6 +2158,8 @@ class Link(Endpoint):
   RCV_FIRST = PN_RCV_FIRST
   RCV_SECOND = PN_RCV_SECOND
 
+  PRIORITIES = PN_LINK_PRIORITIES
+
   def __init__(self, link):
     Endpoint.__init__(self)
     self._link = link
@@ -2194,6 +2226,13 @@ class Link(Endpoint):
   def unsettled(self):
     return pn_link_unsettled(self._link)
 
+  @property
+  def remote_settled_upto(self):
+    return wrap_delivery(pn_link_remote_settled_upto(self._link))
+
+  def settle_upto(self, delivery, outcome=0):
+    return self._check(pn_link_settle_upto(self._link, delivery._dlv, outcome))
+
   @property
   def credit(self):
     return pn_link_credit(self._link)
@@ -2206,6 +2245,34 @@ class Link(Endpoint):
   def queued(self):
     return pn_link_queued(self._link)
 
+  @property
+  def credit_starvation(self):
+    return pn_link_credit_starvation(self._link)
+
+  def _get_priority(self):
+    return pn_link_get_priority(self._link)
+  def _set_priority(self, priority):
+    self._check(pn_link_set_priority(self._link, priority))
+  priority = property(_get_priority, _set_priority)
+
+  def _get_weight(self):
+    return pn_link_get_weight(self._link)
+  def _set_weight(self, weight):
+    self._check(pn_link_set_weight(self._link, weight))
+  weight = property(_get_weight, _set_weight)
+
+  def _get_max_buffered(self):
+    return pn_link_get_max_buffered(self._link)
+  def _set_max_buffered(self, size):
+    pn_link_set_max_buffered(self._link, size)
+  max_buffered = property(_get_max_buffered, _set_max_buffered)
+
+  def _get_resumable(self):
+    return pn_link_is_resumable(self._link)
+  def _set_resumable(self, resumable):
+    pn_link_set_resumable(self._link, bool(resumable))
+  resumable = property(_get_resumable, _set_resumable)
+
   def next(self, mask):
     return wrap_link(pn_link_next(self._link, mask))
 
@@ -2333,6 +2400,9 @@ class Sender(Link):
   def send(self, bytes):
     return self._check(pn_link_send(self._link, bytes))
 
+  def send_settled(self, tag, bytes):
+    return self._check(pn_link_send_settled(self._link, tag, bytes))
+
   def drained(self):
     pn_link_drained(self._link)
 
@@ -2367,6 +2437,8 @@ class Disposition(object):
   REJECTED = PN_REJECTED
   RELEASED = PN_RELEASED
   MODIFIED = PN_MODIFIED
+  DECLARED = PN_DECLARED
+  TRANSACTIONAL_STATE = PN_TRANSACTIONAL_STATE
 
   def __init__(self, impl, local):
     self._impl = impl
@@ -2439,6 +2511,14 @@ class Disposition(object):
       raise AttributeError("condition attribute is read-only")
   condition = property(_get_condition, _set_condition)
 
+  @property
+  def txn_id(self):
+    return pn_disposition_get_txn(self._impl)
+
+  @property
+  def txn_outcome(self):
+    return pn_disposition_get_txn_outcome(self._impl)
+
 class Delivery(object):
 
   RECEIVED = Disposition.RECEIVED
@@ -2446,6 +2526,8 @@ class Delivery(object):
   REJECTED = Disposition.REJECTED
   RELEASED = Disposition.RELEASED
   MODIFIED = Disposition.MODIFIED
+  DECLARED = Disposition.DECLARED
+  TRANSACTIONAL_STATE = Disposition.TRANSACTIONAL_STATE
 
   def __init__(self, dlv):
     self._dlv = dlv
@@ -2482,6 +2564,10 @@ class Delivery(object):
   def partial(self):
     return pn_delivery_partial(self._dlv)
 
+  @property
+  def spilled(self):
+    return pn_delivery_spilled(self._dlv)
+
   @property
   def local_state(self):
     return pn_delivery_local_state(self._dlv)
@@ -2537,6 +2623,9 @@ class Transport(object):
   def bind(self, connection):
     self._check(pn_transport_bind(self._trans, connection._conn))
 
+  def unbind(self):
+    self._check(pn_transport_unbind(self._trans))
+
   def trace(self, n):
     pn_transport_trace(self._trans, n)
 
@@ -2614,6 +2703,21 @@ Sets the maximum size for received frames (in bytes).
   def remote_max_frame_size(self):
     return pn_transport_get_remote_max_frame(self._trans)
 
+  def _get_adaptive_frame(self):
+    return pn_transport_get_adaptive_frame(self._trans)
+
+  def _set_adaptive_frame(self, value):
+    pn_transport_set_adaptive_frame(self._trans, value)
+
+  adaptive_frame = property(_get_adaptive_frame, _set_adaptive_frame,
+                            doc="""
+Sizes outgoing frames from the socket, TLS and message sizes.
+""")
+
+  @property
+  def output_frame_size(self):
+    return pn_transport_get_output_frame(self._trans)
+
   # AMQP 1.0 idle-time-out
   def _get_idle_timeout(self):
     return pn_transport_get_idle_timeout(self._trans)
@@ -2638,6 +2742,68 @@ The idle timeout of the connection (in milliseconds).
   def frames_input(self):
     return pn_transport_get_frames_input(self._trans)
 
+  def _get_stats_timing(self):
+    return pn_transport_get_stats_timing(self._trans)
+
+  def _set_stats_timing(self, value):
+    pn_transport_set_stats_timing(self._trans, value)
+
+  stats_timing = property(_get_stats_timing, _set_stats_timing,
+                          doc="""
+Enables gathering of frame encode/decode and processing latencies.
+""")
+
+class Collector:
+
+  def __init__(self):
+    self._impl = pn_collector()
+
+  def peek(self):
+    event = pn_collector_peek(self._impl)
+    if event is None:
+      return None
+
+    tp = pn_event_transport(event)
+    return Event(type=pn_event_type(event),
+                 connection=wrap_connection(pn_event_connection(event)),
+                 session=wrap_session(pn_event_session(event)),
+                 link=wrap_link(pn_event_link(event)),
+                 delivery=wrap_delivery(pn_event_delivery(event)),
+                 transport=tp and Transport(_trans=tp))
+
+  def pop(self):
+    return pn_collector_pop(self._impl)
+
+  def __del__(self):
+    pn_collector_free(self._impl)
+
+class Event:
+
+  CONNECTION_LOCAL_STATE = PN_CONNECTION_LOCAL_STATE
+  CONNECTION_REMOTE_STATE = PN_CONNECTION_REMOTE_STATE
+  SESSION_LOCAL_STATE = PN_SESSION_LOCAL_STATE
+  SESSION_REMOTE_STATE = PN_SESSION_REMOTE_STATE
+  LINK_LOCAL_STATE = PN_LINK_LOCAL_STATE
+  LINK_REMOTE_STATE = PN_LINK_REMOTE_STATE
+  LINK_FLOW = PN_LINK_FLOW
+  DELIVERY = PN_DELIVERY
+  TRANSPORT = PN_TRANSPORT
+  DELIVERY_RANGE = PN_DELIVERY_RANGE
+
+  def __init__(self, type, connection, session, link, delivery, transport):
+    self.type = type
+    self.connection = connection
+    self.session = session
+    self.link = link
+    self.delivery = delivery
+    self.transport = transport
+
+  def __repr__(self):
+    objects = [self.connection, self.session, self.link, self.delivery,
+               self.transport]
+    return "%s(%s)" % (pn_event_type_name(self.type),
+                       ", ".join([str(o) for o in objects if o is not None]))
+
 class SASLException(TransportException):
   pass
 
@@ -2937,6 +3103,7 @@ __all__ = [
            "REJECTED",
            "UNDESCRIBED",
            "Array",
+           "Collector",
            "Condition",
            "Connection",
            "Connector",
@@ -2947,6 +3114,7 @@ __all__ = [
            "Driver",
            "DriverException",
            "Endpoint",
+           "Event",
            "Link",
            "Listener",
            "Message",
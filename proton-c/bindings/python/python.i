@@ -28,6 +28,7 @@
 #include <proton/driver.h>
 #include <proton/driver_extras.h>
 #include <proton/messenger.h>
+#include <proton/event.h>
 #include <proton/ssl.h>
 %}
 
@@ -106,6 +107,14 @@ int pn_message_save_json(pn_message_t *msg, char *OUTPUT, size_t *OUTPUT_SIZE);
 ssize_t pn_link_send(pn_link_t *transport, char *STRING, size_t LENGTH);
 %ignore pn_link_send;
 
+%rename(pn_link_send_settled) wrap_pn_link_send_settled;
+%inline %{
+  ssize_t wrap_pn_link_send_settled(pn_link_t *link, pn_bytes_t tag, char *STRING, size_t LENGTH) {
+    return pn_link_send_settled(link, pn_dtag(tag.start, tag.size), STRING, LENGTH);
+  }
+%}
+%ignore pn_link_send_settled;
+
 %rename(pn_link_recv) wrap_pn_link_recv;
 %inline %{
   int wrap_pn_link_recv(pn_link_t *link, char *OUTPUT, size_t *OUTPUT_SIZE) {
@@ -120,6 +129,9 @@ ssize_t pn_link_send(pn_link_t *transport, char *STRING, size_t LENGTH);
 %}
 %ignore pn_link_recv;
 
+// pn_link_recv already copies the payload out
+%ignore pn_delivery_map;
+
 int pn_transport_push(pn_transport_t *transport, char *STRING, size_t LENGTH);
 %ignore pn_transport_push;
 
@@ -130,6 +142,7 @@ int pn_transport_push(pn_transport_t *transport, char *STRING, size_t LENGTH);
   }
 %}
 %ignore pn_transport_peek;
+%ignore pn_transport_head_vec;
 
 ssize_t pn_transport_input(pn_transport_t *transport, char *STRING, size_t LENGTH);
 %ignore pn_transport_input;
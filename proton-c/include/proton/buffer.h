@@ -44,8 +44,23 @@ PN_EXTERN int pn_buffer_trim(pn_buffer_t *buf, size_t left, size_t right);
 PN_EXTERN void pn_buffer_clear(pn_buffer_t *buf);
 PN_EXTERN int pn_buffer_defrag(pn_buffer_t *buf);
 PN_EXTERN pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf);
+/* the content as it lies in memory, in at most two pieces, without
+   moving it; returns how many of head and tail are not empty */
+PN_EXTERN size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *head, pn_bytes_t *tail);
 PN_EXTERN int pn_buffer_print(pn_buffer_t *buf);
 
+/* Freed buffers are kept for reuse by the thread that frees them, up
+   to a capacity in bytes for each thread, 1MB unless set otherwise. A
+   capacity of 0 turns the pool off. What a thread keeps is released
+   when it exits, and trimmed to a quarter of the capacity whenever it
+   frees a connection or transport; where the platform cannot run code
+   at thread exit nothing is kept. pn_buffer_pool_trim releases what is
+   kept down to at most keep bytes and returns how much it freed. */
+PN_EXTERN size_t pn_buffer_pool_get_capacity(void);
+PN_EXTERN void pn_buffer_pool_set_capacity(size_t capacity);
+PN_EXTERN size_t pn_buffer_pool_cached(void);
+PN_EXTERN size_t pn_buffer_pool_trim(size_t keep);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1317,6 +1317,8 @@ typedef long long int int64_t;
 
 %include "proton/messenger.h"
 
+%include "proton/event.h"
+
 %include "proton/ssl.h"
 
 %ignore pn_decode_atoms;
@@ -118,6 +118,8 @@ typedef int pn_state_t;     /**< encodes the state of an endpoint */
 #define PN_REJECTED (0x0000000000000025)
 #define PN_RELEASED (0x0000000000000026)
 #define PN_MODIFIED (0x0000000000000027)
+#define PN_DECLARED (0x0000000000000033)
+#define PN_TRANSACTIONAL_STATE (0x0000000000000034)
 
 typedef int pn_trace_t;
 
@@ -220,6 +222,14 @@ PN_EXTERN pn_transport_t *pn_transport(void);
 
 PN_EXTERN int pn_transport_bind(pn_transport_t *transport, pn_connection_t *connection);
 
+/** Detaches the transport from its connection. The connection keeps
+ * its endpoints and unsettled deliveries, and a transport bound to it
+ * next opens, begins and attaches them all again, resuming deliveries
+ * that were in flight where the links allow it, see
+ * pn_link_set_resumable().
+ *
+ * @return an error code, or 0 on success
+ */
 PN_EXTERN int pn_transport_unbind(pn_transport_t *transport);
 
 /** Retrieve the first Session that matches the given state mask.
@@ -304,6 +314,33 @@ PN_EXTERN void *pn_connection_get_context(pn_connection_t *connection);
  */
 PN_EXTERN void pn_connection_set_context(pn_connection_t *connection, void *context);
 
+/** Heap memory held by a connection and everything it owns, as
+ * reported by ::pn_connection_memory_usage. Sizes are in bytes and
+ * leave out allocator overhead and any SASL or SSL layer state.
+ */
+typedef struct {
+  size_t connection;     /**< the connection and its open properties */
+  size_t sessions;       /**< sessions, their delivery maps and handle tables */
+  size_t links;          /**< links with their names, termini and conditions */
+  size_t deliveries;     /**< unsettled and pooled deliveries, including
+                              their tags, buffered bytes and dispositions */
+  size_t transport;      /**< the bound transport with its frame and I/O buffers */
+  size_t total;          /**< the sum of all of the above */
+  size_t session_count;
+  size_t link_count;
+  size_t delivery_count;
+} pn_memory_usage_t;
+
+/** Measure the memory held by a connection, for sizing hosts that
+ * carry many links. This walks every session, link and unsettled
+ * delivery, so it is not meant to be called on a hot path.
+ *
+ * @param[in] connection the connection to measure
+ * @param[out] usage filled in with the connection's memory usage
+ * @return 0 on success, or PN_ARG_ERR
+ */
+PN_EXTERN int pn_connection_memory_usage(pn_connection_t *connection, pn_memory_usage_t *usage);
+
 
 // transport
 PN_EXTERN pn_error_t *pn_transport_error(pn_transport_t *transport);
@@ -368,13 +405,15 @@ PN_EXTERN int pn_transport_process(pn_transport_t *transport, size_t size);
 PN_EXTERN int pn_transport_close_tail(pn_transport_t *transport);
 
 /** Report the number of pending output bytes following the
- * transport's head pointer. If the engine is in an exceptional state
- * such as encountering an error condition or reaching the end of
- * stream state, a negative value will be returned indicating the
- * condition. If an error is indicated, further details can be
- * obtained from ::pn_transport_error. Calls to ::pn_transport_pop may
- * alter the value of this pointer. See ::pn_transport_pop for
- * details.
+ * transport's head pointer. Output is queued in fixed size chunks,
+ * so this only covers the first of them; ::pn_transport_head_vec
+ * describes all of the queued output. If the engine is in an
+ * exceptional state such as encountering an error condition or
+ * reaching the end of stream state, a negative value will be
+ * returned indicating the condition. If an error is indicated,
+ * further details can be obtained from ::pn_transport_error. Calls
+ * to ::pn_transport_pop may alter the value of this pointer. See
+ * ::pn_transport_pop for details.
  *
  * @param[in] the transport
  * @return the number of pending output bytes, or an error code
@@ -392,9 +431,22 @@ PN_EXTERN ssize_t pn_transport_pending(pn_transport_t *transport);
  */
 PN_EXTERN const char *pn_transport_head(pn_transport_t *transport);
 
+/** Describe the queued output as a vector of contiguous segments,
+ * starting at the transport's head pointer, suitable for a gathering
+ * write. Like ::pn_transport_head this does not generate output, so
+ * call ::pn_transport_pending first. The segments remain valid until
+ * the next call to ::pn_transport_pop or ::pn_transport_pending.
+ *
+ * @param[in] transport the transport
+ * @param[out] vec the segments of queued output
+ * @param[in] count the number of segments vec can hold
+ * @return the number of segments filled in, or an error code if < 0
+ */
+PN_EXTERN int pn_transport_head_vec(pn_transport_t *transport, pn_bytes_t *vec, int count);
+
 /** Copies ::size bytes from the head of the transport to the ::dst
  * pointer. It is an error to call this with a value of ::size that is
- * greater than the value reported by ::pn_transport_pending.
+ * greater than the total output queued.
  *
  * @param[in] transport the transport
  * @return 0 on success, or error code if < 0
@@ -402,9 +454,11 @@ PN_EXTERN const char *pn_transport_head(pn_transport_t *transport);
 PN_EXTERN int pn_transport_peek(pn_transport_t *transport, char *dst, size_t size);
 
 /** Removes ::size bytes of output from the pending output queue
- * following the transport's head pointer. Calls to this function may
- * alter the transport's head pointer as well as the number of pending
- * bytes reported by ::pn_transport_pending.
+ * following the transport's head pointer. The bytes removed may
+ * span several of the segments reported by ::pn_transport_head_vec.
+ * Calls to this function may alter the transport's head pointer as
+ * well as the number of pending bytes reported by
+ * ::pn_transport_pending.
  *
  * @param[in] the transport
  * @param[size] the number of bytes to remove
@@ -439,12 +493,120 @@ PN_EXTERN void pn_transport_trace(pn_transport_t *transport, pn_trace_t trace);
 PN_EXTERN uint32_t pn_transport_get_max_frame(pn_transport_t *transport);
 PN_EXTERN void pn_transport_set_max_frame(pn_transport_t *transport, uint32_t size);
 PN_EXTERN uint32_t pn_transport_get_remote_max_frame(pn_transport_t *transport);
+
+/** Enable or disable adaptive frame sizing. When enabled (the
+ * default) outgoing transfers are fragmented into frames sized from
+ * the socket send buffer, the TLS record size and the sizes of
+ * recently sent messages, within the peer's max-frame. The max frame
+ * advertised to the peer is unaffected; see
+ * ::pn_transport_set_max_frame.
+ *
+ * @param[in] transport the transport
+ * @param[in] adaptive true to size frames adaptively
+ */
+PN_EXTERN void pn_transport_set_adaptive_frame(pn_transport_t *transport, bool adaptive);
+PN_EXTERN bool pn_transport_get_adaptive_frame(pn_transport_t *transport);
+
+/** Tell the transport the send buffer size of the socket it writes
+ * to. Drivers call this when the transport is created.
+ *
+ * @param[in] transport the transport
+ * @param[in] size the socket send buffer size in bytes
+ */
+PN_EXTERN void pn_transport_set_send_buffer_hint(pn_transport_t *transport, size_t size);
+
+/** Report the size outgoing transfer frames are currently limited
+ * to, zero meaning unlimited.
+ *
+ * @param[in] transport the transport
+ * @return the outgoing frame size in bytes
+ */
+PN_EXTERN uint32_t pn_transport_get_output_frame(pn_transport_t *transport);
 /* timeout of zero means "no timeout" */
 PN_EXTERN pn_millis_t pn_transport_get_idle_timeout(pn_transport_t *transport);
 PN_EXTERN void pn_transport_set_idle_timeout(pn_transport_t *transport, pn_millis_t timeout);
 PN_EXTERN pn_millis_t pn_transport_get_remote_idle_timeout(pn_transport_t *transport);
 PN_EXTERN uint64_t pn_transport_get_frames_output(const pn_transport_t *transport);
 PN_EXTERN uint64_t pn_transport_get_frames_input(const pn_transport_t *transport);
+
+/** Frame kinds tracked by ::pn_transport_stats_t. The performatives
+ * appear in protocol order; empty (keepalive) frames are tracked
+ * separately.
+ */
+typedef enum {
+  PN_STATS_OPEN,
+  PN_STATS_BEGIN,
+  PN_STATS_ATTACH,
+  PN_STATS_FLOW,
+  PN_STATS_TRANSFER,
+  PN_STATS_DISPOSITION,
+  PN_STATS_DETACH,
+  PN_STATS_END,
+  PN_STATS_CLOSE,
+  PN_STATS_EMPTY,
+  PN_STATS_FRAME_KINDS
+} pn_stats_frame_t;
+
+/** Number of buckets in a ::pn_transport_stats_t latency histogram.
+ * Bucket 0 counts samples of 0us, bucket i counts samples in the
+ * range [2^(i-1), 2^i) microseconds, and the last bucket also counts
+ * everything larger.
+ */
+#define PN_STATS_BUCKETS (24)
+
+/** Protocol statistics gathered by a transport.
+ *
+ * Frame and byte counters, high-water marks and window stalls are
+ * always maintained. The latency histograms, pn_process timings and
+ * the time spent in window stalls and credit starvation are only
+ * gathered while timing is enabled with
+ * ::pn_transport_set_stats_timing. All times are in microseconds.
+ */
+typedef struct {
+  uint64_t frames_input[PN_STATS_FRAME_KINDS];
+  uint64_t bytes_input[PN_STATS_FRAME_KINDS];
+  uint64_t frames_output[PN_STATS_FRAME_KINDS];
+  uint64_t bytes_output[PN_STATS_FRAME_KINDS];
+  uint64_t decode_time[PN_STATS_BUCKETS];
+  uint64_t encode_time[PN_STATS_BUCKETS];
+  uint64_t process_calls;
+  uint64_t process_time;
+  size_t output_high_water;   /* transport output buffer */
+  size_t frame_high_water;    /* encoded frames awaiting the transport */
+  uint64_t window_stalls;     /* sends blocked by a closed session window */
+  uint64_t window_stall_time;
+  uint64_t credit_starvation_time; /* summed over all sender links */
+  uint64_t window_exhausted;  /* incoming session windows that ran out
+                                 while there was room to reopen them */
+  uint64_t resumed_deliveries; /* carried over from a previous transport */
+  uint64_t resent_bytes;      /* of those, payload transferred again */
+  uint64_t resumed_bytes;     /* and payload the receiver already had */
+} pn_transport_stats_t;
+
+/** Access the statistics gathered by a transport. The returned
+ * pointer remains valid for the lifetime of the transport and is
+ * updated in place. Stalls and starvation still in progress are
+ * counted up to the time of the call.
+ *
+ * @param[in] transport the transport
+ * @return the transport's statistics
+ */
+PN_EXTERN const pn_transport_stats_t *pn_transport_stats(pn_transport_t *transport);
+
+/** Reset all statistics gathered by a transport to zero.
+ *
+ * @param[in] transport the transport
+ */
+PN_EXTERN void pn_transport_stats_reset(pn_transport_t *transport);
+
+/** Enable or disable gathering of latency statistics. Timing is off
+ * by default since it reads a clock for every frame.
+ *
+ * @param[in] transport the transport
+ * @param[in] enabled true to gather timings
+ */
+PN_EXTERN void pn_transport_set_stats_timing(pn_transport_t *transport, bool enabled);
+PN_EXTERN bool pn_transport_get_stats_timing(pn_transport_t *transport);
 PN_EXTERN bool pn_transport_quiesced(pn_transport_t *transport);
 PN_EXTERN void pn_transport_free(pn_transport_t *transport);
 
@@ -458,6 +620,14 @@ PN_EXTERN void pn_session_free(pn_session_t *session);
 PN_EXTERN void *pn_session_get_context(pn_session_t *session);
 PN_EXTERN void pn_session_set_context(pn_session_t *session, void *context);
 
+/** Report how many times outgoing transfers on this session were
+ * blocked because the remote incoming window was closed.
+ *
+ * @param[in] session the session
+ * @return the number of window stalls
+ */
+PN_EXTERN uint64_t pn_session_window_stalls(pn_session_t *session);
+
 // link
 PN_EXTERN pn_link_t *pn_sender(pn_session_t *session, const char *name);
 PN_EXTERN pn_link_t *pn_receiver(pn_session_t *session, const char *name);
@@ -483,10 +653,107 @@ PN_EXTERN pn_rcv_settle_mode_t pn_link_remote_rcv_settle_mode(pn_link_t *link);
 PN_EXTERN void pn_link_set_snd_settle_mode(pn_link_t *link, pn_snd_settle_mode_t);
 PN_EXTERN void pn_link_set_rcv_settle_mode(pn_link_t *link, pn_rcv_settle_mode_t);
 
+/** Number of strict priority classes a link may be placed in. */
+#define PN_LINK_PRIORITIES (8)
+
+/** Set the egress priority class of a sender link. Transfer frames
+ * from links in a higher class are always sent before those of a
+ * lower class; links within a class share the connection by
+ * deficit round robin according to their weights. The default
+ * priority is 0.
+ *
+ * @param[in] link a sender link
+ * @param[in] priority a class from 0 to PN_LINK_PRIORITIES - 1
+ * @return 0 on success, PN_ARG_ERR if the class is out of range
+ */
+PN_EXTERN int pn_link_set_priority(pn_link_t *link, int priority);
+PN_EXTERN int pn_link_get_priority(pn_link_t *link);
+
+/** Set the share of its priority class given to a sender link. A
+ * link of weight 2 may send twice as many bytes per scheduling round
+ * as a link of weight 1. The default weight is 1.
+ *
+ * @param[in] link a sender link
+ * @param[in] weight a weight of at least 1
+ * @return 0 on success, PN_ARG_ERR if the weight is zero
+ */
+PN_EXTERN int pn_link_set_weight(pn_link_t *link, uint32_t weight);
+PN_EXTERN uint32_t pn_link_get_weight(pn_link_t *link);
+
+/** Bound the memory a receiver link uses for any one delivery. Once
+ * a delivery's buffered payload would grow past size bytes, it and
+ * the rest of the delivery are written to a temporary file instead,
+ * which pn_link_recv() then reads from. Spilled payload does not count
+ * against the session's incoming capacity, which otherwise applies
+ * back-pressure through the incoming window once that much is
+ * buffered. The default of 0 never spills.
+ *
+ * @param[in] receiver a receiver link
+ * @param[in] size the most payload bytes to hold in memory per delivery
+ */
+PN_EXTERN void pn_link_set_max_buffered(pn_link_t *receiver, size_t size);
+PN_EXTERN size_t pn_link_get_max_buffered(pn_link_t *receiver);
+
+/** Let a sender link resume deliveries that were in flight when its
+ * transport was unbound. A resumable sender keeps the payload of each
+ * unsettled delivery until it is settled, so once the connection is
+ * bound to a new transport and the link attached again, each such
+ * delivery is transferred again from the offset the receiver reports
+ * having reached instead of from the start. Deliveries the receiver
+ * no longer lists are sent again in full. Links are not resumable by
+ * default, in which case an unsettled delivery that was partly or
+ * wholly transferred is left for the application to resend.
+ *
+ * @param[in] sender a sender link
+ * @param[in] resumable whether to keep payload for resumption
+ */
+PN_EXTERN void pn_link_set_resumable(pn_link_t *sender, bool resumable);
+PN_EXTERN bool pn_link_is_resumable(pn_link_t *sender);
+
+/** Report the total time a sender link spent with deliveries ready
+ * to send but no credit from the remote receiver. Only time spent
+ * while stats timing is enabled on the transport is counted, see
+ * ::pn_transport_set_stats_timing.
+ *
+ * @param[in] link a sender link
+ * @return credit starvation time in microseconds
+ */
+PN_EXTERN uint64_t pn_link_credit_starvation(pn_link_t *link);
+
 PN_EXTERN int pn_link_unsettled(pn_link_t *link);
 PN_EXTERN pn_delivery_t *pn_unsettled_head(pn_link_t *link);
 PN_EXTERN pn_delivery_t *pn_unsettled_next(pn_delivery_t *delivery);
 
+/** Get the newest delivery up to which the remote peer has settled
+ * every delivery on the link. Deliveries the application has already
+ * settled are skipped over. This lets a bulk acknowledgement be
+ * consumed by settling from pn_unsettled_head() up to the returned
+ * delivery rather than by inspecting each delivery in turn.
+ *
+ * @param[in] link a link
+ * @return the newest delivery of the remotely settled prefix of the
+ *         unsettled deliveries, or NULL if the oldest one is not
+ *         remotely settled
+ */
+PN_EXTERN pn_delivery_t *pn_link_remote_settled_upto(pn_link_t *link);
+
+/** Settle every unsettled delivery on a link up to and including the
+ * given one, in the order they were created, optionally giving them
+ * all the same outcome first. This has the effect of calling
+ * pn_delivery_update() and pn_delivery_settle() on each of them, and
+ * the peer is told in as few disposition frames as the delivery-ids
+ * allow.
+ *
+ * @param[in] link a link
+ * @param[in] delivery the newest delivery to settle, which must be an
+ *                     unsettled delivery of the link
+ * @param[in] outcome the outcome to apply, or 0 to keep the state each
+ *                    delivery already has
+ * @return the number of deliveries settled, or an error code if the
+ *         delivery is not an unsettled delivery of the link
+ */
+PN_EXTERN int pn_link_settle_upto(pn_link_t *link, pn_delivery_t *delivery, uint64_t outcome);
+
 PN_EXTERN void pn_link_open(pn_link_t *sender);
 PN_EXTERN void pn_link_close(pn_link_t *sender);
 PN_EXTERN void pn_link_free(pn_link_t *sender);
@@ -496,6 +763,24 @@ PN_EXTERN void pn_link_set_context(pn_link_t *link, void *context);
 // sender
 PN_EXTERN void pn_link_offered(pn_link_t *sender, int credit);
 PN_EXTERN ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n);
+
+/** Send a complete message on a link as a pre-settled delivery. When
+ * the link is attached, has credit, has no deliveries queued ahead of
+ * the message, and the message fits in one frame, the transfer is
+ * encoded into the transport's output at once. No delivery is created
+ * and nothing about the message is kept afterwards. In any other case
+ * the message is queued and settled as an ordinary delivery would be.
+ * A transfer written straight to the output is not subject to the link
+ * priorities of the egress scheduler.
+ *
+ * @param[in] sender a sender link whose settle mode is not
+ *                   PN_SND_UNSETTLED, with no current delivery
+ * @param[in] tag the delivery tag
+ * @param[in] bytes the encoded message
+ * @param[in] n the size of the message
+ * @return n, or an error code
+ */
+PN_EXTERN ssize_t pn_link_send_settled(pn_link_t *sender, pn_delivery_tag_t tag, const char *bytes, size_t n);
 PN_EXTERN void pn_link_drained(pn_link_t *sender);
 //void pn_link_abort(pn_sender_t *sender);
 
@@ -539,6 +824,23 @@ PN_EXTERN uint64_t pn_delivery_remote_state(pn_delivery_t *delivery);
 PN_EXTERN bool pn_delivery_settled(pn_delivery_t *delivery);
 PN_EXTERN size_t pn_delivery_pending(pn_delivery_t *delivery);
 PN_EXTERN bool pn_delivery_partial(pn_delivery_t *delivery);
+
+/** @return true if the payload of a received delivery was spilled to
+ * a temporary file, see ::pn_link_set_max_buffered
+ */
+PN_EXTERN bool pn_delivery_spilled(pn_delivery_t *delivery);
+
+/** Access the unread payload of a complete, readable delivery without
+ * copying it. Spilled payload is mapped from its file. Reading with
+ * pn_link_recv() does not invalidate the mapping, but advancing past
+ * or settling the delivery does.
+ *
+ * @param[in] delivery the current delivery of a receiver link
+ * @param[out] size set to the number of bytes available
+ * @return the payload, or NULL if the delivery is partial, is not
+ *         readable, or its file cannot be mapped
+ */
+PN_EXTERN const char *pn_delivery_map(pn_delivery_t *delivery, size_t *size);
 PN_EXTERN bool pn_delivery_writable(pn_delivery_t *delivery);
 PN_EXTERN bool pn_delivery_readable(pn_delivery_t *delivery);
 PN_EXTERN bool pn_delivery_updated(pn_delivery_t *delivery);
@@ -557,12 +859,38 @@ PN_EXTERN uint32_t pn_disposition_get_section_number(pn_disposition_t *dispositi
 PN_EXTERN void pn_disposition_set_section_number(pn_disposition_t *disposition, uint32_t section_number);
 PN_EXTERN uint64_t pn_disposition_get_section_offset(pn_disposition_t *disposition);
 PN_EXTERN void pn_disposition_set_section_offset(pn_disposition_t *disposition, uint64_t section_offset);
+PN_EXTERN bool pn_disposition_is_settled(pn_disposition_t *disposition);
 PN_EXTERN bool pn_disposition_is_failed(pn_disposition_t *disposition);
 PN_EXTERN void pn_disposition_set_failed(pn_disposition_t *disposition, bool failed);
 PN_EXTERN bool pn_disposition_is_undeliverable(pn_disposition_t *disposition);
 PN_EXTERN void pn_disposition_set_undeliverable(pn_disposition_t *disposition, bool undeliverable);
 PN_EXTERN pn_data_t *pn_disposition_annotations(pn_disposition_t *disposition);
 
+/** Set a disposition to carry a transaction identifier. Used with
+ * ::PN_DECLARED by a coordinator declaring a transaction, or with
+ * ::PN_TRANSACTIONAL_STATE to make a transfer or an outcome part of a
+ * transaction. The disposition takes effect once passed to
+ * pn_delivery_update() with the matching type.
+ *
+ * @param[in] disposition a local disposition
+ * @param[in] txn_id the transaction identifier
+ * @param[in] outcome the outcome within the transaction, e.g.
+ *            ::PN_ACCEPTED, or 0 for none
+ * @return 0 on success, an error code otherwise
+ */
+PN_EXTERN int pn_disposition_set_txn(pn_disposition_t *disposition, pn_bytes_t txn_id,
+                                     uint64_t outcome);
+
+/** @return the transaction identifier of a ::PN_DECLARED or
+ * ::PN_TRANSACTIONAL_STATE disposition, empty if there is none
+ */
+PN_EXTERN pn_bytes_t pn_disposition_get_txn(pn_disposition_t *disposition);
+
+/** @return the outcome a ::PN_TRANSACTIONAL_STATE disposition gives
+ * within its transaction, or 0 if there is none
+ */
+PN_EXTERN uint64_t pn_disposition_get_txn_outcome(pn_disposition_t *disposition);
+
 // conditions
 PN_EXTERN pn_condition_t *pn_connection_condition(pn_connection_t *connection);
 PN_EXTERN pn_condition_t *pn_connection_remote_condition(pn_connection_t *connection);
@@ -0,0 +1,141 @@
+#ifndef PROTON_EVENT_H
+#define PROTON_EVENT_H 1
+
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/import_export.h>
+#include <proton/engine.h>
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @file
+ * API for engine events.
+ *
+ * A collector attached to a connection records what happens to the
+ * connection and everything it owns as it happens, so an application
+ * can react to just the changes since it last looked instead of
+ * scanning work lists and endpoint lists for them.
+ */
+
+typedef struct pn_collector_t pn_collector_t;
+typedef struct pn_event_t pn_event_t;
+
+/** The kinds of event a collector records.
+ */
+typedef enum {
+  PN_EVENT_NONE = 0,
+  PN_CONNECTION_LOCAL_STATE,  /**< the connection was opened or closed locally */
+  PN_CONNECTION_REMOTE_STATE, /**< the peer opened or closed the connection */
+  PN_SESSION_LOCAL_STATE,     /**< a session was opened or closed locally */
+  PN_SESSION_REMOTE_STATE,    /**< the peer opened or closed a session */
+  PN_LINK_LOCAL_STATE,        /**< a link was opened or closed locally */
+  PN_LINK_REMOTE_STATE,       /**< the peer opened or closed a link */
+  PN_LINK_FLOW,               /**< the peer updated a link's flow state */
+  PN_DELIVERY,                /**< a delivery became readable, or the peer
+                                   updated or settled it */
+  PN_TRANSPORT,               /**< the transport has new output to write */
+  PN_DELIVERY_RANGE           /**< the peer updated or settled a range of a
+                                   session's deliveries in one frame; each
+                                   has its remote state set already and is
+                                   on the connection's work list */
+} pn_event_type_t;
+
+/** The name of an event type, for logging.
+ *
+ * @param[in] type an event type
+ * @return the name of the type
+ */
+PN_EXTERN const char *pn_event_type_name(pn_event_type_t type);
+
+/** Construct a collector.
+ *
+ * @return a new, empty collector
+ */
+PN_EXTERN pn_collector_t *pn_collector(void);
+
+/** Free a collector along with any events it still holds. A
+ * connection the collector is attached to stops recording events.
+ *
+ * @param[in] collector a collector to free, or NULL
+ */
+PN_EXTERN void pn_collector_free(pn_collector_t *collector);
+
+/** Record an event. Consecutive events of the same type for the same
+ * object are recorded once. The event holds a reference to its
+ * object until it is popped.
+ *
+ * @param[in] collector the collector
+ * @param[in] type the type of event
+ * @param[in] context the connection, session, link or delivery the
+ *                    event is about, the connection for transport
+ *                    events
+ */
+PN_EXTERN void pn_collector_put(pn_collector_t *collector, pn_event_type_t type, void *context);
+
+/** Access the oldest event in a collector.
+ *
+ * @param[in] collector the collector
+ * @return the oldest event, or NULL if there are none; it remains
+ *         valid until it is popped
+ */
+PN_EXTERN pn_event_t *pn_collector_peek(pn_collector_t *collector);
+
+/** Discard the oldest event in a collector.
+ *
+ * @param[in] collector the collector
+ * @return true if an event was discarded
+ */
+PN_EXTERN bool pn_collector_pop(pn_collector_t *collector);
+
+/** Record the events of a connection, and of its sessions, links,
+ * deliveries and transport, in a collector.
+ *
+ * @param[in] connection the connection
+ * @param[in] collector the collector, or NULL to stop recording
+ */
+PN_EXTERN void pn_connection_collect(pn_connection_t *connection, pn_collector_t *collector);
+
+/** @return the type of an event */
+PN_EXTERN pn_event_type_t pn_event_type(pn_event_t *event);
+
+/** The objects an event is about. An event about a delivery is also
+ * about its link, session and connection, and so on up.
+ *
+ * @param[in] event an event
+ * @return the object, or NULL if the event is not about one
+ */
+PN_EXTERN pn_connection_t *pn_event_connection(pn_event_t *event);
+PN_EXTERN pn_session_t *pn_event_session(pn_event_t *event);
+PN_EXTERN pn_link_t *pn_event_link(pn_event_t *event);
+PN_EXTERN pn_delivery_t *pn_event_delivery(pn_event_t *event);
+PN_EXTERN pn_transport_t *pn_event_transport(pn_event_t *event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* event.h */
@@ -222,6 +222,36 @@ PN_EXTERN int pn_messenger_get_incoming_window(pn_messenger_t *messenger);
  */
 PN_EXTERN int pn_messenger_set_incoming_window(pn_messenger_t *messenger, int window);
 
+/** Gets the transaction batch for a Messenger. @see
+ * ::pn_messenger_set_txn_batch
+ *
+ * @param[in] messenger the messenger
+ *
+ * @return the transaction batch, zero if transactions are not used
+ */
+PN_EXTERN int pn_messenger_get_txn_batch(pn_messenger_t *messenger);
+
+/** Sets the transaction batch for a Messenger. If the batch is set to
+ *  a positive value, the Messenger declares a transaction with the
+ *  peer of each connection and makes the messages it sends, and the
+ *  messages accepted or rejected on that connection, part of it. Once
+ *  at least that many have been done in the transaction it is
+ *  discharged and another one declared, so that the peer can commit
+ *  them together. Outgoing messages wait while a transaction is being
+ *  declared or discharged. Messages accepted or rejected while none is
+ *  active are acknowledged outside of any transaction. If the peer has
+ *  no transaction coordinator, transactions are not used on that
+ *  connection. @see ::pn_messenger_commit
+ *
+ * @param[in] messenger the Messenger
+ * @param[in] batch the number of messages per transaction, zero to
+ *            not use transactions
+ *
+ * @return an error or zero on success
+ * @see error.h
+ */
+PN_EXTERN int pn_messenger_set_txn_batch(pn_messenger_t *messenger, int batch);
+
 /** Starts a messenger. A messenger cannot send or recv messages until
  * it is started.
  *
@@ -328,6 +358,17 @@ PN_EXTERN int pn_messenger_interrupt(pn_messenger_t *messenger);
  */
 PN_EXTERN int pn_messenger_send(pn_messenger_t *messenger, int n);
 
+/** Discharges the transactions in progress on every connection without
+ * waiting for them to reach the transaction batch, and blocks until
+ * the peers have committed them. @see ::pn_messenger_set_txn_batch
+ *
+ * @param[in] messenger the messenger
+ *
+ * @return an error code or zero on success
+ * @see error.h
+ */
+PN_EXTERN int pn_messenger_commit(pn_messenger_t *messenger);
+
 /** Instructs the messenger to receives up to limit messages into the
  * incoming message queue of a messenger. If limit is -1, Messenger
  * will receive as many messages as it can buffer internally. If the
@@ -59,6 +59,19 @@ typedef struct {
     PREFIX ## _inspect                          \
 }
 
+// counts kept by each thread of the objects of a class it makes and
+// frees; only classes the library pools for reuse are counted unless
+// counting is turned on for the thread. An object freed by another
+// thread than the one that made it is counted by both, so live may go
+// below zero
+typedef struct {
+  int64_t live;      // made less freed
+  int64_t peak;      // most live at once
+  size_t pooled;     // kept for reuse
+  uint64_t created;  // made, reused or not
+  uint64_t reused;   // made from the pool
+} pn_class_stats_t;
+
 PN_EXTERN void *pn_new(size_t size, pn_class_t *clazz);
 PN_EXTERN void *pn_incref(void *object);
 PN_EXTERN void pn_decref(void *object);
@@ -69,6 +82,10 @@ PN_EXTERN uintptr_t pn_hashcode(void *object);
 PN_EXTERN intptr_t pn_compare(void *a, void *b);
 PN_EXTERN bool pn_equals(void *a, void *b);
 PN_EXTERN int pn_inspect(void *object, pn_string_t *dst);
+PN_EXTERN void pn_class_stats(pn_class_t *clazz, pn_class_stats_t *stats);
+PN_EXTERN void pn_class_set_counting(bool counting);
+PN_EXTERN bool pn_class_get_counting(void);
+PN_EXTERN void pn_class_release(pn_class_t *clazz);
 
 #define PN_REFCOUNT (0x1)
 
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "util.h"
+#include "platform.h"
 
 struct pn_buffer_t {
   size_t capacity;
@@ -36,24 +37,206 @@ struct pn_buffer_t {
   char *bytes;
 };
 
+// Buffers and their bytes are kept for reuse once freed, in a pool per
+// thread. Capacities up to the largest size class are rounded up to a
+// power of two so that a freed block fits any buffer of its class.
+// Bigger buffers come straight from malloc.
+#define PNI_POOL_MIN_SHIFT (6)
+#define PNI_POOL_CLASSES (11)
+#define PNI_POOL_MAX_BLOCK ((size_t) 1 << (PNI_POOL_MIN_SHIFT + PNI_POOL_CLASSES - 1))
+#define PNI_POOL_DEFAULT_CAPACITY (1024*1024)
+// what is kept once a connection or transport is freed, as a fraction
+// of the capacity
+#define PNI_POOL_REST (4)
+
+typedef union pni_block_t {
+  union pni_block_t *next;
+  pn_buffer_t buffer;
+} pni_block_t;
+
+typedef struct {
+  size_t capacity;  // most bytes kept, 0 if nothing is kept
+  size_t cached;    // bytes kept at present
+  bool hooked;      // released when the thread exits
+  pni_block_t *buffers;
+  pni_block_t *blocks[PNI_POOL_CLASSES];
+  size_t counts[PNI_POOL_CLASSES];
+} pni_pool_t;
+
+#ifdef PN_THREAD_LOCAL
+static PN_THREAD_LOCAL pni_pool_t pni_pool = {PNI_POOL_DEFAULT_CAPACITY, 0, false, NULL, {NULL}, {0}};
+
+static pni_pool_t *pni_pool_get(void)
+{
+  return &pni_pool;
+}
+#else
+static pni_pool_t *pni_pool_get(void)
+{
+  return NULL;
+}
+#endif
+
+// the size class of a capacity, or -1 if it is too big for one
+static int pni_pool_class(size_t capacity)
+{
+  if (capacity > PNI_POOL_MAX_BLOCK) return -1;
+  int cls = 0;
+  while (((size_t) 1 << (PNI_POOL_MIN_SHIFT + cls)) < capacity) cls++;
+  return cls;
+}
+
+static size_t pni_pool_round(size_t capacity)
+{
+  if (!capacity) return 0;
+  int cls = pni_pool_class(capacity);
+  return cls < 0 ? capacity : (size_t) 1 << (PNI_POOL_MIN_SHIFT + cls);
+}
+
+static void pni_pool_exit(void)
+{
+  pn_buffer_pool_trim(0);
+}
+
+// whether the pool has room for size more bytes; nothing is kept by a
+// thread that would not give it back on exit
+static bool pni_pool_keeps(pni_pool_t *pool, size_t size)
+{
+  if (!pool || pool->cached + size > pool->capacity) return false;
+  if (!pool->hooked) {
+    if (pn_i_thread_exit(pni_pool_exit)) {
+      pool->capacity = 0;
+      return false;
+    }
+    pool->hooked = true;
+  }
+  return true;
+}
+
+static char *pni_pool_alloc(size_t capacity)
+{
+  pni_pool_t *pool = pni_pool_get();
+  int cls = pni_pool_class(capacity);
+  if (pool && cls >= 0 && pool->blocks[cls]) {
+    pni_block_t *block = pool->blocks[cls];
+    pool->blocks[cls] = block->next;
+    pool->counts[cls]--;
+    pool->cached -= capacity;
+    return (char *) block;
+  }
+  return (char *) malloc(capacity);
+}
+
+static void pni_pool_release(char *bytes, size_t capacity)
+{
+  if (!bytes) return;
+  pni_pool_t *pool = pni_pool_get();
+  int cls = pni_pool_class(capacity);
+  if (cls >= 0 && capacity >= sizeof(pni_block_t) && pni_pool_keeps(pool, capacity)) {
+    pni_block_t *block = (pni_block_t *) bytes;
+    block->next = pool->blocks[cls];
+    pool->blocks[cls] = block;
+    pool->counts[cls]++;
+    pool->cached += capacity;
+  } else {
+    free(bytes);
+  }
+}
+
+size_t pn_buffer_pool_trim(size_t keep)
+{
+  pni_pool_t *pool = pni_pool_get();
+  if (!pool) return 0;
+  size_t released = 0;
+  // the largest blocks go first, they are the least likely to be wanted
+  for (int cls = PNI_POOL_CLASSES - 1; cls >= 0 && pool->cached > keep; cls--) {
+    size_t size = (size_t) 1 << (PNI_POOL_MIN_SHIFT + cls);
+    while (pool->blocks[cls] && pool->cached > keep) {
+      pni_block_t *block = pool->blocks[cls];
+      pool->blocks[cls] = block->next;
+      pool->counts[cls]--;
+      pool->cached -= size;
+      released += size;
+      free(block);
+    }
+  }
+  while (pool->buffers && pool->cached > keep) {
+    pni_block_t *block = pool->buffers;
+    pool->buffers = block->next;
+    pool->cached -= sizeof(pni_block_t);
+    released += sizeof(pni_block_t);
+    free(block);
+  }
+  return released;
+}
+
+size_t pni_buffer_pool_rest(void)
+{
+  pni_pool_t *pool = pni_pool_get();
+  return pool ? pn_buffer_pool_trim(pool->capacity / PNI_POOL_REST) : 0;
+}
+
+size_t pn_buffer_pool_cached(void)
+{
+  pni_pool_t *pool = pni_pool_get();
+  return pool ? pool->cached : 0;
+}
+
+size_t pn_buffer_pool_get_capacity(void)
+{
+  pni_pool_t *pool = pni_pool_get();
+  return pool ? pool->capacity : 0;
+}
+
+void pn_buffer_pool_set_capacity(size_t capacity)
+{
+  pni_pool_t *pool = pni_pool_get();
+  if (!pool) return;
+  pool->capacity = capacity;
+  pn_buffer_pool_trim(capacity);
+}
+
 pn_buffer_t *pn_buffer(size_t capacity)
 {
-  pn_buffer_t *buf = (pn_buffer_t *) malloc(sizeof(pn_buffer_t));
+  pni_pool_t *pool = pni_pool_get();
+  pn_buffer_t *buf;
+  if (pool && pool->buffers) {
+    pni_block_t *block = pool->buffers;
+    pool->buffers = block->next;
+    pool->cached -= sizeof(pni_block_t);
+    buf = &block->buffer;
+  } else {
+    buf = (pn_buffer_t *) malloc(sizeof(pni_block_t));
+  }
+  capacity = pni_pool_round(capacity);
   buf->capacity = capacity;
   buf->start = 0;
   buf->size = 0;
-  buf->bytes = capacity ? (char *) malloc(capacity) : NULL;
+  buf->bytes = capacity ? pni_pool_alloc(capacity) : NULL;
   return buf;
 }
 
 void pn_buffer_free(pn_buffer_t *buf)
 {
   if (buf) {
-    free(buf->bytes);
-    free(buf);
+    pni_pool_release(buf->bytes, buf->capacity);
+    pni_pool_t *pool = pni_pool_get();
+    if (pni_pool_keeps(pool, sizeof(pni_block_t))) {
+      pni_block_t *block = (pni_block_t *) buf;
+      block->next = pool->buffers;
+      pool->buffers = block;
+      pool->cached += sizeof(pni_block_t);
+    } else {
+      free(buf);
+    }
   }
 }
 
+size_t pni_buffer_footprint(pn_buffer_t *buf)
+{
+  return buf ? sizeof(pn_buffer_t) + buf->capacity : 0;
+}
+
 size_t pn_buffer_size(pn_buffer_t *buf)
 {
   return buf->size;
@@ -132,9 +315,17 @@ int pn_buffer_ensure(pn_buffer_t *buf, size_t size)
   while (pn_buffer_available(buf) < size) {
     buf->capacity = 2*(buf->capacity ? buf->capacity : 16);
   }
+  buf->capacity = pni_pool_round(buf->capacity);
 
   if (buf->capacity != old_capacity) {
-    buf->bytes = (char *) realloc(buf->bytes, buf->capacity);
+    if (pni_pool_class(buf->capacity) < 0 && pni_pool_class(old_capacity) < 0) {
+      buf->bytes = (char *) realloc(buf->bytes, buf->capacity);
+    } else {
+      char *bytes = pni_pool_alloc(buf->capacity);
+      if (old_capacity) memcpy(bytes, buf->bytes, old_capacity);
+      pni_pool_release(buf->bytes, old_capacity);
+      buf->bytes = bytes;
+    }
 
     if (wrapped) {
       size_t n = old_capacity - old_head;
@@ -258,7 +449,11 @@ static void pn_buffer_rotate (pn_buffer_t *buf, size_t sz) {
 
 int pn_buffer_defrag(pn_buffer_t *buf)
 {
-  pn_buffer_rotate(buf, buf->start);
+  if (pn_buffer_wrapped(buf)) {
+    pn_buffer_rotate(buf, buf->start);
+  } else if (buf->size) {
+    memmove(buf->bytes, buf->bytes + buf->start, buf->size);
+  }
   buf->start = 0;
   return 0;
 }
@@ -266,13 +461,28 @@ int pn_buffer_defrag(pn_buffer_t *buf)
 pn_bytes_t pn_buffer_bytes(pn_buffer_t *buf)
 {
   if (buf) {
-    pn_buffer_defrag(buf);
-    return pn_bytes(buf->size, buf->bytes);
+    // only a wrapped buffer has to be moved to be read in one piece, an
+    // empty one is reset so its whole capacity follows the start
+    if (pn_buffer_wrapped(buf) || !buf->size) pn_buffer_defrag(buf);
+    return pn_bytes(buf->size, buf->bytes + buf->start);
   } else {
     return pn_bytes(0, NULL);
   }
 }
 
+size_t pn_buffer_segments(pn_buffer_t *buf, pn_bytes_t *head, pn_bytes_t *tail)
+{
+  if (!buf || !buf->size) {
+    *head = pn_bytes(0, NULL);
+    *tail = pn_bytes(0, NULL);
+    return 0;
+  }
+
+  *head = pn_bytes(pn_buffer_head_size(buf), buf->bytes + pn_buffer_head(buf));
+  *tail = pn_bytes(pn_buffer_tail_size(buf), buf->bytes);
+  return tail->size ? 2 : 1;
+}
+
 int pn_buffer_print(pn_buffer_t *buf)
 {
   printf("pn_buffer(\"");
@@ -1063,7 +1063,7 @@ static int pn_data_inspect(void *obj, pn_string_t *dst)
 pn_data_t *pn_data(size_t capacity)
 {
   static pn_class_t clazz = {pn_data_finalize, NULL, NULL, pn_data_inspect};
-  pn_data_t *data = (pn_data_t *) pn_new(sizeof(pn_data_t), &clazz);
+  pn_data_t *data = (pn_data_t *) pni_new(sizeof(pn_data_t), &clazz, 64);
   data->capacity = capacity;
   data->size = 0;
   data->nodes = capacity ? (pn_node_t *) malloc(capacity * sizeof(pn_node_t)) : NULL;
@@ -1079,6 +1079,16 @@ pn_data_t *pn_data(size_t capacity)
   return data;
 }
 
+size_t pni_data_footprint(pn_data_t *data)
+{
+  if (!data) return 0;
+  return pni_object_footprint(sizeof(pn_data_t)) +
+    data->capacity * sizeof(pn_node_t) +
+    data->iatom_capacity * sizeof(pn_iatom_t) +
+    pni_buffer_footprint(data->buf) +
+    pni_error_footprint(data->error);
+}
+
 void pn_data_free(pn_data_t *data)
 {
   pn_free(data);
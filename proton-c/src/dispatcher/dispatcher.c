@@ -28,6 +28,7 @@
 #include "dispatcher.h"
 #include "protocol.h"
 #include "../util.h"
+#include "../platform.h"
 #include "../platform_fmt.h"
 
 pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, void *context)
@@ -48,6 +49,10 @@ pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, void *context)
   disp->size = 0;
 
   disp->output_args = pn_data(16);
+  disp->output_payload = NULL;
+  disp->output_size = 0;
+  disp->output_head = 0;
+  disp->output_rest = NULL;
   disp->frame = pn_buffer( 4*1024 );
   // XXX
   disp->capacity = 4*1024;
@@ -68,6 +73,7 @@ void pn_dispatcher_free(pn_dispatcher_t *disp)
     pn_data_free(disp->output_args);
     pn_buffer_free(disp->frame);
     free(disp->output);
+    free(disp->scratch);
     free(disp);
   }
 }
@@ -80,10 +86,46 @@ void pn_dispatcher_action(pn_dispatcher_t *disp, uint8_t code,
 
 typedef enum {IN, OUT} pn_dir_t;
 
+// maps a performative descriptor onto its pn_stats_frame_t slot
+static inline int pni_stats_kind(uint64_t code)
+{
+  return (code >= OPEN && code <= CLOSE) ? (int) (code - OPEN) : -1;
+}
+
+static void pni_stats_sample(uint64_t *histogram, uint64_t usec)
+{
+  int bucket = 0;
+  while (usec && bucket < PN_STATS_BUCKETS - 1) {
+    usec >>= 1;
+    bucket++;
+  }
+  histogram[bucket]++;
+}
+
+// returns the time the sample was taken, for back-to-back frames
+static uint64_t pni_stats_output(pn_dispatcher_t *disp, int kind, size_t size, uint64_t start)
+{
+  pn_transport_stats_t *stats = &disp->stats;
+  if (kind >= 0) {
+    stats->frames_output[kind]++;
+    stats->bytes_output[kind] += size;
+  }
+  if (disp->available > stats->frame_high_water)
+    stats->frame_high_water = disp->available;
+  if (!disp->timing) return 0;
+  uint64_t now = pn_i_now_usec();
+  pni_stats_sample(stats->encode_time, now - start);
+  return now;
+}
+
 static void pn_do_trace(pn_dispatcher_t *disp, uint16_t ch, pn_dir_t dir,
                         pn_data_t *args, const char *payload, size_t size)
 {
   if (disp->trace & PN_TRACE_FRM) {
+    if (!disp->scratch) {
+      disp->scratch = (char *) malloc(SCRATCH);
+      if (!disp->scratch) return;
+    }
     size_t n = SCRATCH;
     pn_data_format(args, disp->scratch, &n);
     pn_dispatcher_trace(disp, ch, "%s %s", dir == OUT ? "->" : "<-",
@@ -111,12 +153,16 @@ void pn_dispatcher_trace(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ..
 
 int pn_dispatch_frame(pn_dispatcher_t *disp, pn_frame_t frame)
 {
+  size_t wire_size = AMQP_HEADER_SIZE + frame.ex_size + frame.size;
   if (frame.size == 0) { // ignore null frames
+    disp->stats.frames_input[PN_STATS_EMPTY]++;
+    disp->stats.bytes_input[PN_STATS_EMPTY] += wire_size;
     if (disp->trace & PN_TRACE_FRM)
       pn_dispatcher_trace(disp, frame.channel, "<- (EMPTY FRAME)\n");
     return 0;
   }
 
+  uint64_t start = disp->timing ? pn_i_now_usec() : 0;
   ssize_t dsize = pn_data_decode(disp->args, frame.payload, frame.size);
   if (dsize < 0) {
     fprintf(stderr, "Error decoding frame: %s %s\n", pn_code(dsize),
@@ -139,6 +185,14 @@ int pn_dispatch_frame(pn_dispatcher_t *disp, pn_frame_t frame)
     fprintf(stderr, "Error dispatching frame\n");
     return PN_ERR;
   }
+  if (disp->timing)
+    pni_stats_sample(disp->stats.decode_time, pn_i_now_usec() - start);
+  int kind = pni_stats_kind(lcode);
+  if (kind >= 0) {
+    disp->stats.frames_input[kind]++;
+    disp->stats.bytes_input[kind] += wire_size;
+  }
+
   uint8_t code = lcode;
   disp->code = code;
   disp->size = frame.size - dsize;
@@ -197,12 +251,52 @@ void pn_set_payload(pn_dispatcher_t *disp, const char *data, size_t size)
 {
   disp->output_payload = data;
   disp->output_size = size;
+  disp->output_head = size;
+  disp->output_rest = NULL;
+}
+
+void pn_set_payload_segments(pn_dispatcher_t *disp, pn_bytes_t head, pn_bytes_t tail)
+{
+  disp->output_payload = head.start;
+  disp->output_size = head.size + tail.size;
+  disp->output_head = head.size;
+  disp->output_rest = tail.start;
+}
+
+// copies the next size bytes of the payload, crossing into the second
+// segment once the first runs out
+static void pni_payload_copy(pn_dispatcher_t *disp, char *dst, size_t size)
+{
+  size_t n = pn_min(size, disp->output_head);
+  // an empty first segment may have no bytes behind it at all
+  if (n) {
+    memmove(dst, disp->output_payload, n);
+    disp->output_payload += n;
+    disp->output_head -= n;
+  }
+  if (n < size) {
+    memmove(dst + n, disp->output_rest, size - n);
+    disp->output_payload = disp->output_rest + (size - n);
+    disp->output_head = disp->output_size - size;
+    disp->output_rest = NULL;
+  }
+  disp->output_size -= size;
 }
 
 int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...)
 {
+  uint64_t start = disp->timing ? pn_i_now_usec() : 0;
+  int kind = -1;
   va_list ap;
   va_start(ap, fmt);
+  if (!fmt[0]) {
+    kind = PN_STATS_EMPTY;
+  } else if (fmt[0] == 'D' && fmt[1] == 'L') {
+    va_list aq;
+    va_copy(aq, ap);
+    kind = pni_stats_kind(va_arg(aq, uint64_t));
+    va_end(aq);
+  }
   pn_data_clear(disp->output_args);
   int err = pn_data_vfill(disp->output_args, fmt, ap);
   va_end(ap);
@@ -245,6 +339,7 @@ int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...)
     fprintf(stderr, "\"\n");
   }
   disp->available += n;
+  pni_stats_output(disp, kind, n, start);
 
   return 0;
 }
@@ -267,19 +362,35 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
                            uint32_t message_format,
                            bool settled,
                            bool more,
+                           uint64_t state_code,
+                           pn_data_t *state,
+                           bool resume,
                            pn_sequence_t frame_limit)
 {
   bool more_flag = more;
   int framecount = 0;
+  uint64_t start = disp->timing ? pn_i_now_usec() : 0;
+
+  size_t max_frame = disp->remote_max_frame;
+  if (disp->output_max_frame && (!max_frame || disp->output_max_frame < max_frame))
+    max_frame = disp->output_max_frame;
 
   // create preformatives, assuming 'more' flag need not change
 
  compute_performatives:
   pn_data_clear(disp->output_args);
-  int err = pn_data_fill(disp->output_args, "DL[IIzIoo]", TRANSFER,
-                         handle, id, tag->size, tag->start,
-                         message_format,
-                         settled, more_flag);
+  // the state and resume flag follow rcv-settle-mode, which is never sent
+  int err = (resume || state_code) ?
+    pn_data_fill(disp->output_args, "DL[IIzIoon?DLCo]", TRANSFER,
+                 handle, id, tag->size, tag->start,
+                 message_format,
+                 settled, more_flag,
+                 (bool) state_code, state_code, state,
+                 resume) :
+    pn_data_fill(disp->output_args, "DL[IIzIoo]", TRANSFER,
+                 handle, id, tag->size, tag->start,
+                 message_format,
+                 settled, more_flag);
   if (err) {
     fprintf(stderr, "error posting transfer frame: %s: %s\n", pn_code(err), pn_data_error(disp->output_args));
     return PN_ERR;
@@ -305,9 +416,9 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
 
     // check if we need to break up the outbound frame
     size_t available = disp->output_size;
-    if (disp->remote_max_frame) {
-      if ((available + buf.size) > disp->remote_max_frame - 8) {
-        available = disp->remote_max_frame - 8 - buf.size;
+    if (max_frame) {
+      if ((available + buf.size) > max_frame - 8) {
+        available = max_frame - 8 - buf.size;
         if (more_flag == false) {
           more_flag = true;
           goto compute_performatives;  // deal with flag change
@@ -325,11 +436,10 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
       goto encode_performatives;
     }
 
-    pn_do_trace(disp, ch, OUT, disp->output_args, disp->output_payload, available);
+    pn_do_trace(disp, ch, OUT, disp->output_args, disp->output_payload,
+                pn_min(available, disp->output_head));
 
-    memmove( buf.start + buf.size, disp->output_payload, available);
-    disp->output_payload += available;
-    disp->output_size -= available;
+    pni_payload_copy(disp, buf.start + buf.size, available);
     buf.size += available;
 
     pn_frame_t frame = {disp->frame_type};
@@ -351,8 +461,10 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp, uint16_t ch,
       fprintf(stderr, "\"\n");
     }
     disp->available += n;
+    start = pni_stats_output(disp, PN_STATS_TRANSFER, n, start);
   } while (disp->output_size > 0 && framecount < frame_limit);
 
   disp->output_payload = NULL;
+  disp->output_rest = NULL;
   return framecount;
 }
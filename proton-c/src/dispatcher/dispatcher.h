@@ -28,6 +28,7 @@
 #endif
 #include <proton/buffer.h>
 #include <proton/codec.h>
+#include <proton/engine.h>
 
 typedef struct pn_dispatcher_t pn_dispatcher_t;
 
@@ -49,8 +50,11 @@ struct pn_dispatcher_t {
   size_t size;
   pn_data_t *output_args;
   const char *output_payload;
-  size_t output_size;
+  size_t output_size;   // payload left to send, over both segments
+  size_t output_head;   // how much of it output_payload points at
+  const char *output_rest; // the second segment of the payload, if any
   size_t remote_max_frame;
+  size_t output_max_frame; // preferred transfer frame size, 0 for remote_max_frame
   pn_buffer_t *frame;  // frame under construction
   size_t capacity;
   size_t available; /* number of raw bytes pending output */
@@ -60,7 +64,9 @@ struct pn_dispatcher_t {
   bool batch;
   uint64_t output_frames_ct;
   uint64_t input_frames_ct;
-  char scratch[SCRATCH];
+  bool timing;
+  pn_transport_stats_t stats;
+  char *scratch;  // frame trace buffer, allocated once tracing
 };
 
 pn_dispatcher_t *pn_dispatcher(uint8_t frame_type, void *context);
@@ -69,6 +75,7 @@ void pn_dispatcher_action(pn_dispatcher_t *disp, uint8_t code,
                           pn_action_t *action);
 int pn_scan_args(pn_dispatcher_t *disp, const char *fmt, ...);
 void pn_set_payload(pn_dispatcher_t *disp, const char *data, size_t size);
+void pn_set_payload_segments(pn_dispatcher_t *disp, pn_bytes_t head, pn_bytes_t tail);
 int pn_post_frame(pn_dispatcher_t *disp, uint16_t ch, const char *fmt, ...);
 ssize_t pn_dispatcher_input(pn_dispatcher_t *disp, const char *bytes, size_t available);
 ssize_t pn_dispatcher_output(pn_dispatcher_t *disp, char *bytes, size_t size);
@@ -81,5 +88,8 @@ int pn_post_transfer_frame(pn_dispatcher_t *disp,
                            uint32_t message_format,
                            bool settled,
                            bool more,
+                           uint64_t state_code,
+                           pn_data_t *state,
+                           bool resume,
                            pn_sequence_t frame_limit);
 #endif /* dispatcher.h */
@@ -25,6 +25,7 @@
 #include <proton/object.h>
 #include <proton/buffer.h>
 #include <proton/engine.h>
+#include <proton/event.h>
 #include <proton/types.h>
 #include "../dispatcher/dispatcher.h"
 #include "../util.h"
@@ -33,12 +34,25 @@ typedef enum pn_endpoint_type_t {CONNECTION, SESSION, SENDER, RECEIVER} pn_endpo
 
 typedef struct pn_endpoint_t pn_endpoint_t;
 
-#define COND_NAME_MAX (256)
-#define COND_DESC_MAX (1024)
+// endpoints with pending transport work are queued by kind, so each
+// phase of pn_process only visits the endpoints it can act on
+typedef enum {
+  PN_DIRTY_CONNECTION,
+  PN_DIRTY_SESSION,
+  PN_DIRTY_LINK,
+  PN_DIRTY_KINDS
+} pn_dirty_kind_t;
 
+typedef struct {
+  pn_endpoint_t *transport_head;
+  pn_endpoint_t *transport_tail;
+} pn_dirty_queue_t;
+
+// Every endpoint and disposition carries conditions that are almost
+// never set, so their parts are only allocated once they are.
 struct pn_condition_t {
-  char name[COND_NAME_MAX];
-  char description[COND_DESC_MAX];
+  pn_string_t *name;
+  pn_string_t *description;
   pn_data_t *info;
 };
 
@@ -52,26 +66,78 @@ struct pn_endpoint_t {
   pn_endpoint_t *endpoint_prev;
   pn_endpoint_t *transport_next;
   pn_endpoint_t *transport_prev;
+  pn_endpoint_t *index_next;      // see pn_state_bucket_t
+  pn_endpoint_t *index_prev;
+  pn_connection_t *connection;    // NULL once unlinked from it
+  uint64_t seq;                   // creation order within the connection
   bool modified;
 };
 
+// Sessions and links are also kept in one list per combination of
+// local and remote state, each sorted by creation order, so that
+// pn_session_head and pn_link_head only visit the endpoints that match.
+#define PN_STATE_BUCKETS (9)
+
+typedef struct {
+  pn_endpoint_t *index_head;
+  pn_endpoint_t *index_tail;
+  pn_endpoint_t *cursor;  // last endpoint passed over by a lookup
+} pn_state_bucket_t;
+
 typedef struct {
   pn_sequence_t id;
   bool sent;
   bool init;
 } pn_delivery_state_t;
 
+// Deliveries indexed by delivery-id. Ids are assigned serially, so the
+// map is a ring of slots covering [base, base + span), where base is the
+// lowest id still in use. Slots are allocated on first use and the ring
+// doubles when full.
 typedef struct {
   pn_sequence_t next;
-  pn_hash_t *deliveries;
+  pn_sequence_t base;
+  size_t span;
+  size_t head;       // slot holding base
+  size_t capacity;   // zero or a power of two
+  pn_delivery_t **slots;
 } pn_delivery_map_t;
 
+#define PN_DELIVERY_MAP_MIN (16)
+
+// Delivery-ids first..last, all given the same outcome and settled
+// flag, whose disposition has yet to be sent.
+typedef struct {
+  uint64_t code;
+  pn_sequence_t first;
+  pn_sequence_t last;
+  bool settled;
+  bool role;
+} pn_disp_range_t;
+
+// Pending dispositions as disjoint ranges sorted by role, settled flag,
+// outcome and then first id, so that deliveries settled out of order
+// still go out in as few disposition frames as possible.
+typedef struct {
+  pn_disp_range_t *ranges;
+  size_t size;
+  size_t capacity;
+} pn_disp_set_t;
+
+#define PN_DISP_SET_MIN (16)
+
 typedef struct {
   // XXX: stop using negative numbers
   uint32_t local_handle;
   uint32_t remote_handle;
   pn_sequence_t delivery_count;
   pn_sequence_t link_credit;
+  bool starved;             // out of credit with a delivery waiting
+  uint64_t starved_since;   // start of current starvation, or 0 when not timed
+  uint64_t starvation_time;
+  int64_t deficit;          // egress scheduler deficit counter, in bytes
+  bool flow_pending;        // link state changed since the last flow, see pni_flow
+  pn_sequence_t resuming;   // deliveries from a previous transport not yet resumed
 } pn_link_state_t;
 
 typedef struct {
@@ -88,16 +154,18 @@ typedef struct {
   pn_sequence_t outgoing_window;
   pn_hash_t *local_handles;
   pn_hash_t *remote_handles;
+  uint32_t next_handle;  // where the search for a free handle starts
 
-  uint64_t disp_code;
-  bool disp_settled;
-  bool disp_type;
-  pn_sequence_t disp_first;
-  pn_sequence_t disp_last;
-  bool disp;
-} pn_session_state_t;
+  pn_disp_set_t disp;
 
-#define SCRATCH (1024)
+  uint64_t window_stalls;
+  bool stalled;             // remote incoming window closed with a transfer waiting
+  uint64_t stalled_since;   // start of current stall, or 0 when not timed
+
+  pn_sequence_t window_low; // reopen the incoming window at or below this, see pni_window_refresh
+  bool flow_pending;        // session state to be sent in a flow, see pni_flow
+  bool detached;            // begun on a previous transport, see pn_transport_unbind
+} pn_session_state_t;
 
 #include <proton/sasl.h>
 #include <proton/ssl.h>
@@ -112,6 +180,16 @@ typedef struct pn_io_layer_t {
   size_t (*buffered_input)(struct pn_io_layer_t *);   // how much input is held
 } pn_io_layer_t;
 
+#define PNI_CHUNK_SIZE (16 * 1024)
+
+// a fixed size piece of the transport's output
+typedef struct pni_chunk_t {
+  struct pni_chunk_t *next;
+  size_t start;     // first byte not yet popped
+  size_t end;       // one past the last byte produced
+  char bytes[PNI_CHUNK_SIZE];
+} pni_chunk_t;
+
 struct pn_transport_t {
   size_t header_count;
   pn_sasl_t *sasl;
@@ -128,10 +206,27 @@ struct pn_transport_t {
   pn_data_t *remote_desired_capabilities;
   pn_data_t *remote_properties;
   pn_data_t *disp_data;
+  pn_disposition_t *disp_outcome; // see pni_disposition_outcome
+  pn_data_t *unsettled_data; // the unsettled map of an attach sent or received
+  pn_data_t *target_data;    // the target of an attach sent, see pni_target_encode
+  // decoded terminus and condition data, copied out only when present
+#define PN_SCAN_DATA (6)
+  pn_data_t *scan_data[PN_SCAN_DATA];
   //#define PN_DEFAULT_MAX_FRAME_SIZE (16*1024)
 #define PN_DEFAULT_MAX_FRAME_SIZE (0)  /* for now, allow unlimited size */
   uint32_t   local_max_frame;
   uint32_t   remote_max_frame;
+
+  /* adaptive frame sizing, see pni_frame_policy() */
+#define PN_ADAPTIVE_FRAME_FLOOR (4*1024)
+#define PN_ADAPTIVE_FRAME_CEILING (64*1024)
+#define PN_TLS_RECORD_SIZE (16*1024)
+  /* stop scheduling transfers once this much output is queued */
+#define PN_EGRESS_BUDGET (2*PN_ADAPTIVE_FRAME_CEILING)
+  bool       adaptive_frame;
+  size_t     send_buffer_hint;  /* socket send buffer, 0 if unknown */
+  size_t     record_size;       /* TLS record payload, 0 if not encrypted */
+  size_t     message_size;      /* moving average of outgoing messages */
   pn_condition_t remote_condition;
 
 #define PN_IO_SSL  0
@@ -153,16 +248,19 @@ struct pn_transport_t {
   pn_error_t *error;
   pn_hash_t *local_channels;
   pn_hash_t *remote_channels;
-  char scratch[SCRATCH];
+  uint32_t next_channel; // where the search for a free channel starts
 
   /* statistics */
   uint64_t bytes_input;
   uint64_t bytes_output;
 
-  /* output buffered for send */
-  size_t output_size;
+  /* output buffered for send, as a list of fixed size chunks */
+  pni_chunk_t *output_head;
+  pni_chunk_t *output_tail;
+  pni_chunk_t *output_free;  // emptied chunks kept for reuse
+  int output_free_count;
+  size_t output_size;        // bytes held in chunks, in use or free
   size_t output_pending;
-  char *output_buf;
 
   /* input from peer */
   size_t input_size;
@@ -176,14 +274,21 @@ struct pn_connection_t {
   pn_endpoint_t endpoint;
   pn_endpoint_t *endpoint_head;
   pn_endpoint_t *endpoint_tail;
-  pn_endpoint_t *transport_head;
-  pn_endpoint_t *transport_tail;
+  pn_dirty_queue_t dirty[PN_DIRTY_KINDS];
+  pn_state_bucket_t session_index[PN_STATE_BUCKETS];
+  pn_state_bucket_t link_index[PN_STATE_BUCKETS];
+  uint64_t endpoint_seq;
   pn_list_t *sessions;
   pn_transport_t *transport;
   pn_delivery_t *work_head;
   pn_delivery_t *work_tail;
   pn_delivery_t *tpwork_head;
   pn_delivery_t *tpwork_tail;
+  pn_link_t *sched_head[PN_LINK_PRIORITIES];  // egress scheduler rings
+  pn_link_t *sched_tail[PN_LINK_PRIORITIES];
+  pn_delivery_t *delivery_pool;  // settled deliveries kept for reuse
+  uint64_t settle_count;         // deliveries fully settled so far
+  pn_collector_t *collector;     // see pn_connection_collect
   pn_string_t *container;
   pn_string_t *hostname;
   pn_data_t *offered_capabilities;
@@ -196,6 +301,7 @@ struct pn_session_t {
   pn_endpoint_t endpoint;
   pn_connection_t *connection;
   pn_list_t *links;
+  pn_hash_t *link_names; // see pn_find_link
   void *context;
   size_t incoming_capacity;
   pn_sequence_t incoming_bytes;
@@ -205,6 +311,8 @@ struct pn_session_t {
   pn_session_state_t state;
 };
 
+// The address and data of a terminus are NULL until first set or
+// accessed, see pni_terminus_data.
 struct pn_terminus_t {
   pn_terminus_type_t type;
   pn_string_t *address;
@@ -229,9 +337,8 @@ struct pn_link_t {
   pn_terminus_t remote_target;
   pn_delivery_t *unsettled_head;
   pn_delivery_t *unsettled_tail;
+  pn_delivery_t *remote_settled_upto; // see pn_link_remote_settled_upto
   pn_delivery_t *current;
-  pn_delivery_t *settled_head;
-  pn_delivery_t *settled_tail;
   uint8_t snd_settle_mode;
   uint8_t rcv_settle_mode;
   uint8_t remote_snd_settle_mode;
@@ -242,8 +349,18 @@ struct pn_link_t {
   pn_sequence_t queued;
   bool drain;
   bool drained; // sender only
+  uint8_t priority;
+  uint32_t weight;
+  size_t max_buffered; // receiver only, spill deliveries past this, 0 never
+  bool resumable;      // sender only, keep transferred payload until settled
   void *context;
   pn_link_state_t state;
+  // egress scheduler ring membership, see pni_schedule_transfers
+  pn_link_t *sched_next;
+  pn_link_t *sched_prev;
+  bool scheduled;
+  pn_delivery_t *sched_delivery; // only valid within pn_process_tpwork
+  pn_link_t *name_next; // next link in the same link_names bucket
 };
 
 struct pn_disposition_t {
@@ -258,17 +375,31 @@ struct pn_disposition_t {
   bool settled;
 };
 
+#define PN_DELIVERY_TAG_INLINE (32)
+
+// Where a delivery carried over from a previous transport stands, see
+// pn_transport_unbind. Both ends list these in the unsettled map of
+// their next attach; the sender then transfers each again from the
+// offset the receiver reports, with the resume flag set.
+typedef enum {
+  PNI_RESUME_NONE,
+  PNI_RESUME_PENDING,   // waiting for the peer's unsettled map
+  PNI_RESUME_READY,     // sender only, to be transferred again
+  PNI_RESUME_EXPECTED   // receiver only, waiting for the resumed transfer
+} pni_resume_t;
+
 struct pn_delivery_t {
   pn_link_t *link;
-  pn_buffer_t *tag;
+  size_t tag_size;
+  char tag_inline[PN_DELIVERY_TAG_INLINE];
+  pn_buffer_t *tag;  // only used for tags that do not fit inline
   pn_disposition_t local;
   pn_disposition_t remote;
   bool updated;
   bool settled; // tracks whether we're in the unsettled list or not
   pn_delivery_t *unsettled_next;
   pn_delivery_t *unsettled_prev;
-  pn_delivery_t *settled_next;
-  pn_delivery_t *settled_prev;
+  pn_delivery_t *pool_next;
   pn_delivery_t *work_next;
   pn_delivery_t *work_prev;
   bool work;
@@ -276,16 +407,23 @@ struct pn_delivery_t {
   pn_delivery_t *tpwork_prev;
   bool tpwork;
   pn_buffer_t *bytes;
+  // received payload past the link's max_buffered goes to a temporary
+  // file instead of bytes, see pni_delivery_append
+  FILE *spill;
+  uint64_t spill_size;   // bytes written to the file
+  uint64_t spill_read;   // bytes of it consumed by pn_link_recv
+  void *map;             // see pn_delivery_map
+  uint64_t map_size;
+  pn_buffer_t *sent;     // payload transferred so far, on resumable links
+  uint64_t transferred;  // payload bytes sent or received so far
+  pni_resume_t resume;
   bool done;
   void *context;
   pn_delivery_state_t state;
 };
 
-#define PN_SET_LOCAL(OLD, NEW)                                          \
-  (OLD) = ((OLD) & PN_REMOTE_MASK) | (NEW)
-
-#define PN_SET_REMOTE(OLD, NEW)                                         \
-  (OLD) = ((OLD) & PN_LOCAL_MASK) | (NEW)
+void pn_set_local(pn_endpoint_t *endpoint, pn_state_t state);
+void pn_set_remote(pn_endpoint_t *endpoint, pn_state_t state);
 
 void pn_link_dump(pn_link_t *link);
 
@@ -40,18 +40,132 @@ static ssize_t transport_consume(pn_transport_t *transport);
 
 void pn_delivery_map_init(pn_delivery_map_t *db, pn_sequence_t next)
 {
-  db->deliveries = pn_hash(1024, 0.75, PN_REFCOUNT);
   db->next = next;
+  db->base = next;
+  db->span = 0;
+  db->head = 0;
+  db->capacity = 0;
+  db->slots = NULL;
 }
 
 void pn_delivery_map_free(pn_delivery_map_t *db)
 {
-  pn_free(db->deliveries);
+  for (size_t i = 0; i < db->span; i++) {
+    pn_decref(db->slots[(db->head + i) & (db->capacity - 1)]);
+  }
+  free(db->slots);
+  db->slots = NULL;
+  db->capacity = 0;
+  db->span = 0;
+}
+
+// offset of id from the lowest id in use, in serial number arithmetic
+// so that the map keeps working when ids wrap around
+static inline size_t pni_delivery_map_offset(pn_delivery_map_t *db, pn_sequence_t id)
+{
+  return (uint32_t) id - (uint32_t) db->base;
 }
 
 pn_delivery_t *pn_delivery_map_get(pn_delivery_map_t *db, pn_sequence_t id)
 {
-  return (pn_delivery_t *) pn_hash_get(db->deliveries, id);
+  size_t offset = pni_delivery_map_offset(db, id);
+  if (offset >= db->span) return NULL;
+  return db->slots[(db->head + offset) & (db->capacity - 1)];
+}
+
+static int pni_delivery_map_grow(pn_delivery_map_t *db)
+{
+  size_t capacity = db->capacity ? 2*db->capacity : PN_DELIVERY_MAP_MIN;
+  pn_delivery_t **slots = (pn_delivery_t **) malloc(capacity*sizeof(pn_delivery_t *));
+  if (!slots) return PN_ERR;
+  for (size_t i = 0; i < db->span; i++) {
+    slots[i] = db->slots[(db->head + i) & (db->capacity - 1)];
+  }
+  memset(slots + db->span, 0, (capacity - db->span)*sizeof(pn_delivery_t *));
+  free(db->slots);
+  db->slots = slots;
+  db->capacity = capacity;
+  db->head = 0;
+  return 0;
+}
+
+void pn_disp_set_free(pn_disp_set_t *set)
+{
+  free(set->ranges);
+  set->ranges = NULL;
+  set->size = 0;
+  set->capacity = 0;
+}
+
+// orders a range against the position id would take under the given
+// key, comparing ids in serial number arithmetic
+static int pni_disp_range_cmp(pn_disp_range_t *range, bool role, bool settled,
+                              uint64_t code, pn_sequence_t id)
+{
+  if (range->role != role) return range->role ? 1 : -1;
+  if (range->settled != settled) return range->settled ? 1 : -1;
+  if (range->code != code) return range->code < code ? -1 : 1;
+  int32_t diff = (int32_t) ((uint32_t) range->first - (uint32_t) id);
+  return diff < 0 ? -1 : diff > 0;
+}
+
+static bool pni_disp_range_keyed(pn_disp_range_t *range, bool role, bool settled, uint64_t code)
+{
+  return range->role == role && range->settled == settled && range->code == code;
+}
+
+int pn_disp_set_add(pn_disp_set_t *set, bool role, bool settled, uint64_t code, pn_sequence_t id)
+{
+  // find the first range ordered after id
+  size_t lo = 0, hi = set->size;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo)/2;
+    if (pni_disp_range_cmp(&set->ranges[mid], role, settled, code, id) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  pn_disp_range_t *prev = NULL;
+  pn_disp_range_t *next = NULL;
+  if (lo > 0 && pni_disp_range_keyed(&set->ranges[lo - 1], role, settled, code))
+    prev = &set->ranges[lo - 1];
+  if (lo < set->size && pni_disp_range_keyed(&set->ranges[lo], role, settled, code))
+    next = &set->ranges[lo];
+
+  if (prev && (int32_t) ((uint32_t) id - (uint32_t) prev->last) <= 0) {
+    return 0;   // already pending
+  }
+
+  bool extends_prev = prev && (uint32_t) id == (uint32_t) prev->last + 1;
+  bool extends_next = next && (uint32_t) id + 1 == (uint32_t) next->first;
+  if (extends_prev && extends_next) {
+    prev->last = next->last;
+    memmove(next, next + 1, (set->size - lo - 1)*sizeof(pn_disp_range_t));
+    set->size--;
+  } else if (extends_prev) {
+    prev->last = id;
+  } else if (extends_next) {
+    next->first = id;
+  } else {
+    if (set->size == set->capacity) {
+      size_t capacity = set->capacity ? 2*set->capacity : PN_DISP_SET_MIN;
+      pn_disp_range_t *ranges = (pn_disp_range_t *) realloc(set->ranges, capacity*sizeof(pn_disp_range_t));
+      if (!ranges) return PN_ERR;
+      set->ranges = ranges;
+      set->capacity = capacity;
+    }
+    memmove(set->ranges + lo + 1, set->ranges + lo, (set->size - lo)*sizeof(pn_disp_range_t));
+    pn_disp_range_t *range = &set->ranges[lo];
+    range->code = code;
+    range->first = id;
+    range->last = id;
+    range->settled = settled;
+    range->role = role;
+    set->size++;
+  }
+
+  return 0;
 }
 
 static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *delivery, pn_sequence_t id)
@@ -63,29 +177,79 @@ static void pn_delivery_state_init(pn_delivery_state_t *ds, pn_delivery_t *deliv
 
 pn_delivery_state_t *pn_delivery_map_push(pn_delivery_map_t *db, pn_delivery_t *delivery)
 {
+  if (!db->span) {
+    db->base = db->next;
+    db->head = 0;
+  }
+  if (db->span == db->capacity && pni_delivery_map_grow(db)) return NULL;
+
   pn_delivery_state_t *ds = &delivery->state;
-  pn_delivery_state_init(ds, delivery, db->next++);
-  pn_hash_put(db->deliveries, ds->id, delivery);
+  pn_delivery_state_init(ds, delivery, db->next);
+  db->next = (uint32_t) db->next + 1;
+  db->slots[(db->head + db->span) & (db->capacity - 1)] = delivery;
+  db->span++;
+  pn_incref(delivery);
   return ds;
 }
 
+// Uses up the next id for a delivery that is never tracked. While
+// other deliveries are in use the id gets an empty slot, so the ids of
+// the map stay contiguous.
+static int pni_delivery_map_skip(pn_delivery_map_t *db, pn_sequence_t *id)
+{
+  if (db->span) {
+    if (db->span == db->capacity && pni_delivery_map_grow(db)) return PN_ERR;
+    db->slots[(db->head + db->span) & (db->capacity - 1)] = NULL;
+    db->span++;
+  }
+  *id = db->next;
+  db->next = (uint32_t) db->next + 1;
+  return 0;
+}
+
 void pn_delivery_map_del(pn_delivery_map_t *db, pn_delivery_t *delivery)
 {
-  pn_hash_del(db->deliveries, delivery->state.id);
+  size_t offset = pni_delivery_map_offset(db, delivery->state.id);
   delivery->state.init = false;
   delivery->state.sent = false;
+  if (offset >= db->span) return;
+
+  size_t mask = db->capacity - 1;
+  db->slots[(db->head + offset) & mask] = NULL;
+  // the lowest id in use moves up past any settled ones
+  while (db->span && !db->slots[db->head]) {
+    db->head = (db->head + 1) & mask;
+    db->base = (uint32_t) db->base + 1;
+    db->span--;
+  }
+  pn_decref(delivery);
 }
 
 void pn_delivery_map_clear(pn_delivery_map_t *dm)
 {
-  pn_hash_t *hash = dm->deliveries;
-  for (pn_handle_t entry = pn_hash_head(hash);
-       entry;
-       entry = pn_hash_next(hash, entry))
-  {
-    pn_delivery_t *dlv = (pn_delivery_t *) pn_hash_value(hash, entry);
-    pn_delivery_map_del(dm, dlv);
+  while (dm->span) {
+    pn_delivery_map_del(dm, dm->slots[dm->head]);
+  }
+}
+
+// Clips the delivery-ids first..last to the ids held by the map and
+// returns them as a run of slot offsets from base, false if none are.
+static bool pni_delivery_map_range(pn_delivery_map_t *db, pn_sequence_t first,
+                                   pn_sequence_t last, size_t *offset, size_t *count)
+{
+  uint32_t n = (uint32_t) last - (uint32_t) first;
+  if (n > INT32_MAX) n = 0;    // last precedes first, only first is meant
+  uint32_t lo = (uint32_t) first - (uint32_t) db->base;
+  uint32_t hi = lo + n;
+  if ((int32_t) lo < 0) {
+    if ((int32_t) hi < 0) return false;
+    lo = 0;
   }
+  if (lo >= db->span) return false;
+  if (hi >= db->span) hi = db->span - 1;
+  *offset = lo;
+  *count = hi - lo + 1;
+  return true;
 }
 
 // endpoints
@@ -106,18 +270,44 @@ pn_connection_t *pn_ep_get_connection(pn_endpoint_t *endpoint)
 }
 
 void pn_modified(pn_connection_t *connection, pn_endpoint_t *endpoint);
+void pn_clear_modified(pn_connection_t *connection, pn_endpoint_t *endpoint);
+
+static void pni_post_event(pn_connection_t *connection, pn_event_type_t type, void *context)
+{
+  if (connection && connection->collector)
+    pn_collector_put(connection->collector, type, context);
+}
+
+static void pni_post_state(pn_endpoint_t *endpoint, bool remote)
+{
+  pn_event_type_t type;
+  switch (endpoint->type) {
+  case CONNECTION:
+    type = remote ? PN_CONNECTION_REMOTE_STATE : PN_CONNECTION_LOCAL_STATE;
+    break;
+  case SESSION:
+    type = remote ? PN_SESSION_REMOTE_STATE : PN_SESSION_LOCAL_STATE;
+    break;
+  default:
+    type = remote ? PN_LINK_REMOTE_STATE : PN_LINK_LOCAL_STATE;
+    break;
+  }
+  pni_post_event(pn_ep_get_connection(endpoint), type, endpoint);
+}
 
 void pn_open(pn_endpoint_t *endpoint)
 {
   // TODO: do we care about the current state?
-  PN_SET_LOCAL(endpoint->state, PN_LOCAL_ACTIVE);
+  pn_set_local(endpoint, PN_LOCAL_ACTIVE);
+  pni_post_state(endpoint, false);
   pn_modified(pn_ep_get_connection(endpoint), endpoint);
 }
 
 void pn_close(pn_endpoint_t *endpoint)
 {
   // TODO: do we care about the current state?
-  PN_SET_LOCAL(endpoint->state, PN_LOCAL_CLOSED);
+  pn_set_local(endpoint, PN_LOCAL_CLOSED);
+  pni_post_state(endpoint, false);
   pn_modified(pn_ep_get_connection(endpoint), endpoint);
 }
 
@@ -140,9 +330,17 @@ void pn_connection_close(pn_connection_t *connection)
 
 void pn_endpoint_tini(pn_endpoint_t *endpoint);
 
+void pn_connection_collect(pn_connection_t *connection, pn_collector_t *collector)
+{
+  assert(connection);
+  pn_decref(connection->collector);
+  connection->collector = (pn_collector_t *) pn_incref(collector);
+}
+
 void pn_connection_free(pn_connection_t *connection)
 {
-  pn_free(connection);
+  // pending events may still hold references
+  pn_decref(connection);
 }
 
 void *pn_connection_get_context(pn_connection_t *conn)
@@ -158,16 +356,65 @@ void pn_connection_set_context(pn_connection_t *conn, void *context)
 
 void pn_condition_init(pn_condition_t *condition)
 {
-  condition->name[0] = '\0';
-  condition->description[0] = '\0';
-  condition->info = pn_data(16);
+  condition->name = NULL;
+  condition->description = NULL;
+  condition->info = NULL;
 }
 
 void pn_condition_tini(pn_condition_t *condition)
 {
-  pn_data_free(condition->info);
+  pn_free(condition->name);
+  pn_free(condition->description);
+  pn_free(condition->info);
+}
+
+// sets a lazily allocated string, only allocating it for a non-NULL value
+static int pni_string_assign(pn_string_t **dst, const char *src, size_t size)
+{
+  if (!*dst) {
+    if (!src) return 0;
+    *dst = pn_string(NULL);
+    if (!*dst) return PN_ERR;
+  }
+  return pn_string_setn(*dst, src, size);
 }
 
+// copies src into lazily allocated data, only allocating it if src is
+// not empty
+static int pni_data_assign(pn_data_t **dst, pn_data_t *src)
+{
+  if (!*dst) {
+    if (!pn_data_size(src)) return 0;
+    *dst = pn_data(16);
+    if (!*dst) return PN_ERR;
+  }
+  if (!src) {
+    pn_data_clear(*dst);
+    return 0;
+  }
+  return pn_data_copy(*dst, src);
+}
+
+// an unset or empty string reads as NULL
+static inline const char *pni_condition_str(pn_string_t *str)
+{
+  return (str && pn_string_size(str)) ? pn_string_get(str) : NULL;
+}
+
+static int pni_condition_copy(pn_condition_t *dst, pn_condition_t *src)
+{
+  const char *name = pni_condition_str(src->name);
+  const char *description = pni_condition_str(src->description);
+  int err = pni_string_assign(&dst->name, name, name ? strlen(name) : 0);
+  if (err) return err;
+  err = pni_string_assign(&dst->description, description,
+                          description ? strlen(description) : 0);
+  if (err) return err;
+  return pni_data_assign(&dst->info, src->info);
+}
+
+static void pn_disposition_finalize(pn_disposition_t *ds);
+
 void pn_transport_free(pn_transport_t *transport)
 {
   if (!transport) return;
@@ -181,13 +428,33 @@ void pn_transport_free(pn_transport_t *transport)
   pn_free(transport->remote_desired_capabilities);
   pn_free(transport->remote_properties);
   pn_free(transport->disp_data);
+  if (transport->disp_outcome) {
+    pn_disposition_finalize(transport->disp_outcome);
+    free(transport->disp_outcome);
+  }
+  pn_free(transport->unsettled_data);
+  pn_free(transport->target_data);
+  for (int i = 0; i < PN_SCAN_DATA; i++)
+    pn_free(transport->scan_data[i]);
   pn_error_free(transport->error);
   pn_condition_tini(&transport->remote_condition);
   pn_free(transport->local_channels);
   pn_free(transport->remote_channels);
   free(transport->input_buf);
-  free(transport->output_buf);
+  pni_chunk_t *chunk = transport->output_head;
+  while (chunk) {
+    pni_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  chunk = transport->output_free;
+  while (chunk) {
+    pni_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
   free(transport);
+  pni_buffer_pool_rest();
 }
 
 void pn_add_session(pn_connection_t *conn, pn_session_t *ssn)
@@ -196,8 +463,13 @@ void pn_add_session(pn_connection_t *conn, pn_session_t *ssn)
   ssn->connection = conn;
 }
 
+static void pni_sched_remove(pn_link_t *link);
+
 void pn_remove_session(pn_connection_t *conn, pn_session_t *ssn)
 {
+  for (size_t i = 0; i < pn_list_size(ssn->links); i++) {
+    pni_sched_remove((pn_link_t *) pn_list_get(ssn->links, i));
+  }
   ssn->connection = NULL;
   pn_list_remove(conn->sessions, ssn);
 }
@@ -223,6 +495,12 @@ void pn_session_free(pn_session_t *session)
     pn_remove_session(session->connection, session);
 }
 
+uint64_t pn_session_window_stalls(pn_session_t *session)
+{
+  assert(session);
+  return session->state.window_stalls;
+}
+
 void *pn_session_get_context(pn_session_t *session)
 {
     return session ? session->context : 0;
@@ -241,8 +519,55 @@ void pn_add_link(pn_session_t *ssn, pn_link_t *link)
   link->session = ssn;
 }
 
+// Links are indexed by a hash of their name and role so that an
+// incoming attach finds its link without scanning the session. Links
+// whose keys collide, including links that share a name and role, are
+// chained in creation order.
+static uintptr_t pni_link_key(const char *name, size_t size, pn_endpoint_type_t type)
+{
+  uintptr_t key = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    key = (key ^ (uint8_t) name[i]) * 16777619u;
+  }
+  return (key ^ type) * 16777619u;
+}
+
+static void pni_link_index(pn_session_t *ssn, pn_link_t *link)
+{
+  uintptr_t key = pni_link_key(pn_string_get(link->name), pn_string_size(link->name),
+                               link->endpoint.type);
+  link->name_next = NULL;
+  pn_link_t *tail = (pn_link_t *) pn_hash_get(ssn->link_names, key);
+  if (!tail) {
+    pn_hash_put(ssn->link_names, key, link);
+    return;
+  }
+  while (tail->name_next) tail = tail->name_next;
+  tail->name_next = link;
+}
+
+static void pni_link_unindex(pn_session_t *ssn, pn_link_t *link)
+{
+  uintptr_t key = pni_link_key(pn_string_get(link->name), pn_string_size(link->name),
+                               link->endpoint.type);
+  pn_link_t *head = (pn_link_t *) pn_hash_get(ssn->link_names, key);
+  if (head == link) {
+    if (link->name_next) {
+      pn_hash_put(ssn->link_names, key, link->name_next);
+    } else {
+      pn_hash_del(ssn->link_names, key);
+    }
+  } else {
+    while (head && head->name_next != link) head = head->name_next;
+    if (head) head->name_next = link->name_next;
+  }
+  link->name_next = NULL;
+}
+
 void pn_remove_link(pn_session_t *ssn, pn_link_t *link)
 {
+  pni_sched_remove(link);
+  pni_link_unindex(ssn, link);
   link->session = NULL;
   pn_list_remove(ssn->links, link);
 }
@@ -272,6 +597,70 @@ void pn_link_free(pn_link_t *link)
     pn_remove_link(link->session, link);
 }
 
+int pn_link_set_priority(pn_link_t *link, int priority)
+{
+  assert(link);
+  if (priority < 0 || priority >= PN_LINK_PRIORITIES) return PN_ARG_ERR;
+  if (link->priority != priority) {
+    pni_sched_remove(link);
+    link->priority = priority;
+  }
+  return 0;
+}
+
+int pn_link_get_priority(pn_link_t *link)
+{
+  assert(link);
+  return link->priority;
+}
+
+int pn_link_set_weight(pn_link_t *link, uint32_t weight)
+{
+  assert(link);
+  if (!weight) return PN_ARG_ERR;
+  link->weight = weight;
+  return 0;
+}
+
+uint32_t pn_link_get_weight(pn_link_t *link)
+{
+  assert(link);
+  return link->weight;
+}
+
+void pn_link_set_max_buffered(pn_link_t *receiver, size_t size)
+{
+  assert(receiver);
+  receiver->max_buffered = size;
+}
+
+size_t pn_link_get_max_buffered(pn_link_t *receiver)
+{
+  assert(receiver);
+  return receiver->max_buffered;
+}
+
+void pn_link_set_resumable(pn_link_t *sender, bool resumable)
+{
+  assert(sender);
+  sender->resumable = resumable;
+}
+
+bool pn_link_is_resumable(pn_link_t *sender)
+{
+  assert(sender);
+  return sender->resumable;
+}
+
+uint64_t pn_link_credit_starvation(pn_link_t *link)
+{
+  assert(link);
+  uint64_t starved = link->state.starvation_time;
+  if (link->state.starved_since)
+    starved += pn_i_now_usec() - link->state.starved_since;
+  return starved;
+}
+
 void *pn_link_get_context(pn_link_t *link)
 {
     return link ? link->context : 0;
@@ -283,6 +672,115 @@ void pn_link_set_context(pn_link_t *link, void *context)
         link->context = context;
 }
 
+static int pni_state_bucket(pn_state_t state)
+{
+  int local = (state & PN_LOCAL_ACTIVE) ? 1 : (state & PN_LOCAL_CLOSED) ? 2 : 0;
+  int remote = (state & PN_REMOTE_ACTIVE) ? 1 : (state & PN_REMOTE_CLOSED) ? 2 : 0;
+  return local*3 + remote;
+}
+
+static pn_state_bucket_t *pni_state_index(pn_connection_t *conn, pn_endpoint_type_t type)
+{
+  switch (type) {
+  case CONNECTION:
+    return NULL;
+  case SESSION:
+    return conn->session_index;
+  default:
+    return conn->link_index;
+  }
+}
+
+static void pni_state_insert(pn_endpoint_t *endpoint)
+{
+  pn_state_bucket_t *index = pni_state_index(endpoint->connection, endpoint->type);
+  if (!index) return;
+  pn_state_bucket_t *bucket = &index[pni_state_bucket(endpoint->state)];
+
+  // endpoints tend to change state in the order they were created, so
+  // the right place is almost always at or near the tail
+  pn_endpoint_t *prev = bucket->index_tail;
+  while (prev && prev->seq > endpoint->seq) prev = prev->index_prev;
+  endpoint->index_prev = prev;
+  endpoint->index_next = prev ? prev->index_next : bucket->index_head;
+  if (endpoint->index_next) {
+    endpoint->index_next->index_prev = endpoint;
+  } else {
+    bucket->index_tail = endpoint;
+  }
+  if (prev) {
+    prev->index_next = endpoint;
+  } else {
+    bucket->index_head = endpoint;
+  }
+}
+
+static void pni_state_remove(pn_endpoint_t *endpoint)
+{
+  pn_state_bucket_t *index = pni_state_index(endpoint->connection, endpoint->type);
+  if (!index) return;
+  pn_state_bucket_t *bucket = &index[pni_state_bucket(endpoint->state)];
+  if (bucket->cursor == endpoint) bucket->cursor = endpoint->index_prev;
+  LL_REMOVE(bucket, index, endpoint);
+}
+
+void pn_set_local(pn_endpoint_t *endpoint, pn_state_t state)
+{
+  if (endpoint->connection) pni_state_remove(endpoint);
+  endpoint->state = (endpoint->state & PN_REMOTE_MASK) | state;
+  if (endpoint->connection) pni_state_insert(endpoint);
+}
+
+void pn_set_remote(pn_endpoint_t *endpoint, pn_state_t state)
+{
+  if (endpoint->connection) pni_state_remove(endpoint);
+  endpoint->state = (endpoint->state & PN_LOCAL_MASK) | state;
+  if (endpoint->connection) pni_state_insert(endpoint);
+}
+
+// the first endpoint in the bucket created after seq
+static pn_endpoint_t *pni_state_after(pn_state_bucket_t *bucket, uint64_t seq)
+{
+  pn_endpoint_t *endpoint = bucket->cursor;
+  if (!endpoint || endpoint->seq > seq) endpoint = bucket->index_head;
+  while (endpoint && endpoint->seq <= seq) endpoint = endpoint->index_next;
+  // iteration resumes from here on the next call
+  bucket->cursor = endpoint ? endpoint->index_prev : bucket->index_tail;
+  return endpoint;
+}
+
+// the first endpoint created after seq that matches the state mask: a
+// mask of only local or only remote states matches any one of them, a
+// mask with both matches exactly that state, and 0 matches everything
+static pn_endpoint_t *pni_state_find(pn_state_bucket_t *index, pn_state_t state, uint64_t seq)
+{
+  static const pn_state_t locals[3] = {PN_LOCAL_UNINIT, PN_LOCAL_ACTIVE, PN_LOCAL_CLOSED};
+  static const pn_state_t remotes[3] = {PN_REMOTE_UNINIT, PN_REMOTE_ACTIVE, PN_REMOTE_CLOSED};
+  bool exact = (state & PN_LOCAL_MASK) && (state & PN_REMOTE_MASK);
+  pn_endpoint_t *found = NULL;
+
+  for (int l = 0; l < 3; l++) {
+    for (int r = 0; r < 3; r++) {
+      pn_state_t st = locals[l] | remotes[r];
+      if (state && (exact ? st != state : !(st & state))) continue;
+      pn_endpoint_t *endpoint = pni_state_after(&index[l*3 + r], seq);
+      if (endpoint && (!found || endpoint->seq < found->seq)) found = endpoint;
+    }
+  }
+
+  return found;
+}
+
+static void pni_endpoint_unlink(pn_endpoint_t *endpoint)
+{
+  pn_connection_t *conn = endpoint->connection;
+  if (!conn) return;
+  pn_clear_modified(conn, endpoint);
+  pni_state_remove(endpoint);
+  LL_REMOVE(conn, endpoint, endpoint);
+  endpoint->connection = NULL;
+}
+
 void pn_endpoint_init(pn_endpoint_t *endpoint, int type, pn_connection_t *conn)
 {
   endpoint->type = (pn_endpoint_type_t) type;
@@ -295,8 +793,11 @@ void pn_endpoint_init(pn_endpoint_t *endpoint, int type, pn_connection_t *conn)
   endpoint->transport_next = NULL;
   endpoint->transport_prev = NULL;
   endpoint->modified = false;
+  endpoint->connection = conn;
+  endpoint->seq = ++conn->endpoint_seq;
 
   LL_ADD(conn, endpoint, endpoint);
+  pni_state_insert(endpoint);
 }
 
 void pn_endpoint_tini(pn_endpoint_t *endpoint)
@@ -309,13 +810,28 @@ void pn_endpoint_tini(pn_endpoint_t *endpoint)
 static void pn_connection_finalize(void *object)
 {
   pn_connection_t *conn = (pn_connection_t *) object;
+  // sessions referenced by pending events outlive the connection
+  for (size_t i = 0; i < pn_list_size(conn->sessions); i++) {
+    ((pn_session_t *) pn_list_get(conn->sessions, i))->connection = NULL;
+  }
+  for (pn_endpoint_t *ep = conn->endpoint_head; ep; ep = ep->endpoint_next) {
+    ep->connection = NULL;
+  }
   pn_free(conn->sessions);
+  // deliveries settled on any of the links freed above end up here
+  while (conn->delivery_pool) {
+    pn_delivery_t *d = conn->delivery_pool;
+    conn->delivery_pool = d->pool_next;
+    pn_free(d);
+  }
   pn_free(conn->container);
   pn_free(conn->hostname);
   pn_free(conn->offered_capabilities);
   pn_free(conn->desired_capabilities);
   pn_free(conn->properties);
+  pn_decref(conn->collector);
   pn_endpoint_tini(&conn->endpoint);
+  pni_buffer_pool_rest();
 }
 
 pn_connection_t *pn_connection()
@@ -327,15 +843,22 @@ pn_connection_t *pn_connection()
   conn->context = NULL;
   conn->endpoint_head = NULL;
   conn->endpoint_tail = NULL;
+  memset(conn->dirty, 0, sizeof(conn->dirty));
+  memset(conn->session_index, 0, sizeof(conn->session_index));
+  memset(conn->link_index, 0, sizeof(conn->link_index));
+  conn->endpoint_seq = 0;
   pn_endpoint_init(&conn->endpoint, CONNECTION, conn);
-  conn->transport_head = NULL;
-  conn->transport_tail = NULL;
   conn->sessions = pn_list(0, PN_REFCOUNT);
   conn->transport = NULL;
   conn->work_head = NULL;
   conn->work_tail = NULL;
   conn->tpwork_head = NULL;
   conn->tpwork_tail = NULL;
+  memset(conn->sched_head, 0, sizeof(conn->sched_head));
+  memset(conn->sched_tail, 0, sizeof(conn->sched_tail));
+  conn->delivery_pool = NULL;
+  conn->settle_count = 0;
+  conn->collector = NULL;
   conn->container = pn_string(NULL);
   conn->hostname = pn_string(NULL);
   conn->offered_capabilities = pn_data(16);
@@ -505,115 +1028,101 @@ void pn_clear_tpwork(pn_delivery_t *delivery)
 
 void pn_dump(pn_connection_t *conn)
 {
-  pn_endpoint_t *endpoint = conn->transport_head;
-  while (endpoint)
-  {
-    printf("%p", (void *) endpoint);
-    endpoint = endpoint->transport_next;
-    if (endpoint)
-      printf(" -> ");
+  for (int kind = 0; kind < PN_DIRTY_KINDS; kind++) {
+    pn_endpoint_t *endpoint = conn->dirty[kind].transport_head;
+    while (endpoint)
+    {
+      printf("%p", (void *) endpoint);
+      endpoint = endpoint->transport_next;
+      if (endpoint)
+        printf(" -> ");
+    }
+    printf("\n");
+  }
+}
+
+static pn_dirty_queue_t *pni_dirty_queue(pn_connection_t *connection, pn_endpoint_t *endpoint)
+{
+  switch (endpoint->type) {
+  case CONNECTION:
+    return &connection->dirty[PN_DIRTY_CONNECTION];
+  case SESSION:
+    return &connection->dirty[PN_DIRTY_SESSION];
+  default:
+    return &connection->dirty[PN_DIRTY_LINK];
   }
-  printf("\n");
 }
 
 void pn_modified(pn_connection_t *connection, pn_endpoint_t *endpoint)
 {
   if (!endpoint->modified) {
-    LL_ADD(connection, transport, endpoint);
+    pn_dirty_queue_t *queue = pni_dirty_queue(connection, endpoint);
+    LL_ADD(queue, transport, endpoint);
     endpoint->modified = true;
+    pni_post_event(connection, PN_TRANSPORT, connection);
   }
 }
 
 void pn_clear_modified(pn_connection_t *connection, pn_endpoint_t *endpoint)
 {
   if (endpoint->modified) {
-    LL_REMOVE(connection, transport, endpoint);
+    pn_dirty_queue_t *queue = pni_dirty_queue(connection, endpoint);
+    LL_REMOVE(queue, transport, endpoint);
     endpoint->transport_next = NULL;
     endpoint->transport_prev = NULL;
     endpoint->modified = false;
   }
 }
 
-bool pn_matches(pn_endpoint_t *endpoint, pn_endpoint_type_t type, pn_state_t state)
-{
-  if (endpoint->type != type) return false;
-
-  if (!state) return true;
-
-  int st = endpoint->state;
-  if ((state & PN_REMOTE_MASK) == 0 || (state & PN_LOCAL_MASK) == 0)
-    return st & state;
-  else
-    return st == state;
-}
-
-pn_endpoint_t *pn_find(pn_endpoint_t *endpoint, pn_endpoint_type_t type, pn_state_t state)
-{
-  while (endpoint)
-  {
-    if (pn_matches(endpoint, type, state))
-      return endpoint;
-    endpoint = endpoint->endpoint_next;
-  }
-  return NULL;
-}
-
 pn_session_t *pn_session_head(pn_connection_t *conn, pn_state_t state)
 {
   if (conn)
-    return (pn_session_t *) pn_find(conn->endpoint_head, SESSION, state);
+    return (pn_session_t *) pni_state_find(conn->session_index, state, 0);
   else
     return NULL;
 }
 
 pn_session_t *pn_session_next(pn_session_t *ssn, pn_state_t state)
 {
-  if (ssn)
-    return (pn_session_t *) pn_find(ssn->endpoint.endpoint_next, SESSION, state);
+  if (ssn && ssn->endpoint.connection)
+    return (pn_session_t *) pni_state_find(ssn->endpoint.connection->session_index,
+                                           state, ssn->endpoint.seq);
   else
     return NULL;
 }
 
 pn_link_t *pn_link_head(pn_connection_t *conn, pn_state_t state)
 {
-  if (!conn) return NULL;
-
-  pn_endpoint_t *endpoint = conn->endpoint_head;
-
-  while (endpoint)
-  {
-    if (pn_matches(endpoint, SENDER, state) || pn_matches(endpoint, RECEIVER, state))
-      return (pn_link_t *) endpoint;
-    endpoint = endpoint->endpoint_next;
-  }
-
-  return NULL;
+  if (conn)
+    return (pn_link_t *) pni_state_find(conn->link_index, state, 0);
+  else
+    return NULL;
 }
 
 pn_link_t *pn_link_next(pn_link_t *link, pn_state_t state)
 {
-  if (!link) return NULL;
-
-  pn_endpoint_t *endpoint = link->endpoint.endpoint_next;
-
-  while (endpoint)
-  {
-    if (pn_matches(endpoint, SENDER, state) || pn_matches(endpoint, RECEIVER, state))
-      return (pn_link_t *) endpoint;
-    endpoint = endpoint->endpoint_next;
-  }
-
-  return NULL;
+  if (link && link->endpoint.connection)
+    return (pn_link_t *) pni_state_find(link->endpoint.connection->link_index,
+                                        state, link->endpoint.seq);
+  else
+    return NULL;
 }
 
 static void pn_session_finalize(void *object)
 {
   pn_session_t *session = (pn_session_t *) object;
+  // as above, links may outlive the session
+  for (size_t i = 0; i < pn_list_size(session->links); i++) {
+    ((pn_link_t *) pn_list_get(session->links, i))->session = NULL;
+  }
   pn_free(session->links);
+  pn_free(session->link_names);
+  pni_endpoint_unlink(&session->endpoint);
   pn_endpoint_tini(&session->endpoint);
 
   pn_delivery_map_free(&session->state.incoming);
   pn_delivery_map_free(&session->state.outgoing);
+  pn_disp_set_free(&session->state.disp);
   pn_free(session->state.local_handles);
   pn_free(session->state.remote_handles);
 }
@@ -629,6 +1138,7 @@ pn_session_t *pn_session(pn_connection_t *conn)
   pn_add_session(conn, ssn);
   pn_decref(ssn);
   ssn->links = pn_list(0, PN_REFCOUNT);
+  ssn->link_names = pn_hash(0, 0.75, 0);
   ssn->context = 0;
   ssn->incoming_capacity = 1024*1024;
   ssn->incoming_bytes = 0;
@@ -693,11 +1203,49 @@ size_t pn_session_incoming_window(pn_session_t *ssn)
   uint32_t size = ssn->connection->transport->local_max_frame;
   if (!size) {
     return 2147483647; // biggest legal value
+  } else if ((size_t) ssn->incoming_bytes >= ssn->incoming_capacity) {
+    return 0;
   } else {
     return (ssn->incoming_capacity - ssn->incoming_bytes)/size;
   }
 }
 
+// The incoming window is reopened once it falls to window_low frames
+// and the buffered bytes leave room to open it by at least as much
+// again, so the peer's refreshed window arrives before the old one is
+// used up. The receiver has no direct measure of the round trip, so
+// window_low starts at a quarter of the first window and doubles, up
+// to half of what the capacity allows, each time the window runs out
+// while the capacity would have allowed more: that many frames were in
+// flight during the round trip. A window that runs out because the
+// application is not draining its deliveries is left alone, the
+// capacity is the ceiling on what may be buffered.
+static pn_sequence_t pni_window_low(pn_session_t *ssn)
+{
+  uint32_t size = ssn->connection->transport->local_max_frame;
+  pn_sequence_t low = ssn->state.window_low;
+  if (size && (size_t) low > ssn->incoming_capacity / size / 2)
+    low = ssn->incoming_capacity / size / 2;
+  return low;
+}
+
+static bool pni_window_refresh(pn_session_t *ssn)
+{
+  pn_sequence_t current = ssn->state.incoming_window;
+  if (!current) return true;
+  pn_sequence_t low = pni_window_low(ssn);
+  if (current > low) return false;
+  return pn_session_incoming_window(ssn) >= (size_t) current + (low ? low : 1);
+}
+
+static void pni_window_exhausted(pn_transport_t *transport, pn_session_t *ssn)
+{
+  if (!pn_session_incoming_window(ssn)) return;
+  transport->disp->stats.window_exhausted++;
+  pn_sequence_t low = pni_window_low(ssn);
+  ssn->state.window_low = low ? 2 * low : 1;
+}
+
 pn_state_t pn_session_state(pn_session_t *session)
 {
   return session->endpoint.state;
@@ -724,6 +1272,55 @@ static ssize_t pn_output_write_amqp_header(pn_io_layer_t *io_layer, char *bytes,
 static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t available);
 static pn_timestamp_t pn_tick_amqp(pn_io_layer_t *io_layer, pn_timestamp_t now);
 
+// The largest frame we are willing to emit: half the socket send
+// buffer so one frame cannot monopolize it, cut on a TLS record
+// boundary so records are not split across frames.
+static uint32_t pni_frame_ceiling(pn_transport_t *transport)
+{
+  size_t ceiling = PN_ADAPTIVE_FRAME_CEILING;
+  if (transport->send_buffer_hint && transport->send_buffer_hint / 2 < ceiling)
+    ceiling = transport->send_buffer_hint / 2;
+  if (transport->record_size && ceiling > transport->record_size)
+    ceiling -= ceiling % transport->record_size;
+  if (ceiling < AMQP_MIN_MAX_FRAME_SIZE)
+    ceiling = AMQP_MIN_MAX_FRAME_SIZE;
+  return ceiling;
+}
+
+// Size outgoing transfer frames so that a typical message travels in a
+// single frame and only outliers are fragmented, in units of whole TLS
+// records, never exceeding the ceiling above (or the peer's max-frame).
+static void pni_frame_policy(pn_transport_t *transport)
+{
+  if (!transport->adaptive_frame) {
+    transport->disp->output_max_frame = 0;
+    return;
+  }
+
+  size_t ceiling = pni_frame_ceiling(transport);
+  size_t target = ceiling;
+  if (transport->message_size) {
+    size_t unit = transport->record_size ? transport->record_size : PN_ADAPTIVE_FRAME_FLOOR;
+    // leave room for the frame header and transfer performative
+    target = transport->message_size + 256;
+    target = ((target + unit - 1) / unit) * unit;
+    if (target > ceiling) target = ceiling;
+  }
+  transport->disp->output_max_frame = target;
+}
+
+static void pni_frame_observe(pn_transport_t *transport, size_t size)
+{
+  size_t old = transport->message_size;
+  if (!old) {
+    transport->message_size = size;
+  } else {
+    transport->message_size = (int64_t) old + ((int64_t) size - (int64_t) old) / 8;
+  }
+  if (transport->message_size != old)
+    pni_frame_policy(transport);
+}
+
 void pn_transport_init(pn_transport_t *transport)
 {
   transport->header_count = 0;
@@ -771,6 +1368,11 @@ void pn_transport_init(pn_transport_t *transport)
   transport->remote_hostname = NULL;
   transport->local_max_frame = PN_DEFAULT_MAX_FRAME_SIZE;
   transport->remote_max_frame = 0;
+  transport->adaptive_frame = true;
+  transport->send_buffer_hint = 0;
+  transport->record_size = 0;
+  transport->message_size = 0;
+  pni_frame_policy(transport);
   transport->local_idle_timeout = 0;
   transport->dead_remote_deadline = 0;
   transport->last_bytes_input = 0;
@@ -781,16 +1383,27 @@ void pn_transport_init(pn_transport_t *transport)
   transport->remote_desired_capabilities = pn_data(16);
   transport->remote_properties = pn_data(16);
   transport->disp_data = pn_data(16);
+  transport->disp_outcome = NULL;
+  transport->unsettled_data = pn_data(0);
+  transport->target_data = pn_data(16);
+  for (int i = 0; i < PN_SCAN_DATA; i++)
+    transport->scan_data[i] = pn_data(16);
   transport->error = pn_error();
   pn_condition_init(&transport->remote_condition);
 
   transport->local_channels = pn_hash(0, 0.75, PN_REFCOUNT);
   transport->remote_channels = pn_hash(0, 0.75, PN_REFCOUNT);
+  transport->next_channel = 0;
 
   transport->bytes_input = 0;
   transport->bytes_output = 0;
 
   transport->input_pending = 0;
+  transport->output_head = NULL;
+  transport->output_tail = NULL;
+  transport->output_free = NULL;
+  transport->output_free_count = 0;
+  transport->output_size = 0;
   transport->output_pending = 0;
 }
 
@@ -815,16 +1428,9 @@ pn_transport_t *pn_transport()
 {
   pn_transport_t *transport = (pn_transport_t *) malloc(sizeof(pn_transport_t));
   if (!transport) return NULL;
-  transport->output_size = PN_DEFAULT_MAX_FRAME_SIZE ? PN_DEFAULT_MAX_FRAME_SIZE : 16 * 1024;
-  transport->output_buf = (char *) malloc(transport->output_size);
-  if (!transport->output_buf) {
-    free(transport);
-    return NULL;
-  }
   transport->input_size =  PN_DEFAULT_MAX_FRAME_SIZE ? PN_DEFAULT_MAX_FRAME_SIZE : 16 * 1024;
   transport->input_buf = (char *) malloc(transport->input_size);
   if (!transport->input_buf) {
-    free(transport->output_buf);
     free(transport);
     return NULL;
   }
@@ -836,40 +1442,190 @@ pn_transport_t *pn_transport()
 
 int pn_transport_bind(pn_transport_t *transport, pn_connection_t *connection)
 {
-  if (!transport) return PN_ARG_ERR;
-  if (transport->connection) return PN_STATE_ERR;
-  if (connection->transport) return PN_STATE_ERR;
-  transport->connection = connection;
-  connection->transport = transport;
-  if (transport->open_rcvd) {
-    PN_SET_REMOTE(connection->endpoint.state, PN_REMOTE_ACTIVE);
-    if (!pn_error_code(transport->error)) {
-      transport->disp->halt = false;
-      transport_consume(transport);        // blech - testBindAfterOpen
+  if (!transport) return PN_ARG_ERR;
+  if (transport->connection) return PN_STATE_ERR;
+  if (connection->transport) return PN_STATE_ERR;
+  transport->connection = connection;
+  connection->transport = transport;
+  if (transport->open_rcvd) {
+    pn_set_remote(&connection->endpoint, PN_REMOTE_ACTIVE);
+    pni_post_state(&connection->endpoint, true);
+    if (!pn_error_code(transport->error)) {
+      transport->disp->halt = false;
+      transport_consume(transport);        // blech - testBindAfterOpen
+    }
+  }
+  return 0;
+}
+
+static void pni_hash_clear(pn_hash_t *hash)
+{
+  pn_handle_t entry;
+  while ((entry = pn_hash_head(hash))) {
+    pn_hash_del(hash, pn_hash_key(hash, entry));
+  }
+}
+
+// Charges a window stall in progress to the statistics. A stall that
+// ends is cleared, one that carries on is restarted from now so that
+// reading the statistics part way through does not charge it twice.
+// The clock is only read for stalls that began while timing was on.
+static void pni_stall_charge(pn_transport_t *transport, pn_session_t *ssn, bool end)
+{
+  pn_session_state_t *state = &ssn->state;
+  if (state->stalled_since) {
+    uint64_t now = pn_i_now_usec();
+    transport->disp->stats.window_stall_time += now - state->stalled_since;
+    state->stalled_since = end ? 0 : now;
+  }
+  if (end) state->stalled = false;
+}
+
+// as pni_stall_charge, for credit starvation on a sender
+static void pni_starve_charge(pn_transport_t *transport, pn_link_t *link, bool end)
+{
+  pn_link_state_t *state = &link->state;
+  if (state->starved_since) {
+    uint64_t now = pn_i_now_usec();
+    state->starvation_time += now - state->starved_since;
+    transport->disp->stats.credit_starvation_time += now - state->starved_since;
+    state->starved_since = end ? 0 : now;
+  }
+  if (end) state->starved = false;
+}
+
+static void pni_session_charge(pn_transport_t *transport, pn_session_t *ssn, bool end)
+{
+  pni_stall_charge(transport, ssn, end);
+  size_t nlinks = pn_list_size(ssn->links);
+  for (size_t i = 0; i < nlinks; i++)
+    pni_starve_charge(transport, (pn_link_t *) pn_list_get(ssn->links, i), end);
+}
+
+static void pni_connection_charge(pn_transport_t *transport, bool end)
+{
+  pn_connection_t *conn = transport->connection;
+  if (!conn) return;
+  for (pn_endpoint_t *ep = conn->endpoint_head; ep; ep = ep->endpoint_next) {
+    if (ep->type == SESSION)
+      pni_stall_charge(transport, (pn_session_t *) ep, end);
+    else if (ep->type == SENDER)
+      pni_starve_charge(transport, (pn_link_t *) ep, end);
+  }
+}
+
+// Marks the deliveries a link had in flight for resumption on the next
+// transport, see pni_link_resume. Receivers keep whatever payload has
+// arrived. Senders can only resume if the link is resumable, since
+// otherwise the payload already transferred is gone; such deliveries
+// are taken as sent and wait for the application to settle them.
+static void pni_link_unbind(pn_link_t *link)
+{
+  bool sender = link->endpoint.type == SENDER;
+  pn_session_t *ssn = link->session;
+  link->state.resuming = 0;
+  for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+    d->resume = PNI_RESUME_NONE;
+    if (!d->state.init) continue;
+    bool resume = !d->local.settled && !d->remote.settled &&
+      (!sender || link->resumable);
+    if (!resume) {
+      if (sender) {
+        if (!d->state.sent) {
+          link->queued--;
+          ssn->outgoing_deliveries--;
+          ssn->outgoing_bytes -= pn_buffer_size(d->bytes);
+          pn_buffer_clear(d->bytes);
+          d->done = true;
+        }
+        pn_delivery_map_del(&ssn->state.outgoing, d);
+        d->state.sent = true;
+      }
+      continue;
     }
+    if (sender && d->state.sent) {
+      // it is queued again until the resumed transfer completes
+      link->queued++;
+      ssn->outgoing_deliveries++;
+    }
+    d->resume = PNI_RESUME_PENDING;
+    link->state.resuming++;
+  }
+
+  pni_sched_remove(link);
+  link->state.local_handle = (link->endpoint.state & PN_LOCAL_CLOSED) ? -2 : -1;
+  link->state.remote_handle = -1;
+  link->state.delivery_count = 0;
+  link->state.link_credit = 0;
+  link->state.starved = false;
+  link->state.starved = false;
+  link->state.starved_since = 0;
+  link->state.deficit = 0;
+  link->state.flow_pending = false;
+  if (sender) {
+    link->credit = 0;
+    link->drain = false;
+    link->drained = false;
   }
-  return 0;
 }
 
+static void pni_session_unbind(pn_session_t *ssn)
+{
+  pn_session_state_t *state = &ssn->state;
+  bool closed = ssn->endpoint.state & PN_LOCAL_CLOSED;
+  state->detached = !closed && (state->local_channel != (uint16_t) -1 ||
+                                state->remote_channel != (uint16_t) -1);
+  state->local_channel = closed ? (uint16_t) -2 : (uint16_t) -1;
+  state->remote_channel = (uint16_t) -1;
+  state->incoming_init = false;
+  pn_delivery_map_clear(&state->incoming);
+  pn_delivery_map_clear(&state->outgoing);
+  state->incoming_transfer_count = 0;
+  state->incoming_window = 0;
+  state->remote_incoming_window = 0;
+  state->outgoing_transfer_count = 0;
+  state->outgoing_window = 0;
+  pni_hash_clear(state->local_handles);
+  pni_hash_clear(state->remote_handles);
+  state->next_handle = 0;
+  state->disp.size = 0;
+  state->stalled = false;
+  state->stalled_since = 0;
+  state->window_low = 0;
+  state->flow_pending = false;
+}
+
+// Everything the transport knew about the endpoints is forgotten, so a
+// transport bound next opens, begins and attaches them all again.
 int pn_transport_unbind(pn_transport_t *transport)
 {
   assert(transport);
   if (!transport->connection) return 0;
 
+  pni_connection_charge(transport, true);
+
   pn_connection_t *conn = transport->connection;
   transport->connection = NULL;
   conn->transport = NULL;
 
+  // links first, while their deliveries still know whether they were sent
+  pn_endpoint_t *endpoint = conn->endpoint_head;
+  while (endpoint) {
+    if (endpoint->type == SENDER || endpoint->type == RECEIVER)
+      pni_link_unbind((pn_link_t *) endpoint);
+    endpoint = endpoint->endpoint_next;
+  }
+
   pn_session_t *ssn = pn_session_head(conn, 0);
   while (ssn) {
-    pn_delivery_map_clear(&ssn->state.incoming);
-    pn_delivery_map_clear(&ssn->state.outgoing);
+    pni_session_unbind(ssn);
     ssn = pn_session_next(ssn, 0);
   }
 
-  pn_endpoint_t *endpoint = conn->endpoint_head;
+  endpoint = conn->endpoint_head;
   while (endpoint) {
     pn_condition_clear(&endpoint->remote_condition);
+    pn_set_remote(endpoint, PN_REMOTE_UNINIT);
     pn_modified(conn, endpoint);
     endpoint = endpoint->endpoint_next;
   }
@@ -885,16 +1641,16 @@ pn_error_t *pn_transport_error(pn_transport_t *transport)
 void pn_terminus_init(pn_terminus_t *terminus, pn_terminus_type_t type)
 {
   terminus->type = type;
-  terminus->address = pn_string(NULL);
+  terminus->address = NULL;
   terminus->durability = PN_NONDURABLE;
   terminus->expiry_policy = PN_SESSION_CLOSE;
   terminus->timeout = 0;
   terminus->dynamic = false;
   terminus->distribution_mode = PN_DIST_MODE_UNSPECIFIED;
-  terminus->properties = pn_data(16);
-  terminus->capabilities = pn_data(16);
-  terminus->outcomes = pn_data(16);
-  terminus->filter = pn_data(16);
+  terminus->properties = NULL;
+  terminus->capabilities = NULL;
+  terminus->outcomes = NULL;
+  terminus->filter = NULL;
 }
 
 static void pn_link_finalize(void *object)
@@ -905,16 +1661,19 @@ static void pn_link_finalize(void *object)
   pn_terminus_free(&link->target);
   pn_terminus_free(&link->remote_source);
   pn_terminus_free(&link->remote_target);
-  while (link->settled_head) {
-    pn_delivery_t *d = link->settled_head;
-    LL_POP(link, settled, pn_delivery_t);
-    pn_free(d);
-  }
+  pn_connection_t *conn = link->endpoint.connection;
   while (link->unsettled_head) {
     pn_delivery_t *d = link->unsettled_head;
     LL_POP(link, unsettled, pn_delivery_t);
-    pn_free(d);
+    if (conn && d->work) LL_REMOVE(conn, work, d);
+    if (conn && d->tpwork) LL_REMOVE(conn, tpwork, d);
+    d->work = false;
+    d->tpwork = false;
+    d->link = NULL;
+    pn_decref(d);
   }
+  if (link->session) pni_sched_remove(link);
+  pni_endpoint_unlink(&link->endpoint);
   pn_free(link->name);
   pn_endpoint_tini(&link->endpoint);
 }
@@ -928,18 +1687,27 @@ pn_link_t *pn_link_new(int type, pn_session_t *session, const char *name)
   pn_add_link(session, link);
   pn_decref(link);
   link->name = pn_string(name);
+  pni_link_index(session, link);
   pn_terminus_init(&link->source, PN_SOURCE);
   pn_terminus_init(&link->target, PN_TARGET);
   pn_terminus_init(&link->remote_source, PN_UNSPECIFIED);
   pn_terminus_init(&link->remote_target, PN_UNSPECIFIED);
-  link->settled_head = link->settled_tail = NULL;
   link->unsettled_head = link->unsettled_tail = link->current = NULL;
+  link->remote_settled_upto = NULL;
   link->unsettled_count = 0;
   link->available = 0;
   link->credit = 0;
   link->queued = 0;
   link->drain = false;
   link->drained = false;
+  link->priority = 0;
+  link->weight = 1;
+  link->max_buffered = 0;
+  link->resumable = false;
+  link->sched_next = NULL;
+  link->sched_prev = NULL;
+  link->scheduled = false;
+  link->sched_delivery = NULL;
   link->context = 0;
   link->snd_settle_mode = PN_SND_MIXED;
   link->rcv_settle_mode = PN_RCV_FIRST;
@@ -951,6 +1719,12 @@ pn_link_t *pn_link_new(int type, pn_session_t *session, const char *name)
   link->state.remote_handle = -1;
   link->state.delivery_count = 0;
   link->state.link_credit = 0;
+  link->state.flow_pending = false;
+  link->state.starved = false;
+  link->state.starved_since = 0;
+  link->state.starvation_time = 0;
+  link->state.deficit = 0;
+  link->state.resuming = 0;
   // end transport stat
 
   return link;
@@ -991,13 +1765,13 @@ pn_terminus_type_t pn_terminus_get_type(pn_terminus_t *terminus)
 const char *pn_terminus_get_address(pn_terminus_t *terminus)
 {
   assert(terminus);
-  return pn_string_get(terminus->address);
+  return terminus->address ? pn_string_get(terminus->address) : NULL;
 }
 
 int pn_terminus_set_address(pn_terminus_t *terminus, const char *address)
 {
   assert(terminus);
-  return pn_string_set(terminus->address, address);
+  return pni_string_assign(&terminus->address, address, address ? strlen(address) : 0);
 }
 
 static char *pn_bytes_strdup(pn_bytes_t str)
@@ -1008,7 +1782,7 @@ static char *pn_bytes_strdup(pn_bytes_t str)
 int pn_terminus_set_address_bytes(pn_terminus_t *terminus, pn_bytes_t address)
 {
   assert(terminus);
-  return pn_string_setn(terminus->address, address.start, address.size);
+  return pni_string_assign(&terminus->address, address.start, address.size);
 }
 
 pn_durability_t pn_terminus_get_durability(pn_terminus_t *terminus)
@@ -1059,24 +1833,32 @@ int pn_terminus_set_dynamic(pn_terminus_t *terminus, bool dynamic)
   return 0;
 }
 
+// most termini never carry any of their data, so it is allocated on
+// first access
+static pn_data_t *pni_terminus_data(pn_data_t **data)
+{
+  if (!*data) *data = pn_data(16);
+  return *data;
+}
+
 pn_data_t *pn_terminus_properties(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->properties : NULL;
+  return terminus ? pni_terminus_data(&terminus->properties) : NULL;
 }
 
 pn_data_t *pn_terminus_capabilities(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->capabilities : NULL;
+  return terminus ? pni_terminus_data(&terminus->capabilities) : NULL;
 }
 
 pn_data_t *pn_terminus_outcomes(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->outcomes : NULL;
+  return terminus ? pni_terminus_data(&terminus->outcomes) : NULL;
 }
 
 pn_data_t *pn_terminus_filter(pn_terminus_t *terminus)
 {
-  return terminus ? terminus->filter : NULL;
+  return terminus ? pni_terminus_data(&terminus->filter) : NULL;
 }
 
 pn_distribution_mode_t pn_terminus_get_distribution_mode(const pn_terminus_t *terminus)
@@ -1105,13 +1887,13 @@ int pn_terminus_copy(pn_terminus_t *terminus, pn_terminus_t *src)
   terminus->timeout = src->timeout;
   terminus->dynamic = src->dynamic;
   terminus->distribution_mode = src->distribution_mode;
-  err = pn_data_copy(terminus->properties, src->properties);
+  err = pni_data_assign(&terminus->properties, src->properties);
   if (err) return err;
-  err = pn_data_copy(terminus->capabilities, src->capabilities);
+  err = pni_data_assign(&terminus->capabilities, src->capabilities);
   if (err) return err;
-  err = pn_data_copy(terminus->outcomes, src->outcomes);
+  err = pni_data_assign(&terminus->outcomes, src->outcomes);
   if (err) return err;
-  err = pn_data_copy(terminus->filter, src->filter);
+  err = pni_data_assign(&terminus->filter, src->filter);
   if (err) return err;
   return 0;
 }
@@ -1181,19 +1963,37 @@ static void pn_disposition_finalize(pn_disposition_t *ds)
   pn_condition_tini(&ds->condition);
 }
 
+static void pni_delivery_unspill(pn_delivery_t *delivery)
+{
+  if (delivery->map) {
+    pn_i_unmap_file(delivery->map, delivery->map_size);
+    delivery->map = NULL;
+    delivery->map_size = 0;
+  }
+  if (delivery->spill) {
+    fclose(delivery->spill);
+    delivery->spill = NULL;
+  }
+  delivery->spill_size = 0;
+  delivery->spill_read = 0;
+}
+
 static void pn_delivery_finalize(void *object)
 {
   pn_delivery_t *delivery = (pn_delivery_t *) object;
-  pn_buffer_free(delivery->tag);
+  pni_delivery_unspill(delivery);
+  if (delivery->tag) pn_buffer_free(delivery->tag);
   pn_buffer_free(delivery->bytes);
+  if (delivery->sent) pn_buffer_free(delivery->sent);
   pn_disposition_finalize(&delivery->local);
   pn_disposition_finalize(&delivery->remote);
 }
 
 static void pn_disposition_init(pn_disposition_t *ds)
 {
-  ds->data = pn_data(16);
-  ds->annotations = pn_data(16);
+  // data and annotations are rarely used, see pni_disposition_data()
+  ds->data = NULL;
+  ds->annotations = NULL;
   pn_condition_init(&ds->condition);
 }
 
@@ -1205,30 +2005,65 @@ static void pn_disposition_clear(pn_disposition_t *ds)
   ds->failed = false;
   ds->undeliverable = false;
   ds->settled = false;
-  pn_data_clear(ds->data);
-  pn_data_clear(ds->annotations);
+  if (ds->data) pn_data_clear(ds->data);
+  if (ds->annotations) pn_data_clear(ds->annotations);
   pn_condition_clear(&ds->condition);
 }
 
+static pn_bytes_t pni_delivery_tag(pn_delivery_t *delivery)
+{
+  if (delivery->tag_size <= PN_DELIVERY_TAG_INLINE)
+    return pn_bytes(delivery->tag_size, delivery->tag_inline);
+  return pn_buffer_bytes(delivery->tag);
+}
+
+static int pni_delivery_set_tag(pn_delivery_t *delivery, pn_delivery_tag_t tag)
+{
+  delivery->tag_size = tag.size;
+  if (tag.size <= PN_DELIVERY_TAG_INLINE) {
+    if (tag.size) memmove(delivery->tag_inline, tag.bytes, tag.size);
+    return 0;
+  }
+  if (!delivery->tag) {
+    delivery->tag = pn_buffer(tag.size);
+    if (!delivery->tag) return PN_ERR;
+  }
+  pn_buffer_clear(delivery->tag);
+  return pn_buffer_append(delivery->tag, tag.bytes, tag.size);
+}
+
 pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
 {
   assert(link);
-  pn_delivery_t *delivery = link->settled_head;
-  LL_POP(link, settled, pn_delivery_t);
-  if (!delivery) {
+  pn_connection_t *conn = link->session->connection;
+  pn_delivery_t *delivery = conn->delivery_pool;
+  if (delivery) {
+    assert(!delivery->tpwork);
+    conn->delivery_pool = delivery->pool_next;
+  } else {
     static pn_class_t clazz = {pn_delivery_finalize};
     delivery = (pn_delivery_t *) pn_new(sizeof(pn_delivery_t), &clazz);
     if (!delivery) return NULL;
-    delivery->tag = pn_buffer(16);
+    delivery->tag = NULL;
     delivery->bytes = pn_buffer(64);
+    delivery->spill = NULL;
+    delivery->spill_size = 0;
+    delivery->spill_read = 0;
+    delivery->map = NULL;
+    delivery->map_size = 0;
+    delivery->sent = NULL;
     pn_disposition_init(&delivery->local);
     pn_disposition_init(&delivery->remote);
-  } else {
-    assert(!delivery->tpwork);
   }
   delivery->link = link;
-  pn_buffer_clear(delivery->tag);
-  pn_buffer_append(delivery->tag, tag.bytes, tag.size);
+  delivery->pool_next = NULL;
+  if (pni_delivery_set_tag(delivery, tag)) {
+    delivery->tag_size = 0;
+    delivery->tpwork = false;
+    delivery->pool_next = conn->delivery_pool;
+    conn->delivery_pool = delivery;
+    return NULL;
+  }
   pn_disposition_clear(&delivery->local);
   pn_disposition_clear(&delivery->remote);
   delivery->updated = false;
@@ -1241,6 +2076,8 @@ pn_delivery_t *pn_delivery(pn_link_t *link, pn_delivery_tag_t tag)
   delivery->tpwork_prev = NULL;
   delivery->tpwork = false;
   pn_buffer_clear(delivery->bytes);
+  delivery->transferred = 0;
+  delivery->resume = PNI_RESUME_NONE;
   delivery->done = false;
   delivery->context = NULL;
 
@@ -1282,6 +2119,52 @@ pn_delivery_t *pn_unsettled_next(pn_delivery_t *delivery)
   return d;
 }
 
+// resumes from where the previous call stopped, so a link's deliveries
+// are each visited about once however often this is called
+pn_delivery_t *pn_link_remote_settled_upto(pn_link_t *link)
+{
+  assert(link);
+  pn_delivery_t *upto = link->remote_settled_upto;
+  if (upto && upto->local.settled) upto = NULL;
+  pn_delivery_t *d = upto ? upto->unsettled_next : link->unsettled_head;
+  while (d && (d->remote.settled || d->local.settled)) {
+    if (!d->local.settled) upto = d;
+    d = d->unsettled_next;
+  }
+  link->remote_settled_upto = upto;
+  return upto;
+}
+
+int pn_link_settle_upto(pn_link_t *link, pn_delivery_t *delivery, uint64_t outcome)
+{
+  if (!link || !delivery || delivery->link != link || delivery->local.settled)
+    return PN_ARG_ERR;
+
+  // as pn_delivery_settle for each delivery, with the connection marked
+  // modified just once
+  pn_connection_t *conn = link->session->connection;
+  int count = 0;
+  pn_delivery_t *d = link->unsettled_head;
+  while (d) {
+    if (!d->local.settled) {
+      if (outcome) d->local.type = outcome;
+      if (d == link->current) pn_link_advance(link);
+      link->unsettled_count--;
+      d->local.settled = true;
+      if (!d->tpwork) {
+        LL_ADD(conn, tpwork, d);
+        d->tpwork = true;
+      }
+      pn_work_update(conn, d);
+      count++;
+    }
+    if (d == delivery) break;
+    d = d->unsettled_next;
+  }
+  pn_modified(conn, &conn->endpoint);
+  return count;
+}
+
 bool pn_is_current(pn_delivery_t *delivery)
 {
   pn_link_t *link = delivery->link;
@@ -1291,7 +2174,7 @@ bool pn_is_current(pn_delivery_t *delivery)
 void pn_delivery_dump(pn_delivery_t *d)
 {
   char tag[1024];
-  pn_bytes_t bytes = pn_buffer_bytes(d->tag);
+  pn_bytes_t bytes = pni_delivery_tag(d);
   pn_quote_data(tag, 1024, bytes.start, bytes.size);
   printf("{tag=%s, local.type=%" PRIu64 ", remote.type=%" PRIu64 ", local.settled=%u, "
          "remote.settled=%u, updated=%u, current=%u, writable=%u, readable=%u, "
@@ -1319,10 +2202,22 @@ uint64_t pn_disposition_type(pn_disposition_t *disposition)
   return disposition->type;
 }
 
+static pn_data_t *pni_disposition_data(pn_disposition_t *disposition)
+{
+  if (!disposition->data) disposition->data = pn_data(16);
+  return disposition->data;
+}
+
+static pn_data_t *pni_disposition_annotations(pn_disposition_t *disposition)
+{
+  if (!disposition->annotations) disposition->annotations = pn_data(16);
+  return disposition->annotations;
+}
+
 pn_data_t *pn_disposition_data(pn_disposition_t *disposition)
 {
   assert(disposition);
-  return disposition->data;
+  return pni_disposition_data(disposition);
 }
 
 uint32_t pn_disposition_get_section_number(pn_disposition_t *disposition)
@@ -1349,6 +2244,12 @@ void pn_disposition_set_section_offset(pn_disposition_t *disposition, uint64_t s
   disposition->section_offset = section_offset;
 }
 
+bool pn_disposition_is_settled(pn_disposition_t *disposition)
+{
+  assert(disposition);
+  return disposition->settled;
+}
+
 bool pn_disposition_is_failed(pn_disposition_t *disposition)
 {
   assert(disposition);
@@ -1376,7 +2277,53 @@ void pn_disposition_set_undeliverable(pn_disposition_t *disposition, bool undeli
 pn_data_t *pn_disposition_annotations(pn_disposition_t *disposition)
 {
   assert(disposition);
-  return disposition->annotations;
+  return pni_disposition_annotations(disposition);
+}
+
+int pn_disposition_set_txn(pn_disposition_t *disposition, pn_bytes_t txn_id,
+                           uint64_t outcome)
+{
+  assert(disposition);
+  pn_data_t *data = pni_disposition_data(disposition);
+  pn_data_clear(data);
+  return pn_data_fill(data, "[z?DL[]]", txn_id.size, txn_id.start,
+                      (bool) outcome, outcome);
+}
+
+// positions data on the given field of a transaction state list
+static bool pni_txn_field(pn_data_t *data, int field)
+{
+  if (!data) return false;
+  pn_data_rewind(data);
+  if (!pn_data_next(data) || pn_data_type(data) != PN_LIST) return false;
+  pn_data_enter(data);
+  for (int i = 0; i <= field; i++) {
+    if (!pn_data_next(data)) return false;
+  }
+  return true;
+}
+
+pn_bytes_t pn_disposition_get_txn(pn_disposition_t *disposition)
+{
+  assert(disposition);
+  pn_data_t *data = disposition->data;
+  if (pni_txn_field(data, 0) && pn_data_type(data) == PN_BINARY) {
+    return pn_data_get_binary(data);
+  }
+  return pn_bytes(0, NULL);
+}
+
+uint64_t pn_disposition_get_txn_outcome(pn_disposition_t *disposition)
+{
+  assert(disposition);
+  pn_data_t *data = disposition->data;
+  if (pni_txn_field(data, 1) && pn_data_type(data) == PN_DESCRIBED) {
+    pn_data_enter(data);
+    if (pn_data_next(data) && pn_data_type(data) == PN_ULONG) {
+      return pn_data_get_ulong(data);
+    }
+  }
+  return 0;
 }
 
 pn_condition_t *pn_disposition_condition(pn_disposition_t *disposition)
@@ -1415,7 +2362,7 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
     pn_data_fill(data, "[?DL[sSC]]", pn_condition_is_set(cond), ERROR,
                  pn_condition_get_name(cond),
                  pn_condition_get_description(cond),
-                 pn_condition_info(cond));
+                 cond->info);
     break;
   case PN_MODIFIED:
     pn_data_fill(data, "[ooC]",
@@ -1424,7 +2371,7 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
                  disposition->annotations);
     break;
   default:
-    pn_data_copy(data, disposition->data);
+    if (disposition->data) pn_data_copy(data, disposition->data);
     break;
   }
 }
@@ -1432,7 +2379,7 @@ void pni_disposition_encode(pn_disposition_t *disposition, pn_data_t *data)
 pn_delivery_tag_t pn_delivery_tag(pn_delivery_t *delivery)
 {
   if (delivery) {
-    pn_bytes_t tag = pn_buffer_bytes(delivery->tag);
+    pn_bytes_t tag = pni_delivery_tag(delivery);
     return pn_dtag(tag.start, tag.size);
   } else {
     return pn_dtag(0, 0);
@@ -1464,8 +2411,9 @@ void pn_advance_receiver(pn_link_t *link)
   pn_delivery_t *current = link->current;
   link->session->incoming_bytes -= pn_buffer_size(current->bytes);
   pn_buffer_clear(current->bytes);
+  pni_delivery_unspill(current);
 
-  if (!link->session->state.incoming_window) {
+  if (pni_window_refresh(link->session)) {
     pn_add_tpwork(current);
   }
 
@@ -1542,11 +2490,26 @@ void pn_link_set_rcv_settle_mode(pn_link_t *link, pn_rcv_settle_mode_t mode)
 void pn_real_settle(pn_delivery_t *delivery)
 {
   pn_link_t *link = delivery->link;
+  if (link->remote_settled_upto == delivery) link->remote_settled_upto = NULL;
   LL_REMOVE(link, unsettled, delivery);
-  LL_ADD(link, settled, delivery);
-  pn_buffer_clear(delivery->tag);
-  pn_buffer_clear(delivery->bytes);
   delivery->settled = true;
+  pni_delivery_unspill(delivery);
+  if (delivery->resume != PNI_RESUME_NONE) link->state.resuming--;
+  delivery->resume = PNI_RESUME_NONE;
+  if (delivery->sent) {
+    pn_buffer_free(delivery->sent);
+    delivery->sent = NULL;
+  }
+  if (pn_refcount(delivery) > 1) {
+    // still referenced by an event, so it cannot be reused yet
+    pn_decref(delivery);
+    return;
+  }
+  pn_connection_t *conn = link->session->connection;
+  delivery->pool_next = conn->delivery_pool;
+  conn->delivery_pool = delivery;
+  delivery->tag_size = 0;
+  pn_buffer_clear(delivery->bytes);
 }
 
 void pn_full_settle(pn_delivery_map_t *db, pn_delivery_t *delivery)
@@ -1555,6 +2518,7 @@ void pn_full_settle(pn_delivery_map_t *db, pn_delivery_t *delivery)
   if (delivery->state.init) {
     pn_delivery_map_del(db, delivery);
   }
+  delivery->link->session->connection->settle_count++;
   pn_real_settle(delivery);
   pn_clear_tpwork(delivery);
 }
@@ -1585,7 +2549,7 @@ int pn_post_close(pn_transport_t *transport, const char *condition)
   if (!condition && pn_condition_is_set(cond)) {
     condition = pn_condition_get_name(cond);
     description = pn_condition_get_description(cond);
-    info = pn_condition_info(cond);
+    info = cond->info;
   }
 
   return pn_post_frame(transport->disp, 0, "DL[?DL[sSC]]", CLOSE,
@@ -1604,6 +2568,7 @@ int pn_do_error(pn_transport_t *transport, const char *condition, const char *fm
   if (!transport->close_sent) {
     pn_post_close(transport, condition);
     transport->close_sent = true;
+    pni_connection_charge(transport, true);
   }
   transport->disp->halt = true;
   fprintf(stderr, "ERROR %s %s\n", condition, pn_error_text(transport->error));
@@ -1648,7 +2613,8 @@ int pn_do_open(pn_dispatcher_t *disp)
     transport->remote_hostname = NULL;
   }
   if (conn) {
-    PN_SET_REMOTE(conn->endpoint.state, PN_REMOTE_ACTIVE);
+    pn_set_remote(&conn->endpoint, PN_REMOTE_ACTIVE);
+    pni_post_state(&conn->endpoint, true);
   } else {
     transport->disp->halt = true;
   }
@@ -1672,11 +2638,17 @@ int pn_do_begin(pn_dispatcher_t *disp)
     // XXX: what if session is NULL?
     ssn = (pn_session_t *) pn_hash_get(transport->local_channels, remote_channel);
   } else {
-    ssn = pn_session(transport->connection);
+    // a session begun on a previous transport is taken up again, both
+    // ends begin them in the order they were first begun
+    ssn = pn_session_head(transport->connection, 0);
+    while (ssn && !ssn->state.detached) ssn = pn_session_next(ssn, 0);
+    if (!ssn) ssn = pn_session(transport->connection);
   }
+  ssn->state.detached = false;
   ssn->state.incoming_transfer_count = next;
   pn_map_channel(transport, disp->channel, ssn);
-  PN_SET_REMOTE(ssn->endpoint.state, PN_REMOTE_ACTIVE);
+  pn_set_remote(&ssn->endpoint, PN_REMOTE_ACTIVE);
+  pni_post_state(&ssn->endpoint, true);
 
   return 0;
 }
@@ -1684,15 +2656,17 @@ int pn_do_begin(pn_dispatcher_t *disp)
 pn_link_t *pn_find_link(pn_session_t *ssn, pn_bytes_t name, bool is_sender)
 {
   pn_endpoint_type_t type = is_sender ? SENDER : RECEIVER;
+  uintptr_t key = pni_link_key(name.start, name.size, type);
 
-  for (size_t i = 0; i < pn_list_size(ssn->links); i++)
-  {
-    pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, i);
+  pn_link_t *link = (pn_link_t *) pn_hash_get(ssn->link_names, key);
+  while (link) {
     if (link->endpoint.type == type &&
-        !strncmp(name.start, pn_string_get(link->name), name.size))
+        pn_string_size(link->name) == name.size &&
+        (!name.size || !memcmp(pn_string_get(link->name), name.start, name.size)))
     {
       return link;
     }
+    link = link->name_next;
   }
   return NULL;
 }
@@ -1740,6 +2714,141 @@ static const char *dist_mode2symbol(const pn_distribution_mode_t mode)
   }
 }
 
+// queues the payload past offset to be transferred again
+static int pni_delivery_rewind(pn_transport_t *transport, pn_delivery_t *delivery,
+                               uint64_t offset)
+{
+  pn_link_t *link = delivery->link;
+  size_t kept = delivery->sent ? pn_buffer_size(delivery->sent) : 0;
+  if (offset > kept) offset = kept;
+  size_t resend = kept - offset;
+  if (resend) {
+    pn_bytes_t sent = pn_buffer_bytes(delivery->sent);
+    int err = pn_buffer_prepend(delivery->bytes, sent.start + offset, resend);
+    if (err) return err;
+    pn_buffer_trim(delivery->sent, 0, resend);
+    link->session->outgoing_bytes += resend;
+  }
+  delivery->transferred = offset;
+  delivery->resume = PNI_RESUME_READY;
+
+  pn_transport_stats_t *stats = &transport->disp->stats;
+  stats->resumed_deliveries++;
+  stats->resent_bytes += resend;
+  stats->resumed_bytes += offset;
+  return 0;
+}
+
+typedef struct {
+  pn_bytes_t tag;
+  pn_handle_t state;
+  bool matched;
+} pni_unsettled_entry_t;
+
+// Settles the question of each delivery carried over to this transport
+// against the unsettled map the peer attached with. A sender transfers
+// each delivery again, from the offset the receiver reports if it has
+// one and from the start otherwise; a terminal outcome is taken as the
+// remote disposition. A receiver expects a resumed transfer for every
+// delivery the sender still lists, and takes the rest as settled.
+static int pni_link_resume(pn_transport_t *transport, pn_link_t *link, pn_data_t *unsettled)
+{
+  bool sender = link->endpoint.type == SENDER;
+  pni_unsettled_entry_t *entries = NULL;
+  size_t count = 0;
+
+  pn_data_rewind(unsettled);
+  if (pn_data_next(unsettled) && pn_data_type(unsettled) == PN_MAP) {
+    size_t size = pn_data_get_map(unsettled) / 2;
+    entries = size ? (pni_unsettled_entry_t *) malloc(size * sizeof(pni_unsettled_entry_t)) : NULL;
+    if (size && !entries) return PN_ERR;
+    pn_data_enter(unsettled);
+    while (count < size && pn_data_next(unsettled)) {
+      pn_bytes_t tag = pn_data_type(unsettled) == PN_BINARY ?
+        pn_data_get_binary(unsettled) : pn_bytes(0, NULL);
+      if (!pn_data_next(unsettled)) break;
+      entries[count].tag = tag;
+      entries[count].state = pn_data_point(unsettled);
+      entries[count].matched = false;
+      count++;
+    }
+  }
+
+  // both ends list their deliveries in the order they were created, so
+  // the search for each starts where the last match was found
+  size_t cursor = 0;
+  int err = 0;
+  for (pn_delivery_t *d = link->unsettled_head; d && !err; d = d->unsettled_next) {
+    if (d->resume != PNI_RESUME_PENDING) continue;
+    pn_bytes_t tag = pni_delivery_tag(d);
+    pni_unsettled_entry_t *entry = NULL;
+    for (size_t i = 0; i < count; i++) {
+      pni_unsettled_entry_t *e = &entries[(cursor + i) % count];
+      if (!e->matched && e->tag.size == tag.size &&
+          !memcmp(e->tag.start, tag.start, tag.size)) {
+        entry = e;
+        cursor = (cursor + i + 1) % count;
+        break;
+      }
+    }
+    if (entry) entry->matched = true;
+
+    if (!sender) {
+      if (entry) {
+        d->resume = PNI_RESUME_EXPECTED;
+      } else {
+        // the sender has forgotten it
+        d->resume = PNI_RESUME_NONE;
+        link->state.resuming--;
+        d->remote.settled = true;
+        d->updated = true;
+        pn_work_update(transport->connection, d);
+        pni_post_event(transport->connection, PN_DELIVERY, d);
+      }
+      continue;
+    }
+
+    uint64_t offset = 0;
+    if (entry) {
+      pn_data_restore(unsettled, entry->state);
+      if (pn_data_type(unsettled) == PN_DESCRIBED) {
+        pn_data_enter(unsettled);
+        pn_data_next(unsettled);
+        uint64_t code = pn_data_get_ulong(unsettled);
+        if (code == PN_RECEIVED) {
+          if (pn_data_next(unsettled) && pn_data_get_list(unsettled)) {
+            pn_data_enter(unsettled);
+            pn_data_next(unsettled);
+            if (pn_data_next(unsettled)) offset = pn_data_get_ulong(unsettled);
+          }
+        } else if (code) {
+          // nothing more of it is needed
+          d->remote.type = code;
+          d->updated = true;
+          pn_work_update(transport->connection, d);
+          offset = d->transferred;
+        }
+      }
+    }
+    err = pni_delivery_rewind(transport, d, offset);
+  }
+  free(entries);
+  if (err) return err;
+
+  if (sender) {
+    // the work list keeps the link's deliveries in the order they were
+    // created, so resumed ones go out ahead of any created since
+    for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+      if (d->tpwork || d->resume == PNI_RESUME_READY) {
+        pn_clear_tpwork(d);
+        pn_add_tpwork(d);
+      }
+    }
+  }
+  pn_modified(transport->connection, &link->endpoint);
+  return 0;
+}
+
 int pn_do_attach(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = (pn_transport_t *) disp->context;
@@ -1784,7 +2893,8 @@ int pn_do_attach(pn_dispatcher_t *disp)
   }
 
   pn_map_handle(ssn, handle, link);
-  PN_SET_REMOTE(link->endpoint.state, PN_REMOTE_ACTIVE);
+  pn_set_remote(&link->endpoint, PN_REMOTE_ACTIVE);
+  pni_post_state(&link->endpoint, true);
   pn_terminus_t *rsrc = &link->remote_source;
   if (source.start || src_dynamic) {
     pn_terminus_set_type(rsrc, PN_SOURCE);
@@ -1797,8 +2907,14 @@ int pn_do_attach(pn_dispatcher_t *disp)
   } else {
     pn_terminus_set_type(rsrc, PN_UNSPECIFIED);
   }
+  bool tgt_described;
+  uint64_t tgt_descriptor = 0;
+  err = pn_scan_args(disp, "D.[......D?L.]", &tgt_described, &tgt_descriptor);
+  if (err) return err;
   pn_terminus_t *rtgt = &link->remote_target;
-  if (target.start || tgt_dynamic) {
+  if (tgt_described && tgt_descriptor == COORDINATOR) {
+    pn_terminus_set_type(rtgt, PN_COORDINATOR);
+  } else if (target.start || tgt_dynamic) {
     pn_terminus_set_type(rtgt, PN_TARGET);
     pn_terminus_set_address_bytes(rtgt, target);
     pn_terminus_set_durability(rtgt, tgt_dr);
@@ -1814,38 +2930,120 @@ int pn_do_attach(pn_dispatcher_t *disp)
   if (rcv_settle)
     link->remote_rcv_settle_mode = rcv_settle_mode;
 
-  pn_data_clear(link->remote_source.properties);
-  pn_data_clear(link->remote_source.filter);
-  pn_data_clear(link->remote_source.outcomes);
-  pn_data_clear(link->remote_source.capabilities);
-  pn_data_clear(link->remote_target.properties);
-  pn_data_clear(link->remote_target.capabilities);
-
+  pn_data_t **scan = transport->scan_data;
+  for (int i = 0; i < PN_SCAN_DATA; i++)
+    pn_data_clear(scan[i]);
   err = pn_scan_args(disp, "D.[.....D.[.....C.C.CC]D.[.....CC]",
-                     link->remote_source.properties,
-                     link->remote_source.filter,
-                     link->remote_source.outcomes,
-                     link->remote_source.capabilities,
-                     link->remote_target.properties,
-                     link->remote_target.capabilities);
+                     scan[0], scan[1], scan[2], scan[3], scan[4], scan[5]);
   if (err) return err;
+  if (rtgt->type == PN_COORDINATOR) {
+    pn_data_clear(scan[5]);
+    err = pn_scan_args(disp, "D.[......D.[C]]", scan[5]);
+    if (err) return err;
+  }
 
-  pn_data_rewind(link->remote_source.properties);
-  pn_data_rewind(link->remote_source.filter);
-  pn_data_rewind(link->remote_source.outcomes);
-  pn_data_rewind(link->remote_source.capabilities);
-  pn_data_rewind(link->remote_target.properties);
-  pn_data_rewind(link->remote_target.capabilities);
+  pn_data_t **copy[PN_SCAN_DATA] = {
+    &link->remote_source.properties, &link->remote_source.filter,
+    &link->remote_source.outcomes, &link->remote_source.capabilities,
+    &link->remote_target.properties, &link->remote_target.capabilities
+  };
+  for (int i = 0; i < PN_SCAN_DATA; i++) {
+    err = pni_data_assign(copy[i], scan[i]);
+    if (err) return err;
+  }
 
   if (!is_sender) {
     link->state.delivery_count = idc;
   }
 
+  if (link->state.resuming) {
+    pn_data_clear(transport->unsettled_data);
+    err = pn_scan_args(disp, "D.[.......C]", transport->unsettled_data);
+    if (err) return err;
+    err = pni_link_resume(transport, link, transport->unsettled_data);
+    if (err) return err;
+  }
+
   return 0;
 }
 
 int pn_post_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link);
 
+// Flows are not posted as the need for them arises but collected and
+// sent at the end of pn_process, see pn_process_flow_link and
+// pn_process_flow_session, so that however many links on a session
+// are given credit in one pass the session sends one flow for each
+// link whose state changed, or a single session flow if none did.
+static void pni_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link)
+{
+  pn_connection_t *conn = transport->connection;
+  if (link && !link->state.flow_pending) {
+    link->state.flow_pending = true;
+    pn_modified(conn, &link->endpoint);
+  }
+  if (!ssn->state.flow_pending) {
+    ssn->state.flow_pending = true;
+    pn_modified(conn, &ssn->endpoint);
+  }
+}
+
+// Moves what is buffered of a delivery into a temporary file. From
+// then on the payload no longer counts against the session's incoming
+// capacity, so the window stays open for the rest of the delivery.
+static int pni_delivery_spill(pn_delivery_t *delivery)
+{
+  FILE *file = pn_i_tmpfile();
+  if (!file) return PN_ERR;
+  pn_bytes_t head, tail;
+  pn_buffer_segments(delivery->bytes, &head, &tail);
+  if ((head.size && fwrite(head.start, 1, head.size, file) != head.size) ||
+      (tail.size && fwrite(tail.start, 1, tail.size, file) != tail.size)) {
+    fclose(file);
+    return PN_ERR;
+  }
+  delivery->spill = file;
+  delivery->spill_size = head.size + tail.size;
+  delivery->spill_read = 0;
+  delivery->link->session->incoming_bytes -= head.size + tail.size;
+  pn_buffer_clear(delivery->bytes);
+  return 0;
+}
+
+static int pni_delivery_append(pn_delivery_t *delivery, const char *bytes, size_t size)
+{
+  pn_link_t *link = delivery->link;
+  if (!delivery->spill && link->max_buffered &&
+      pn_buffer_size(delivery->bytes) + size > link->max_buffered) {
+    int err = pni_delivery_spill(delivery);
+    if (err) return err;
+  }
+
+  if (delivery->spill) {
+    if (pn_i_fseek(delivery->spill, delivery->spill_size) ||
+        fwrite(bytes, 1, size, delivery->spill) != size) {
+      return PN_ERR;
+    }
+    delivery->spill_size += size;
+    return 0;
+  }
+
+  int err = pn_buffer_append(delivery->bytes, bytes, size);
+  if (err) return err;
+  link->session->incoming_bytes += size;
+  return 0;
+}
+
+// the delivery a resumed transfer continues, see pni_link_resume
+static pn_delivery_t *pni_resumed_delivery(pn_link_t *link, pn_bytes_t tag)
+{
+  for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+    if (d->resume != PNI_RESUME_EXPECTED) continue;
+    pn_bytes_t dtag = pni_delivery_tag(d);
+    if (dtag.size == tag.size && !memcmp(dtag.start, tag.start, tag.size)) return d;
+  }
+  return NULL;
+}
+
 int pn_do_transfer(pn_dispatcher_t *disp)
 {
   // XXX: multi transfer
@@ -1856,8 +3054,13 @@ int pn_do_transfer(pn_dispatcher_t *disp)
   pn_sequence_t id;
   bool settled;
   bool more;
-  int err = pn_scan_args(disp, "D.[I?Iz.oo]", &handle, &id_present, &id, &tag,
-                         &settled, &more);
+  bool resume;
+  bool state_init;
+  uint64_t state_type = 0;
+  pn_data_clear(transport->disp_data);
+  int err = pn_scan_args(disp, "D.[I?Iz.oo.D?LCo]", &handle, &id_present, &id, &tag,
+                         &settled, &more, &state_init, &state_type,
+                         transport->disp_data, &resume);
   if (err) return err;
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
 
@@ -1866,20 +3069,34 @@ int pn_do_transfer(pn_dispatcher_t *disp)
   }
 
   pn_link_t *link = pn_handle_state(ssn, handle);
-  pn_delivery_t *delivery;
-  if (link->unsettled_tail && !link->unsettled_tail->done) {
-    delivery = link->unsettled_tail;
+  pn_delivery_map_t *incoming = &ssn->state.incoming;
+  pn_delivery_t *delivery = link->unsettled_tail;
+  if (id_present && ssn->state.incoming_init) {
+    // after a resumption the delivery being continued need not be the
+    // last one
+    pn_delivery_t *known = pn_delivery_map_get(incoming, id);
+    if (known && known->link == link) delivery = known;
+  }
+  if (delivery && !delivery->done && delivery->state.init) {
+    // continues a delivery already under way
   } else {
-    pn_delivery_map_t *incoming = &ssn->state.incoming;
-
     if (!ssn->state.incoming_init) {
       incoming->next = id;
+      incoming->base = id;
       ssn->state.incoming_init = true;
       ssn->incoming_deliveries++;
     }
 
-    delivery = pn_delivery(link, pn_dtag(tag.start, tag.size));
+    delivery = resume ? pni_resumed_delivery(link, tag) : NULL;
+    if (delivery) {
+      delivery->resume = PNI_RESUME_NONE;
+      link->state.resuming--;
+    } else {
+      delivery = pn_delivery(link, pn_dtag(tag.start, tag.size));
+      link->queued++;
+    }
     pn_delivery_state_t *state = pn_delivery_map_push(incoming, delivery);
+    if (!state) return PN_ERR;
     if (id_present && id != state->id) {
       int err = pn_do_error(transport, "amqp:session:invalid-field",
                             "sequencing error, expected delivery-id %u, got %u",
@@ -1891,9 +3108,12 @@ int pn_do_transfer(pn_dispatcher_t *disp)
 
     link->state.delivery_count++;
     link->state.link_credit--;
-    link->queued++;
 
-    // XXX: need to fill in remote state: delivery->remote.state = ...;
+    if (state_init && state_type == PN_TRANSACTIONAL_STATE) {
+      delivery->remote.type = state_type;
+      err = pn_data_copy(pni_disposition_data(&delivery->remote), transport->disp_data);
+      if (err) return err;
+    }
     delivery->remote.settled = settled;
     if (settled) {
       delivery->updated = true;
@@ -1901,16 +3121,22 @@ int pn_do_transfer(pn_dispatcher_t *disp)
     }
   }
 
-  pn_buffer_append(delivery->bytes, disp->payload, disp->size);
-  ssn->incoming_bytes += disp->size;
+  if (pni_delivery_append(delivery, disp->payload, disp->size)) {
+    return pn_do_error(transport, "amqp:internal-error",
+                       "cannot buffer %" PN_ZU " bytes of transfer payload", disp->size);
+  }
+  delivery->transferred += disp->size;
   delivery->done = !more;
 
   ssn->state.incoming_transfer_count++;
   ssn->state.incoming_window--;
+  pni_post_event(transport->connection, PN_DELIVERY, delivery);
 
-  // XXX: need better policy for when to refresh window
-  if (!ssn->state.incoming_window && (int32_t) link->state.local_handle >= 0) {
-    pn_post_flow(transport, ssn, link);
+  if (!ssn->state.incoming_window) {
+    pni_window_exhausted(transport, ssn);
+  }
+  if (pni_window_refresh(ssn)) {
+    pni_flow(transport, ssn, NULL);
   }
 
   return 0;
@@ -1935,6 +3161,9 @@ int pn_do_flow(pn_dispatcher_t *disp)
   } else {
     ssn->state.remote_incoming_window = iwin;
   }
+  if (ssn->state.stalled && ssn->state.remote_incoming_window > 0) {
+    pni_stall_charge(transport, ssn, true);
+  }
 
   if (handle_init) {
     pn_link_t *link = pn_handle_state(ssn, handle);
@@ -1950,6 +3179,9 @@ int pn_do_flow(pn_dispatcher_t *disp)
       link->state.link_credit = receiver_count + link_credit - link->state.delivery_count;
       link->credit += link->state.link_credit - old;
       link->drain = drain;
+      if (link->state.starved && link->state.link_credit > 0) {
+        pni_starve_charge(transport, link, true);
+      }
       pn_delivery_t *delivery = pn_link_current(link);
       if (delivery) pn_work_update(transport->connection, delivery);
     } else {
@@ -1960,6 +3192,7 @@ int pn_do_flow(pn_dispatcher_t *disp)
         link->credit -= delta;
       }
     }
+    pni_post_event(transport->connection, PN_LINK_FLOW, link);
   }
 
   return 0;
@@ -1969,19 +3202,101 @@ int pn_do_flow(pn_dispatcher_t *disp)
 #define SCAN_ERROR_DETACH ("D.[..D.[sSC]")
 #define SCAN_ERROR_DISP ("[D.[sSC]")
 
-static int pn_scan_error(pn_data_t *data, pn_condition_t *condition, const char *fmt)
+// the info is scanned into the transport's scratch data so that the
+// condition only allocates what the peer actually sent
+static int pn_scan_error(pn_transport_t *transport, pn_data_t *data,
+                         pn_condition_t *condition, const char *fmt)
 {
   pn_bytes_t cond;
   pn_bytes_t desc;
+  pn_data_t *info = transport->scan_data[0];
+  pn_data_clear(info);
   pn_condition_clear(condition);
-  int err = pn_data_scan(data, fmt, &cond, &desc, condition->info);
+  int err = pn_data_scan(data, fmt, &cond, &desc, info);
   if (err) return err;
-  strncat(condition->name, cond.start, cond.size);
-  strncat(condition->description, desc.start, desc.size);
-  pn_data_rewind(condition->info);
+  err = pni_string_assign(&condition->name, cond.start, cond.size);
+  if (err) return err;
+  err = pni_string_assign(&condition->description, desc.start, desc.size);
+  if (err) return err;
+  return pni_data_assign(&condition->info, info);
+}
+
+static void pni_disposition_copy(pn_disposition_t *dst, pn_disposition_t *src)
+{
+  dst->section_number = src->section_number;
+  dst->section_offset = src->section_offset;
+  dst->failed = src->failed;
+  dst->undeliverable = src->undeliverable;
+  if (src->data || dst->data)
+    pn_data_copy(pni_disposition_data(dst), pni_disposition_data(src));
+  if (src->annotations || dst->annotations)
+    pn_data_copy(pni_disposition_annotations(dst), pni_disposition_annotations(src));
+  pni_condition_copy(&dst->condition, &src->condition);
+}
+
+// The outcome of a disposition frame is decoded once, into a
+// disposition cleared for each frame, and copied from there to every
+// delivery in the range, so nothing a delivery held from an earlier
+// outcome survives.
+static pn_disposition_t *pni_disposition_outcome(pn_transport_t *transport)
+{
+  if (!transport->disp_outcome) {
+    transport->disp_outcome = (pn_disposition_t *) malloc(sizeof(pn_disposition_t));
+    if (!transport->disp_outcome) return NULL;
+    pn_disposition_init(transport->disp_outcome);
+  }
+  pn_disposition_clear(transport->disp_outcome);
+  return transport->disp_outcome;
+}
+
+static int pni_disposition_decode(pn_transport_t *transport, pn_disposition_t *outcome,
+                                  uint64_t type)
+{
+  pn_data_t *data = transport->disp_data;
+  switch (type) {
+  case PN_RECEIVED:
+    pn_data_rewind(data);
+    pn_data_next(data);
+    pn_data_enter(data);
+    if (pn_data_next(data))
+      outcome->section_number = pn_data_get_uint(data);
+    if (pn_data_next(data))
+      outcome->section_offset = pn_data_get_ulong(data);
+    break;
+  case PN_ACCEPTED:
+    break;
+  case PN_REJECTED:
+    return pn_scan_error(transport, data, &outcome->condition, SCAN_ERROR_DISP);
+  case PN_RELEASED:
+    break;
+  case PN_MODIFIED:
+    pn_data_rewind(data);
+    pn_data_next(data);
+    pn_data_enter(data);
+    if (pn_data_next(data))
+      outcome->failed = pn_data_get_bool(data);
+    if (pn_data_next(data))
+      outcome->undeliverable = pn_data_get_bool(data);
+    pn_data_narrow(data);
+    pn_data_appendn(pni_disposition_annotations(outcome), data, 1);
+    pn_data_widen(data);
+    break;
+  default:
+    pn_data_copy(pni_disposition_data(outcome), data);
+    break;
+  }
   return 0;
 }
 
+// A range is applied in one pass over the session's delivery index:
+// the outcome is decoded once, and a range of more than one delivery
+// posts a single PN_DELIVERY_RANGE event for the session instead of an
+// event per delivery. The frame is still O(n) in the deliveries it
+// covers: each one has its remote state set and goes on the work list
+// here, because pn_delivery_remote_state(), pn_delivery_settled() and
+// pn_work_head() read that state from the delivery itself, and
+// deferring it would make every one of those reads look for ranges
+// not yet applied.
 int pn_do_disposition(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = (pn_transport_t *) disp->context;
@@ -2008,52 +3323,39 @@ int pn_do_disposition(pn_dispatcher_t *disp)
   bool remote_data = (pn_data_next(transport->disp_data) &&
                       pn_data_get_list(transport->disp_data) > 0);
 
-  for (pn_sequence_t id = first; id <= last; id++) {
-    pn_delivery_t *delivery = pn_delivery_map_get(deliveries, id);
+  size_t offset, count;
+  if (!pni_delivery_map_range(deliveries, first, last, &offset, &count))
+    return 0;
+
+  pn_disposition_t *outcome = NULL;
+  if (remote_data) {
+    outcome = pni_disposition_outcome(transport);
+    if (!outcome) return PN_ERR;
+    err = pni_disposition_decode(transport, outcome, type);
+    if (err) return err;
+  }
+
+  pn_connection_t *conn = transport->connection;
+  pn_delivery_t *only = NULL;
+  size_t updated = 0;
+  size_t mask = deliveries->capacity - 1;
+  for (size_t i = offset; i < offset + count; i++) {
+    pn_delivery_t *delivery = deliveries->slots[(deliveries->head + i) & mask];
+    if (!delivery) continue;
     pn_disposition_t *remote = &delivery->remote;
-    if (delivery) {
-      if (type_init) remote->type = type;
-      if (remote_data) {
-        switch (type) {
-        case PN_RECEIVED:
-          pn_data_rewind(transport->disp_data);
-          pn_data_next(transport->disp_data);
-          pn_data_enter(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->section_number = pn_data_get_uint(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->section_offset = pn_data_get_ulong(transport->disp_data);
-          break;
-        case PN_ACCEPTED:
-          break;
-        case PN_REJECTED:
-          err = pn_scan_error(transport->disp_data, &remote->condition, SCAN_ERROR_DISP);
-          if (err) return err;
-          break;
-        case PN_RELEASED:
-          break;
-        case PN_MODIFIED:
-          pn_data_rewind(transport->disp_data);
-          pn_data_next(transport->disp_data);
-          pn_data_enter(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->failed = pn_data_get_bool(transport->disp_data);
-          if (pn_data_next(transport->disp_data))
-            remote->undeliverable = pn_data_get_bool(transport->disp_data);
-          pn_data_narrow(transport->disp_data);
-          pn_data_clear(remote->data);
-          pn_data_appendn(remote->annotations, transport->disp_data, 1);
-          pn_data_widen(transport->disp_data);
-          break;
-        default:
-          pn_data_copy(remote->data, transport->disp_data);
-          break;
-        }
-      }
-      remote->settled = settled;
-      delivery->updated = true;
-      pn_work_update(transport->connection, delivery);
-    }
+    if (type_init) remote->type = type;
+    if (outcome) pni_disposition_copy(remote, outcome);
+    remote->settled = settled;
+    delivery->updated = true;
+    pn_work_update(conn, delivery);
+    only = delivery;
+    updated++;
+  }
+
+  if (updated == 1) {
+    pni_post_event(conn, PN_DELIVERY, only);
+  } else if (updated) {
+    pni_post_event(conn, PN_DELIVERY_RANGE, ssn);
   }
 
   return 0;
@@ -2073,14 +3375,16 @@ int pn_do_detach(pn_dispatcher_t *disp)
   }
   pn_link_t *link = pn_handle_state(ssn, handle);
 
-  err = pn_scan_error(disp->args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
+  err = pn_scan_error(transport, disp->args, &link->endpoint.remote_condition, SCAN_ERROR_DETACH);
   if (err) return err;
 
   pn_unmap_handle(ssn, link);
+  pni_starve_charge(transport, link, true);
 
   if (closed)
   {
-    PN_SET_REMOTE(link->endpoint.state, PN_REMOTE_CLOSED);
+    pn_set_remote(&link->endpoint, PN_REMOTE_CLOSED);
+    pni_post_state(&link->endpoint, true);
   } else {
     // TODO: implement
   }
@@ -2092,10 +3396,12 @@ int pn_do_end(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = (pn_transport_t *) disp->context;
   pn_session_t *ssn = pn_channel_state(transport, disp->channel);
-  int err = pn_scan_error(disp->args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, disp->args, &ssn->endpoint.remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   pn_unmap_channel(transport, ssn);
-  PN_SET_REMOTE(ssn->endpoint.state, PN_REMOTE_CLOSED);
+  pni_session_charge(transport, ssn, true);
+  pn_set_remote(&ssn->endpoint, PN_REMOTE_CLOSED);
+  pni_post_state(&ssn->endpoint, true);
   return 0;
 }
 
@@ -2103,10 +3409,12 @@ int pn_do_close(pn_dispatcher_t *disp)
 {
   pn_transport_t *transport = (pn_transport_t *) disp->context;
   pn_connection_t *conn = transport->connection;
-  int err = pn_scan_error(disp->args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
+  int err = pn_scan_error(transport, disp->args, &transport->remote_condition, SCAN_ERROR_DEFAULT);
   if (err) return err;
   transport->close_rcvd = true;
-  PN_SET_REMOTE(conn->endpoint.state, PN_REMOTE_CLOSED);
+  pni_connection_charge(transport, true);
+  pn_set_remote(&conn->endpoint, PN_REMOTE_CLOSED);
+  pni_post_state(&conn->endpoint, true);
   return 0;
 }
 
@@ -2294,6 +3602,8 @@ int pn_process_conn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
     if (!(endpoint->state & PN_LOCAL_UNINIT) && !transport->open_sent)
     {
       pn_connection_t *connection = (pn_connection_t *) endpoint;
+      // pick up the TLS record size if an ssl layer has been added
+      pni_frame_policy(transport);
       int err = pn_post_frame(transport->disp, 0, "DL[SS?In?InnCCC]", OPEN,
                               pn_string_get(connection->container),
                               pn_string_get(connection->hostname),
@@ -2311,11 +3621,15 @@ int pn_process_conn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
   return 0;
 }
 
-static uint16_t allocate_alias(pn_hash_t *aliases)
+// Aliases are never released once used, so the search resumes after
+// the last one handed out rather than probing every alias in use.
+static uint16_t allocate_alias(pn_hash_t *aliases, uint32_t *next)
 {
   for (uint32_t i = 0; i < 65536; i++) {
-    if (!pn_hash_get(aliases, i)) {
-      return i;
+    uint32_t alias = (*next + i) % 65536;
+    if (!pn_hash_get(aliases, alias)) {
+      *next = alias + 1;
+      return alias;
     }
   }
 
@@ -2331,9 +3645,10 @@ int pn_process_ssn_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
     pn_session_state_t *state = &ssn->state;
     if (!(endpoint->state & PN_LOCAL_UNINIT) && state->local_channel == (uint16_t) -1)
     {
-      uint16_t channel = allocate_alias(transport->local_channels);
+      uint16_t channel = allocate_alias(transport->local_channels, &transport->next_channel);
       state->incoming_window = pn_session_incoming_window(ssn);
       state->outgoing_window = pn_session_outgoing_window(ssn);
+      state->window_low = state->incoming_window / 4;
       pn_post_frame(transport->disp, channel, "DL[?HIII]", BEGIN,
                     ((int16_t) state->remote_channel >= 0), state->remote_channel,
                     state->outgoing_transfer_count,
@@ -2360,7 +3675,63 @@ static const char *expiry_symbol(pn_expiry_policy_t policy)
   case PN_NEVER:
     return "never";
   }
-  return NULL;
+  return NULL;
+}
+
+// The unsettled map of an attach: the tag of every delivery carried over
+// from a previous transport, with the state the receiver has for it.
+// Receivers report a terminal outcome if they have one and otherwise
+// how much of the payload arrived; senders leave that to the receiver.
+static pn_data_t *pni_unsettled_encode(pn_transport_t *transport, pn_link_t *link)
+{
+  if (!link->state.resuming) return NULL;
+  pn_data_t *data = transport->unsettled_data;
+  pn_data_clear(data);
+  pn_data_put_map(data);
+  pn_data_enter(data);
+  for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+    if (d->resume == PNI_RESUME_NONE) continue;
+    pn_bytes_t tag = pni_delivery_tag(d);
+    pn_data_put_binary(data, tag);
+    if (link->endpoint.type == SENDER) {
+      pn_data_put_null(data);
+    } else if (d->local.type && d->local.type != PN_RECEIVED) {
+      pn_data_clear(transport->disp_data);
+      pni_disposition_encode(&d->local, transport->disp_data);
+      if (pn_data_size(transport->disp_data)) {
+        pn_data_fill(data, "DLC", d->local.type, transport->disp_data);
+      } else {
+        pn_data_fill(data, "DL[]", d->local.type);
+      }
+    } else {
+      pn_data_fill(data, "DL[IL]", PN_RECEIVED, 0, d->transferred);
+    }
+  }
+  pn_data_exit(data);
+  return data;
+}
+
+// the target of an attach, a coordinator has nothing to it but the
+// capabilities the transaction controller asks for
+static pn_data_t *pni_target_encode(pn_transport_t *transport, pn_link_t *link)
+{
+  pn_terminus_t *target = &link->target;
+  if (!target->type) return NULL;
+  pn_data_t *data = transport->target_data;
+  pn_data_clear(data);
+  if (target->type == PN_COORDINATOR) {
+    pn_data_fill(data, "DL[C]", COORDINATOR, target->capabilities);
+  } else {
+    pn_data_fill(data, "DL[SIsIoCC]", TARGET,
+                 pn_terminus_get_address(target),
+                 target->durability,
+                 expiry_symbol(target->expiry_policy),
+                 target->timeout,
+                 target->dynamic,
+                 target->properties,
+                 target->capabilities);
+  }
+  return data;
 }
 
 int pn_process_link_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
@@ -2374,18 +3745,18 @@ int pn_process_link_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
     if (((int16_t) ssn_state->local_channel >= 0) &&
         !(endpoint->state & PN_LOCAL_UNINIT) && state->local_handle == (uint32_t) -1)
     {
-      state->local_handle = allocate_alias(ssn_state->local_handles);
+      state->local_handle = allocate_alias(ssn_state->local_handles, &ssn_state->next_handle);
       pn_hash_put(ssn_state->local_handles, state->local_handle, link);
       const pn_distribution_mode_t dist_mode = link->source.distribution_mode;
       int err = pn_post_frame(transport->disp, ssn_state->local_channel,
-                              "DL[SIoBB?DL[SIsIoC?sCnCC]?DL[SIsIoCC]nnI]", ATTACH,
+                              "DL[SIoBB?DL[SIsIoC?sCnCC]CCnI]", ATTACH,
                               pn_string_get(link->name),
                               state->local_handle,
                               endpoint->type == RECEIVER,
                               link->snd_settle_mode,
                               link->rcv_settle_mode,
                               (bool) link->source.type, SOURCE,
-                              pn_string_get(link->source.address),
+                              pn_terminus_get_address(&link->source),
                               link->source.durability,
                               expiry_symbol(link->source.expiry_policy),
                               link->source.timeout,
@@ -2395,14 +3766,8 @@ int pn_process_link_setup(pn_transport_t *transport, pn_endpoint_t *endpoint)
                               link->source.filter,
                               link->source.outcomes,
                               link->source.capabilities,
-                              (bool) link->target.type, TARGET,
-                              pn_string_get(link->target.address),
-                              link->target.durability,
-                              expiry_symbol(link->target.expiry_policy),
-                              link->target.timeout,
-                              link->target.dynamic,
-                              link->target.properties,
-                              link->target.capabilities,
+                              pni_target_encode(transport, link),
+                              pni_unsettled_encode(transport, link),
                               0);
       if (err) return err;
     }
@@ -2416,7 +3781,7 @@ int pn_post_flow(pn_transport_t *transport, pn_session_t *ssn, pn_link_t *link)
   ssn->state.incoming_window = pn_session_incoming_window(ssn);
   ssn->state.outgoing_window = pn_session_outgoing_window(ssn);
   bool linkq = (bool) link;
-  pn_link_state_t *state = &link->state;
+  pn_link_state_t *state = linkq ? &link->state : NULL;
   return pn_post_frame(transport->disp, ssn->state.local_channel, "DL[?IIII?I?I?In?o]", FLOW,
                        (int16_t) ssn->state.remote_channel >= 0, ssn->state.incoming_transfer_count,
                        ssn->state.incoming_window,
@@ -2436,10 +3801,15 @@ int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
     pn_session_t *ssn = rcv->session;
     pn_link_state_t *state = &rcv->state;
     if ((int16_t) ssn->state.local_channel >= 0 &&
-        (int32_t) state->local_handle >= 0 &&
-        ((rcv->drain || state->link_credit != rcv->credit - rcv->queued) || !ssn->state.incoming_window)) {
-      state->link_credit = rcv->credit - rcv->queued;
-      return pn_post_flow(transport, ssn, rcv);
+        (int32_t) state->local_handle >= 0) {
+      // deliveries resumed from a previous transport need credit again
+      pn_sequence_t credit = rcv->credit - rcv->queued + state->resuming;
+      if (rcv->drain || state->link_credit != credit) {
+        state->link_credit = credit;
+        pni_flow(transport, ssn, rcv);
+      } else if (pni_window_refresh(ssn)) {
+        pni_flow(transport, ssn, NULL);
+      }
     }
   }
 
@@ -2448,21 +3818,23 @@ int pn_process_flow_receiver(pn_transport_t *transport, pn_endpoint_t *endpoint)
 
 int pn_flush_disp(pn_transport_t *transport, pn_session_t *ssn)
 {
-  uint64_t code = ssn->state.disp_code;
-  bool settled = ssn->state.disp_settled;
-  if (ssn->state.disp) {
-    int err = pn_post_frame(transport->disp, ssn->state.local_channel, "DL[oIIo?DL[]]", DISPOSITION,
-                            ssn->state.disp_type, ssn->state.disp_first, ssn->state.disp_last,
-                            settled, (bool)code, code);
-    if (err) return err;
-    ssn->state.disp_type = 0;
-    ssn->state.disp_code = 0;
-    ssn->state.disp_settled = 0;
-    ssn->state.disp_first = 0;
-    ssn->state.disp_last = 0;
-    ssn->state.disp = false;
+  pn_disp_set_t *set = &ssn->state.disp;
+  size_t sent = 0;
+  int err = 0;
+  while (sent < set->size) {
+    pn_disp_range_t *range = &set->ranges[sent];
+    err = pn_post_frame(transport->disp, ssn->state.local_channel, "DL[oIIo?DL[]]", DISPOSITION,
+                        range->role, range->first, range->last,
+                        range->settled, (bool)range->code, range->code);
+    if (err) break;
+    sent++;
   }
-  return 0;
+  // keep whatever could not be posted for the next attempt
+  if (sent && sent < set->size) {
+    memmove(set->ranges, set->ranges + sent, (set->size - sent)*sizeof(pn_disp_range_t));
+  }
+  set->size -= sent;
+  return err;
 }
 
 int pn_post_disp(pn_transport_t *transport, pn_delivery_t *delivery)
@@ -2489,84 +3861,140 @@ int pn_post_disp(pn_transport_t *transport, pn_delivery_t *delivery)
                          (bool)code, code, transport->disp_data);
   }
 
-  if (ssn_state->disp && code == ssn_state->disp_code &&
-      delivery->local.settled == ssn_state->disp_settled &&
-      ssn_state->disp_type == role) {
-    if (state->id == ssn_state->disp_first - 1) {
-      ssn_state->disp_first = state->id;
-      return 0;
-    } else if (state->id == ssn_state->disp_last + 1) {
-      ssn_state->disp_last = state->id;
-      return 0;
-    }
+  // sent by pn_process_flush_disp later in the same pass; nothing runs
+  // in between that could give the delivery a different disposition
+  return pn_disp_set_add(&ssn_state->disp, role, delivery->local.settled, code, state->id);
+}
+
+static bool pni_transfer_pending(pn_delivery_t *delivery)
+{
+  return !delivery->state.sent && delivery->resume != PNI_RESUME_PENDING &&
+    (delivery->done || pn_buffer_size(delivery->bytes) > 0);
+}
+
+static bool pni_transfer_ready(pn_delivery_t *delivery)
+{
+  pn_link_t *link = delivery->link;
+  pn_session_state_t *ssn_state = &link->session->state;
+  return (int16_t) ssn_state->local_channel >= 0 &&
+    (int32_t) link->state.local_handle >= 0 &&
+    pni_transfer_pending(delivery) &&
+    ssn_state->remote_incoming_window > 0 && link->state.link_credit > 0;
+}
+
+// posts at most frame_limit transfer frames for the delivery, returns
+// the number of bytes written to the dispatcher or an error; once the
+// last frame is sent the delivery may be settled, so completion is
+// reported through *complete
+static ssize_t pni_post_transfer(pn_transport_t *transport, pn_delivery_t *delivery,
+                                 pn_sequence_t frame_limit, bool *complete)
+{
+  pn_link_t *link = delivery->link;
+  pn_session_state_t *ssn_state = &link->session->state;
+  pn_link_state_t *link_state = &link->state;
+  pn_delivery_state_t *state = &delivery->state;
+  size_t available = transport->disp->available;
+
+  if (!state->init) {
+    state = pn_delivery_map_push(&ssn_state->outgoing, delivery);
+    if (!state) return PN_ERR;
+    if (delivery->done)
+      pni_frame_observe(transport, pn_buffer_size(delivery->bytes));
   }
 
-  if (ssn_state->disp) {
-    int err = pn_flush_disp(transport, ssn);
-    if (err) return err;
+  // a buffer that has wrapped goes out from both of its pieces rather
+  // than being moved into one first
+  pn_bytes_t head, tail;
+  pn_buffer_segments(delivery->bytes, &head, &tail);
+  pn_set_payload_segments(transport->disp, head, tail);
+  pn_bytes_t tag = pni_delivery_tag(delivery);
+  // the only state a sender gives its transfers is the transaction
+  // they belong to
+  uint64_t state_code = 0;
+  if (delivery->local.type == PN_TRANSACTIONAL_STATE) {
+    state_code = PN_TRANSACTIONAL_STATE;
+    pn_data_clear(transport->disp_data);
+    pni_disposition_encode(&delivery->local, transport->disp_data);
+  }
+  int count = pn_post_transfer_frame(transport->disp,
+                                     ssn_state->local_channel,
+                                     link_state->local_handle,
+                                     state->id, &tag,
+                                     0, // message-format
+                                     delivery->local.settled,
+                                     !delivery->done,
+                                     state_code, transport->disp_data,
+                                     delivery->resume == PNI_RESUME_READY,
+                                     pn_min(frame_limit, ssn_state->remote_incoming_window));
+  if (count < 0) return count;
+  ssn_state->outgoing_transfer_count += count;
+  ssn_state->remote_incoming_window -= count;
+  if (count > 0 && delivery->resume == PNI_RESUME_READY) {
+    delivery->resume = PNI_RESUME_NONE;
+    link_state->resuming--;
   }
 
-  ssn_state->disp_type = role;
-  ssn_state->disp_code = code;
-  ssn_state->disp_settled = delivery->local.settled;
-  ssn_state->disp_first = state->id;
-  ssn_state->disp_last = state->id;
-  ssn_state->disp = true;
+  int sent = head.size + tail.size - transport->disp->output_size;
+  if (link->resumable && sent > 0 && !delivery->local.settled) {
+    // kept so that a resumed transfer can start part way through
+    if (!delivery->sent) delivery->sent = pn_buffer(sent);
+    if (!delivery->sent) return PN_ERR;
+    size_t n = pn_min((size_t) sent, head.size);
+    int err = pn_buffer_append(delivery->sent, head.start, n);
+    if (!err && n < (size_t) sent)
+      err = pn_buffer_append(delivery->sent, tail.start, sent - n);
+    if (err) return err;
+  }
+  delivery->transferred += sent;
+  pn_buffer_trim(delivery->bytes, sent, 0);
+  link->session->outgoing_bytes -= sent;
+  *complete = !pn_buffer_size(delivery->bytes) && delivery->done;
+  if (*complete) {
+    state->sent = true;
+    link_state->delivery_count++;
+    link_state->link_credit--;
+    link->queued--;
+    link->session->outgoing_deliveries--;
+    if (delivery->local.settled) {
+      pn_full_settle(&ssn_state->outgoing, delivery);
+    } else {
+      pn_clear_tpwork(delivery);
+    }
+  }
 
-  return 0;
+  return transport->disp->available - available;
 }
 
+// Transfers themselves are sent by the egress scheduler, see
+// pni_schedule_transfers.
 int pn_process_tpwork_sender(pn_transport_t *transport, pn_delivery_t *delivery)
 {
   pn_link_t *link = delivery->link;
   pn_session_state_t *ssn_state = &link->session->state;
   pn_link_state_t *link_state = &link->state;
-  bool xfr_posted = false;
-  if ((int16_t) ssn_state->local_channel >= 0 && (int32_t) link_state->local_handle >= 0) {
-    pn_delivery_state_t *state = &delivery->state;
-    if (!state->sent && (delivery->done || pn_buffer_size(delivery->bytes) > 0) &&
-        ssn_state->remote_incoming_window > 0 && link_state->link_credit > 0) {
-      if (!state->init) {
-        state = pn_delivery_map_push(&ssn_state->outgoing, delivery);
-      }
-
-      pn_bytes_t bytes = pn_buffer_bytes(delivery->bytes);
-      pn_set_payload(transport->disp, bytes.start, bytes.size);
-      pn_bytes_t tag = pn_buffer_bytes(delivery->tag);
-      int count = pn_post_transfer_frame(transport->disp,
-                                         ssn_state->local_channel,
-                                         link_state->local_handle,
-                                         state->id, &tag,
-                                         0, // message-format
-                                         delivery->local.settled,
-                                         !delivery->done,
-                                         ssn_state->remote_incoming_window);
-      if (count < 0) return count;
-      xfr_posted = true;
-      ssn_state->outgoing_transfer_count += count;
-      ssn_state->remote_incoming_window -= count;
-
-      int sent = bytes.size - transport->disp->output_size;
-      pn_buffer_trim(delivery->bytes, sent, 0);
-      link->session->outgoing_bytes -= sent;
-      if (!pn_buffer_size(delivery->bytes) && delivery->done) {
-        state->sent = true;
-        link_state->delivery_count++;
-        link_state->link_credit--;
-        link->queued--;
-        link->session->outgoing_deliveries--;
-      }
+  if ((int16_t) ssn_state->local_channel >= 0 && (int32_t) link_state->local_handle >= 0 &&
+      pni_transfer_pending(delivery)) {
+    if (ssn_state->remote_incoming_window <= 0 && !ssn_state->stalled) {
+      ssn_state->stalled = true;
+      ssn_state->stalled_since = transport->disp->timing ? pn_i_now_usec() : 0;
+      ssn_state->window_stalls++;
+      transport->disp->stats.window_stalls++;
+    }
+    if (link_state->link_credit <= 0 && !link_state->starved) {
+      link_state->starved = true;
+      link_state->starved_since = transport->disp->timing ? pn_i_now_usec() : 0;
     }
   }
 
   pn_delivery_state_t *state = delivery->state.init ? &delivery->state : NULL;
   if ((int16_t) ssn_state->local_channel >= 0 && !delivery->remote.settled
-      && state && state->sent && !xfr_posted) {
+      && state && state->sent) {
     int err = pn_post_disp(transport, delivery);
     if (err) return err;
   }
 
-  if (delivery->local.settled && state && state->sent) {
+  // sent on this transport or, if not in the map, on a previous one
+  if (delivery->local.settled && delivery->state.sent) {
     pn_full_settle(&ssn_state->outgoing, delivery);
   }
 
@@ -2587,15 +4015,147 @@ int pn_process_tpwork_receiver(pn_transport_t *transport, pn_delivery_t *deliver
     pn_full_settle(&ssn->state.incoming, delivery);
   }
 
-  // XXX: need to centralize this policy and improve it
-  if (!ssn->state.incoming_window) {
-    int err = pn_post_flow(transport, ssn, link);
-    if (err) return err;
+  if (pni_window_refresh(ssn)) {
+    pni_flow(transport, ssn, NULL);
   }
 
   return 0;
 }
 
+/*
+ * Egress scheduler. Each connection keeps a ring of sender links per
+ * priority class. Classes are served strictly highest first; within a
+ * class links take turns by deficit round robin, each turn adding the
+ * link's weight times one frame's worth of bytes to its deficit and
+ * sending frames until the deficit is spent. A link may overdraw by up
+ * to one frame, which is repaid on its next turn. Scheduling stops once
+ * PN_EGRESS_BUDGET bytes are queued for output, so that frames from
+ * links that become ready later are not stuck behind a bulk transfer;
+ * the rings persist across passes so the next pass resumes where this
+ * one stopped.
+ */
+
+static void pni_sched_append(pn_connection_t *conn, pn_link_t *link)
+{
+  int p = link->priority;
+  link->sched_next = NULL;
+  link->sched_prev = conn->sched_tail[p];
+  if (conn->sched_tail[p]) {
+    conn->sched_tail[p]->sched_next = link;
+  } else {
+    conn->sched_head[p] = link;
+  }
+  conn->sched_tail[p] = link;
+  link->scheduled = true;
+}
+
+static void pni_sched_unlink(pn_link_t *link)
+{
+  pn_connection_t *conn = link->session->connection;
+  int p = link->priority;
+  if (link->sched_prev) {
+    link->sched_prev->sched_next = link->sched_next;
+  } else {
+    conn->sched_head[p] = link->sched_next;
+  }
+  if (link->sched_next) {
+    link->sched_next->sched_prev = link->sched_prev;
+  } else {
+    conn->sched_tail[p] = link->sched_prev;
+  }
+  link->sched_next = NULL;
+  link->sched_prev = NULL;
+  link->scheduled = false;
+}
+
+static void pni_sched_remove(pn_link_t *link)
+{
+  if (!link->scheduled) return;
+  pni_sched_unlink(link);
+  link->sched_delivery = NULL;
+  // an idle link does not bank credit for later
+  link->state.deficit = 0;
+}
+
+static void pni_sched_offer(pn_connection_t *conn, pn_delivery_t *delivery)
+{
+  pn_link_t *link = delivery->link;
+  if (!link->sched_delivery && pni_transfer_ready(delivery)) {
+    link->sched_delivery = delivery;
+    if (!link->scheduled) pni_sched_append(conn, link);
+  }
+}
+
+// a link's deliveries go out in the order they were created, so only
+// the next one on its unsettled list can follow a completed delivery
+static pn_delivery_t *pni_sched_successor(pn_delivery_t *next)
+{
+  return next && pni_transfer_ready(next) ? next : NULL;
+}
+
+static int pni_schedule_transfers(pn_transport_t *transport, pn_connection_t *conn)
+{
+  int err = 0;
+  int64_t quantum = pn_transport_get_output_frame(transport);
+  if (!quantum) quantum = PN_ADAPTIVE_FRAME_CEILING;
+
+  for (int priority = PN_LINK_PRIORITIES - 1; priority >= 0; priority--) {
+    pn_link_t *link;
+    while (!err && (link = conn->sched_head[priority]) &&
+           transport->disp->available < PN_EGRESS_BUDGET) {
+      pn_delivery_t *delivery = link->sched_delivery;
+      if (!delivery) {
+        pni_sched_remove(link);
+        continue;
+      }
+
+      // a positive deficit means the budget cut this link's last turn short
+      if (link->state.deficit <= 0)
+        link->state.deficit += quantum * link->weight;
+      while (delivery && link->state.deficit > 0 &&
+             transport->disp->available < PN_EGRESS_BUDGET) {
+        // links sharing the session may have used up its window since
+        // the delivery was offered
+        if (!pni_transfer_ready(delivery)) {
+          delivery = NULL;
+          break;
+        }
+        // read before posting, which may settle the delivery
+        pn_delivery_t *next = delivery->unsettled_next;
+        bool complete;
+        ssize_t n = pni_post_transfer(transport, delivery, 1, &complete);
+        if (n < 0) {
+          err = n;
+          break;
+        }
+        link->state.deficit -= n;
+        if (complete) {
+          delivery = pni_sched_successor(next);
+        } else if (!pni_transfer_ready(delivery)) {
+          delivery = NULL;
+        }
+      }
+
+      link->sched_delivery = delivery;
+      if (!delivery) {
+        pni_sched_remove(link);
+      } else if (link->state.deficit <= 0) {
+        // turn over, go to the back of the ring
+        pni_sched_unlink(link);
+        pni_sched_append(conn, link);
+      }
+    }
+  }
+
+  // deliveries are only pinned for the duration of a pass
+  for (int priority = 0; priority < PN_LINK_PRIORITIES; priority++) {
+    for (pn_link_t *link = conn->sched_head[priority]; link; link = link->sched_next)
+      link->sched_delivery = NULL;
+  }
+
+  return err;
+}
+
 int pn_process_tpwork(pn_transport_t *transport, pn_endpoint_t *endpoint)
 {
   if (endpoint->type == CONNECTION && !transport->close_sent)
@@ -2610,6 +4170,7 @@ int pn_process_tpwork(pn_transport_t *transport, pn_endpoint_t *endpoint)
       if (pn_link_is_sender(link)) {
         int err = pn_process_tpwork_sender(transport, delivery);
         if (err) return err;
+        if (delivery->tpwork) pni_sched_offer(conn, delivery);
       } else {
         int err = pn_process_tpwork_receiver(transport, delivery);
         if (err) return err;
@@ -2621,6 +4182,8 @@ int pn_process_tpwork(pn_transport_t *transport, pn_endpoint_t *endpoint)
 
       delivery = tp_next;
     }
+
+    return pni_schedule_transfers(transport, conn);
   }
 
   return 0;
@@ -2656,7 +4219,43 @@ int pn_process_flow_sender(pn_transport_t *transport, pn_endpoint_t *endpoint)
         state->delivery_count += state->link_credit;
         state->link_credit = 0;
         snd->drained = false;
-        return pn_post_flow(transport, ssn, snd);
+        pni_flow(transport, ssn, snd);
+      }
+    }
+  }
+
+  return 0;
+}
+
+int pn_process_flow_link(pn_transport_t *transport, pn_endpoint_t *endpoint)
+{
+  if (endpoint->type == SENDER || endpoint->type == RECEIVER)
+  {
+    pn_link_t *link = (pn_link_t *) endpoint;
+    if (link->state.flow_pending) {
+      link->state.flow_pending = false;
+      pn_session_t *ssn = link->session;
+      if ((int16_t) ssn->state.local_channel >= 0 &&
+          (int32_t) link->state.local_handle >= 0) {
+        // every flow carries the session state as well
+        ssn->state.flow_pending = false;
+        return pn_post_flow(transport, ssn, link);
+      }
+    }
+  }
+
+  return 0;
+}
+
+int pn_process_flow_session(pn_transport_t *transport, pn_endpoint_t *endpoint)
+{
+  if (endpoint->type == SESSION)
+  {
+    pn_session_t *ssn = (pn_session_t *) endpoint;
+    if (ssn->state.flow_pending) {
+      ssn->state.flow_pending = false;
+      if ((int16_t) ssn->state.local_channel >= 0) {
+        return pn_post_flow(transport, ssn, NULL);
       }
     }
   }
@@ -2686,13 +4285,14 @@ int pn_process_link_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
       if (pn_condition_is_set(&endpoint->condition)) {
         name = pn_condition_get_name(&endpoint->condition);
         description = pn_condition_get_description(&endpoint->condition);
-        info = pn_condition_info(&endpoint->condition);
+        info = endpoint->condition.info;
       }
 
       int err = pn_post_frame(transport->disp, ssn_state->local_channel, "DL[Io?DL[sSC]]", DETACH,
                               state->local_handle, true, (bool) name, ERROR, name, description, info);
       if (err) return err;
       state->local_handle = -2;
+      pni_starve_charge(transport, link, true);
     }
 
     pn_clear_modified(transport->connection, endpoint);
@@ -2742,13 +4342,14 @@ int pn_process_ssn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
       if (pn_condition_is_set(&endpoint->condition)) {
         name = pn_condition_get_name(&endpoint->condition);
         description = pn_condition_get_description(&endpoint->condition);
-        info = pn_condition_info(&endpoint->condition);
+        info = endpoint->condition.info;
       }
 
       int err = pn_post_frame(transport->disp, state->local_channel, "DL[?DL[sSC]]", END,
                               (bool) name, ERROR, name, description, info);
       if (err) return err;
       state->local_channel = -2;
+      pni_session_charge(transport, session, true);
     }
 
     pn_clear_modified(transport->connection, endpoint);
@@ -2765,6 +4366,7 @@ int pn_process_conn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
       int err = pn_post_close(transport, NULL);
       if (err) return err;
       transport->close_sent = true;
+      pni_connection_charge(transport, true);
     }
 
     pn_clear_modified(transport->connection, endpoint);
@@ -2772,10 +4374,11 @@ int pn_process_conn_teardown(pn_transport_t *transport, pn_endpoint_t *endpoint)
   return 0;
 }
 
-int pn_phase(pn_transport_t *transport, int (*phase)(pn_transport_t *, pn_endpoint_t *))
+int pn_phase(pn_transport_t *transport, pn_dirty_kind_t kind,
+             int (*phase)(pn_transport_t *, pn_endpoint_t *))
 {
   pn_connection_t *conn = transport->connection;
-  pn_endpoint_t *endpoint = conn->transport_head;
+  pn_endpoint_t *endpoint = conn->dirty[kind].transport_head;
   while (endpoint)
   {
     pn_endpoint_t *next = endpoint->transport_next;
@@ -2788,24 +4391,28 @@ int pn_phase(pn_transport_t *transport, int (*phase)(pn_transport_t *, pn_endpoi
 
 int pn_process(pn_transport_t *transport)
 {
+  pn_connection_t *conn = transport->connection;
   int err;
-  if ((err = pn_phase(transport, pn_process_conn_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_ssn_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_link_setup))) return err;
-  if ((err = pn_phase(transport, pn_process_flow_receiver))) return err;
-
-  // XXX: this has to happen two times because we might settle stuff
-  // on the first pass and create space for more work to be done on the
-  // second pass
-  if ((err = pn_phase(transport, pn_process_tpwork))) return err;
-  if ((err = pn_phase(transport, pn_process_tpwork))) return err;
-
-  if ((err = pn_phase(transport, pn_process_flush_disp))) return err;
-
-  if ((err = pn_phase(transport, pn_process_flow_sender))) return err;
-  if ((err = pn_phase(transport, pn_process_link_teardown))) return err;
-  if ((err = pn_phase(transport, pn_process_ssn_teardown))) return err;
-  if ((err = pn_phase(transport, pn_process_conn_teardown))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_CONNECTION, pn_process_conn_setup))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_SESSION, pn_process_ssn_setup))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_LINK, pn_process_link_setup))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_LINK, pn_process_flow_receiver))) return err;
+
+  // settling stuff on the first pass may create space for more work
+  // to be done on a second pass, so only then is it worth another one
+  uint64_t settled = conn->settle_count;
+  if ((err = pn_phase(transport, PN_DIRTY_CONNECTION, pn_process_tpwork))) return err;
+  if (conn->settle_count != settled &&
+      (err = pn_phase(transport, PN_DIRTY_CONNECTION, pn_process_tpwork))) return err;
+
+  if ((err = pn_phase(transport, PN_DIRTY_SESSION, pn_process_flush_disp))) return err;
+
+  if ((err = pn_phase(transport, PN_DIRTY_LINK, pn_process_flow_sender))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_LINK, pn_process_flow_link))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_SESSION, pn_process_flow_session))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_LINK, pn_process_link_teardown))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_SESSION, pn_process_ssn_teardown))) return err;
+  if ((err = pn_phase(transport, PN_DIRTY_CONNECTION, pn_process_conn_teardown))) return err;
 
   if (transport->connection->tpwork_head) {
     pn_modified(transport->connection, &transport->connection->endpoint);
@@ -2846,7 +4453,12 @@ static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t
   }
 
   if (!pn_error_code(transport->error)) {
+    pn_transport_stats_t *stats = &transport->disp->stats;
+    uint64_t start = transport->disp->timing ? pn_i_now_usec() : 0;
     pn_error_set(transport->error, pn_process(transport), "process error");
+    stats->process_calls++;
+    if (transport->disp->timing)
+      stats->process_time += pn_i_now_usec() - start;
   }
 
   if (!transport->disp->available && (transport->close_sent || pn_error_code(transport->error))) {
@@ -2859,37 +4471,86 @@ static ssize_t pn_output_write_amqp(pn_io_layer_t *io_layer, char *bytes, size_t
   return pn_dispatcher_output(transport->disp, bytes, size);
 }
 
-// generate outbound data, return amount of pending output else error
+// chunks beyond this many are freed rather than kept for reuse
+#define PNI_CHUNK_CACHE (4)
+
+static pni_chunk_t *pni_chunk_append(pn_transport_t *transport)
+{
+  pni_chunk_t *chunk = transport->output_free;
+  if (chunk) {
+    transport->output_free = chunk->next;
+    transport->output_free_count--;
+  } else {
+    chunk = (pni_chunk_t *) malloc(sizeof(pni_chunk_t));
+    if (!chunk) return NULL;
+    transport->output_size += PNI_CHUNK_SIZE;
+  }
+  chunk->next = NULL;
+  chunk->start = 0;
+  chunk->end = 0;
+  if (transport->output_tail)
+    transport->output_tail->next = chunk;
+  else
+    transport->output_head = chunk;
+  transport->output_tail = chunk;
+  return chunk;
+}
+
+// retire the head chunk once everything in it has been popped
+static void pni_chunk_release(pn_transport_t *transport)
+{
+  pni_chunk_t *chunk = transport->output_head;
+  transport->output_head = chunk->next;
+  if (!transport->output_head) transport->output_tail = NULL;
+  if (transport->output_free_count < PNI_CHUNK_CACHE) {
+    chunk->next = transport->output_free;
+    transport->output_free = chunk;
+    transport->output_free_count++;
+  } else {
+    free(chunk);
+    transport->output_size -= PNI_CHUNK_SIZE;
+  }
+}
+
+// copy up to size pending bytes from the head without popping them
+static size_t pni_output_copy(pn_transport_t *transport, char *dst, size_t size)
+{
+  size_t copied = 0;
+  pni_chunk_t *chunk = transport->output_head;
+  while (chunk && copied < size) {
+    size_t n = pn_min(size - copied, chunk->end - chunk->start);
+    memmove(dst + copied, &chunk->bytes[chunk->start], n);
+    copied += n;
+    chunk = chunk->next;
+  }
+  return copied;
+}
+
+// generate outbound data, return amount of pending output at the head
+// chunk else error
 static ssize_t transport_produce(pn_transport_t *transport)
 {
   pn_io_layer_t *io_layer = transport->io_layers;
-  ssize_t space = transport->output_size - transport->output_pending;
 
-  if (space == 0) {     // can we expand the buffer?
-    int more = 0;
-    if (!transport->remote_max_frame)   // no limit, so double it
-      more = transport->output_size;
-    else if (transport->remote_max_frame > transport->output_size)
-      more = transport->remote_max_frame - transport->output_size;
-    if (more) {
-      char *newbuf = (char *)malloc( transport->output_size + more );
-      if (newbuf) {
-        memmove( newbuf, transport->output_buf, transport->output_pending );
-        free( transport->output_buf );
-        transport->output_buf = newbuf;
-        transport->output_size += more;
-        space = more;
-      }
+  // Chunks are added as the tail fills until twice what was pending on
+  // entry, capped by the peer's max frame size, so the backlog grows as
+  // the old doubling buffer did without pending output being copied.
+  size_t limit = 2 * transport->output_pending;
+  if (transport->remote_max_frame && limit > transport->remote_max_frame)
+    limit = transport->remote_max_frame;
+  if (limit < PNI_CHUNK_SIZE) limit = PNI_CHUNK_SIZE;
+
+  pni_chunk_t *tail = transport->output_tail;
+  while (true) {
+    if (!tail || tail->end == PNI_CHUNK_SIZE) {
+      if (transport->output_pending >= limit) break;
+      tail = pni_chunk_append(transport);
+      if (!tail) break;
     }
-  }
-
-  while (space > 0) {
-    ssize_t n;
-    n = io_layer->process_output( io_layer,
-                                  &transport->output_buf[transport->output_pending],
-                                  space );
+    ssize_t n = io_layer->process_output( io_layer, &tail->bytes[tail->end],
+                                          PNI_CHUNK_SIZE - tail->end );
     if (n > 0) {
-      space -= n;
+      tail->end += n;
       transport->output_pending += n;
     } else if (n == 0) {
       break;
@@ -2906,7 +4567,10 @@ static ssize_t transport_produce(pn_transport_t *transport)
       return n;
     }
   }
-  return transport->output_pending;
+  if (transport->output_pending > transport->disp->stats.output_high_water)
+    transport->disp->stats.output_high_water = transport->output_pending;
+  pni_chunk_t *head = transport->output_head;
+  return head ? head->end - head->start : 0;
 }
 
 // deprecated
@@ -2915,8 +4579,7 @@ ssize_t pn_transport_output(pn_transport_t *transport, char *bytes, size_t size)
   if (!transport) return PN_ARG_ERR;
   ssize_t available = pn_transport_pending(transport);
   if (available > 0) {
-    available = (ssize_t) pn_min( (size_t)available, size );
-    memmove( bytes, pn_transport_head(transport), available );
+    available = (ssize_t) pni_output_copy(transport, bytes, size);
     pn_transport_pop( transport, (size_t) available );
   }
   return available;
@@ -2943,6 +4606,36 @@ void pn_transport_set_max_frame(pn_transport_t *transport, uint32_t size)
   transport->local_max_frame = size;
 }
 
+void pn_transport_set_adaptive_frame(pn_transport_t *transport, bool adaptive)
+{
+  assert(transport);
+  transport->adaptive_frame = adaptive;
+  pni_frame_policy(transport);
+}
+
+bool pn_transport_get_adaptive_frame(pn_transport_t *transport)
+{
+  assert(transport);
+  return transport->adaptive_frame;
+}
+
+void pn_transport_set_send_buffer_hint(pn_transport_t *transport, size_t size)
+{
+  assert(transport);
+  transport->send_buffer_hint = size;
+  pni_frame_policy(transport);
+}
+
+uint32_t pn_transport_get_output_frame(pn_transport_t *transport)
+{
+  assert(transport);
+  size_t size = transport->disp->remote_max_frame;
+  size_t preferred = transport->disp->output_max_frame;
+  if (preferred && (!size || preferred < size))
+    size = preferred;
+  return size;
+}
+
 uint32_t pn_transport_get_remote_max_frame(pn_transport_t *transport)
 {
   return transport->remote_max_frame;
@@ -2979,6 +4672,76 @@ ssize_t pn_link_send(pn_link_t *sender, const char *bytes, size_t n)
   return n;
 }
 
+// true if a settled message of the given size can be written straight
+// to the transport: the link is attached with credit and nothing queued
+// ahead of it, and the message fits into a single frame
+static bool pni_send_settled_ready(pn_transport_t *transport, pn_link_t *sender,
+                                   size_t tag_size, size_t size)
+{
+  pn_session_state_t *ssn_state = &sender->session->state;
+  pn_link_state_t *state = &sender->state;
+  if (transport->close_sent ||
+      (int16_t) ssn_state->local_channel < 0 || (int32_t) state->local_handle < 0 ||
+      !(sender->endpoint.state & PN_LOCAL_ACTIVE))
+    return false;
+  if (sender->queued || sender->credit <= 0 ||
+      state->link_credit <= 0 || ssn_state->remote_incoming_window <= 0)
+    return false;
+  if (transport->disp->available >= PN_EGRESS_BUDGET)
+    return false;
+
+  // as pn_post_transfer_frame works out the frame size, leaving room
+  // for the transfer performative
+  pn_dispatcher_t *disp = transport->disp;
+  size_t max_frame = disp->remote_max_frame;
+  if (disp->output_max_frame && (!max_frame || disp->output_max_frame < max_frame))
+    max_frame = disp->output_max_frame;
+  return !max_frame || size + tag_size + 64 <= max_frame - 8;
+}
+
+ssize_t pn_link_send_settled(pn_link_t *sender, pn_delivery_tag_t tag, const char *bytes, size_t n)
+{
+  if (!sender || sender->endpoint.type != SENDER) return PN_ARG_ERR;
+  // a delivery still being written would come first
+  if (sender->snd_settle_mode == PN_SND_UNSETTLED || sender->current) return PN_STATE_ERR;
+
+  pn_connection_t *conn = sender->session->connection;
+  pn_transport_t *transport = conn->transport;
+  if (!transport || !pni_send_settled_ready(transport, sender, tag.size, n)) {
+    // queue it as an ordinary delivery that is settled straight away
+    pn_delivery_t *delivery = pn_delivery(sender, tag);
+    if (!delivery) return PN_ERR;
+    pn_link_send(sender, bytes, n);
+    pn_link_advance(sender);
+    pn_delivery_settle(delivery);
+    return n;
+  }
+
+  pn_session_state_t *ssn_state = &sender->session->state;
+  pn_link_state_t *state = &sender->state;
+  pn_sequence_t id;
+  if (pni_delivery_map_skip(&ssn_state->outgoing, &id)) return PN_ERR;
+
+  pn_bytes_t tag_bytes = pn_bytes(tag.size, (char *) tag.bytes);
+  pn_set_payload(transport->disp, bytes, n);
+  int count = pn_post_transfer_frame(transport->disp,
+                                     ssn_state->local_channel,
+                                     state->local_handle,
+                                     id, &tag_bytes,
+                                     0, // message-format
+                                     true, false, 0, NULL, false, 1);
+  if (count < 0) return count;
+
+  ssn_state->outgoing_transfer_count += count;
+  ssn_state->remote_incoming_window -= count;
+  state->delivery_count++;
+  state->link_credit--;
+  sender->credit--;
+  pni_frame_observe(transport, n);
+  pni_post_event(conn, PN_TRANSPORT, conn);
+  return n;
+}
+
 void pn_link_drained(pn_link_t *sender)
 {
   if (sender && sender->drain && sender->credit > 0) {
@@ -2993,12 +4756,22 @@ ssize_t pn_link_recv(pn_link_t *receiver, char *bytes, size_t n)
   if (!receiver) return PN_ARG_ERR;
 
   pn_delivery_t *delivery = receiver->current;
-  if (delivery) {
+  if (delivery && delivery->spill) {
+    uint64_t left = delivery->spill_size - delivery->spill_read;
+    size_t size = left < n ? (size_t) left : n;
+    if (!size) return delivery->done ? PN_EOS : 0;
+    if (pn_i_fseek(delivery->spill, delivery->spill_read) ||
+        fread(bytes, 1, size, delivery->spill) != size) {
+      return PN_ERR;
+    }
+    delivery->spill_read += size;
+    return size;
+  } else if (delivery) {
     size_t size = pn_buffer_get(delivery->bytes, 0, n, bytes);
     pn_buffer_trim(delivery->bytes, size, 0);
     if (size) {
       receiver->session->incoming_bytes -= size;
-      if (!receiver->session->state.incoming_window) {
+      if (pni_window_refresh(receiver->session)) {
         pn_add_tpwork(delivery);
       }
       return size;
@@ -3047,6 +4820,167 @@ uint64_t pn_transport_get_frames_input(const pn_transport_t *transport)
   return 0;
 }
 
+const pn_transport_stats_t *pn_transport_stats(pn_transport_t *transport)
+{
+  assert(transport);
+  pni_connection_charge(transport, false);
+  return &transport->disp->stats;
+}
+
+void pn_transport_stats_reset(pn_transport_t *transport)
+{
+  assert(transport);
+  // stalls in progress count from the reset on
+  pni_connection_charge(transport, false);
+  memset(&transport->disp->stats, 0, sizeof(pn_transport_stats_t));
+}
+
+void pn_transport_set_stats_timing(pn_transport_t *transport, bool enabled)
+{
+  assert(transport);
+  transport->disp->timing = enabled;
+}
+
+bool pn_transport_get_stats_timing(pn_transport_t *transport)
+{
+  assert(transport);
+  return transport->disp->timing;
+}
+
+static size_t pni_condition_footprint(pn_condition_t *condition)
+{
+  return pni_string_footprint(condition->name) +
+    pni_string_footprint(condition->description) +
+    pni_data_footprint(condition->info);
+}
+
+// what an endpoint holds beyond the object it is embedded in
+static size_t pni_endpoint_footprint(pn_endpoint_t *endpoint)
+{
+  return pni_error_footprint(endpoint->error) +
+    pni_condition_footprint(&endpoint->condition) +
+    pni_condition_footprint(&endpoint->remote_condition);
+}
+
+static size_t pni_terminus_footprint(pn_terminus_t *terminus)
+{
+  return pni_string_footprint(terminus->address) +
+    pni_data_footprint(terminus->properties) +
+    pni_data_footprint(terminus->capabilities) +
+    pni_data_footprint(terminus->outcomes) +
+    pni_data_footprint(terminus->filter);
+}
+
+static size_t pni_disposition_footprint(pn_disposition_t *disposition)
+{
+  return pni_data_footprint(disposition->data) +
+    pni_data_footprint(disposition->annotations) +
+    pni_condition_footprint(&disposition->condition);
+}
+
+static size_t pni_delivery_footprint(pn_delivery_t *delivery)
+{
+  return pni_object_footprint(sizeof(pn_delivery_t)) +
+    pni_buffer_footprint(delivery->tag) +
+    pni_buffer_footprint(delivery->bytes) +
+    pni_disposition_footprint(&delivery->local) +
+    pni_disposition_footprint(&delivery->remote);
+}
+
+static size_t pni_dispatcher_footprint(pn_dispatcher_t *disp)
+{
+  if (!disp) return 0;
+  return sizeof(pn_dispatcher_t) +
+    pni_buffer_footprint(disp->input) +
+    pni_data_footprint(disp->args) +
+    pni_data_footprint(disp->output_args) +
+    pni_buffer_footprint(disp->frame) +
+    disp->capacity +
+    (disp->scratch ? SCRATCH : 0);
+}
+
+static size_t pni_transport_footprint(pn_transport_t *transport)
+{
+  size_t size = sizeof(pn_transport_t) +
+    pni_dispatcher_footprint(transport->disp) +
+    (transport->remote_container ? strlen(transport->remote_container) + 1 : 0) +
+    (transport->remote_hostname ? strlen(transport->remote_hostname) + 1 : 0) +
+    pni_data_footprint(transport->remote_offered_capabilities) +
+    pni_data_footprint(transport->remote_desired_capabilities) +
+    pni_data_footprint(transport->remote_properties) +
+    pni_data_footprint(transport->disp_data) +
+    pni_data_footprint(transport->unsettled_data) +
+    pni_condition_footprint(&transport->remote_condition) +
+    pni_error_footprint(transport->error) +
+    pni_hash_footprint(transport->local_channels) +
+    pni_hash_footprint(transport->remote_channels) +
+    transport->input_size +
+    transport->output_size;
+  for (int i = 0; i < PN_SCAN_DATA; i++)
+    size += pni_data_footprint(transport->scan_data[i]);
+  return size;
+}
+
+int pn_connection_memory_usage(pn_connection_t *connection, pn_memory_usage_t *usage)
+{
+  if (!connection || !usage) return PN_ARG_ERR;
+  memset(usage, 0, sizeof(*usage));
+
+  usage->connection = pni_object_footprint(sizeof(pn_connection_t)) +
+    pni_endpoint_footprint(&connection->endpoint) +
+    pni_string_footprint(connection->container) +
+    pni_string_footprint(connection->hostname) +
+    pni_data_footprint(connection->offered_capabilities) +
+    pni_data_footprint(connection->desired_capabilities) +
+    pni_data_footprint(connection->properties) +
+    pni_list_footprint(connection->sessions);
+
+  size_t nsessions = pn_list_size(connection->sessions);
+  for (size_t i = 0; i < nsessions; i++) {
+    pn_session_t *ssn = (pn_session_t *) pn_list_get(connection->sessions, i);
+    pn_session_state_t *state = &ssn->state;
+    usage->session_count++;
+    usage->sessions += pni_object_footprint(sizeof(pn_session_t)) +
+      pni_endpoint_footprint(&ssn->endpoint) +
+      pni_list_footprint(ssn->links) +
+      pni_hash_footprint(ssn->link_names) +
+      pni_hash_footprint(state->local_handles) +
+      pni_hash_footprint(state->remote_handles) +
+      (state->incoming.capacity + state->outgoing.capacity) * sizeof(pn_delivery_t *) +
+      state->disp.capacity * sizeof(pn_disp_range_t);
+
+    size_t nlinks = pn_list_size(ssn->links);
+    for (size_t j = 0; j < nlinks; j++) {
+      pn_link_t *link = (pn_link_t *) pn_list_get(ssn->links, j);
+      usage->link_count++;
+      usage->links += pni_object_footprint(sizeof(pn_link_t)) +
+        pni_endpoint_footprint(&link->endpoint) +
+        pni_string_footprint(link->name) +
+        pni_terminus_footprint(&link->source) +
+        pni_terminus_footprint(&link->target) +
+        pni_terminus_footprint(&link->remote_source) +
+        pni_terminus_footprint(&link->remote_target);
+
+      for (pn_delivery_t *d = link->unsettled_head; d; d = d->unsettled_next) {
+        usage->delivery_count++;
+        usage->deliveries += pni_delivery_footprint(d);
+      }
+    }
+  }
+
+  for (pn_delivery_t *d = connection->delivery_pool; d; d = d->pool_next) {
+    usage->delivery_count++;
+    usage->deliveries += pni_delivery_footprint(d);
+  }
+
+  if (connection->transport)
+    usage->transport = pni_transport_footprint(connection->transport);
+
+  usage->total = usage->connection + usage->sessions + usage->links +
+    usage->deliveries + usage->transport;
+  return 0;
+}
+
 pn_link_t *pn_delivery_link(pn_delivery_t *delivery)
 {
   if (!delivery) return NULL;
@@ -3120,7 +5054,31 @@ bool pn_delivery_readable(pn_delivery_t *delivery)
 
 size_t pn_delivery_pending(pn_delivery_t *delivery)
 {
-  return pn_buffer_size(delivery->bytes);
+  return pn_buffer_size(delivery->bytes) +
+    (size_t) (delivery->spill_size - delivery->spill_read);
+}
+
+bool pn_delivery_spilled(pn_delivery_t *delivery)
+{
+  return delivery && delivery->spill;
+}
+
+const char *pn_delivery_map(pn_delivery_t *delivery, size_t *size)
+{
+  if (!delivery || !size || !delivery->done || !pn_delivery_readable(delivery))
+    return NULL;
+  if (!delivery->spill) {
+    pn_bytes_t bytes = pn_buffer_bytes(delivery->bytes);
+    *size = bytes.size;
+    return bytes.start;
+  }
+  if (!delivery->map) {
+    delivery->map = pn_i_map_file(delivery->spill, delivery->spill_size);
+    if (!delivery->map) return NULL;
+    delivery->map_size = delivery->spill_size;
+  }
+  *size = (size_t) (delivery->spill_size - delivery->spill_read);
+  return (const char *) delivery->map + delivery->spill_read;
 }
 
 bool pn_delivery_partial(pn_delivery_t *delivery)
@@ -3167,60 +5125,46 @@ pn_condition_t *pn_link_remote_condition(pn_link_t *link)
 
 bool pn_condition_is_set(pn_condition_t *condition)
 {
-  return condition && condition->name[0];
+  return condition && pni_condition_str(condition->name);
 }
 
 void pn_condition_clear(pn_condition_t *condition)
 {
   assert(condition);
-  condition->name[0] = '\0';
-  condition->description[0] = '\0';
-  pn_data_clear(condition->info);
+  if (condition->name) pn_string_clear(condition->name);
+  if (condition->description) pn_string_clear(condition->description);
+  if (condition->info) pn_data_clear(condition->info);
 }
 
 const char *pn_condition_get_name(pn_condition_t *condition)
 {
   assert(condition);
-  return condition->name[0] ? condition->name : NULL;
-}
-
-static inline int pn_set_buf(char *dst, const char *src, size_t capacity)
-{
-  if (!src) {
-    dst[0] = '\0';
-    return 0;
-  } else {
-    unsigned n = strlen(src) + 1;
-    if (n > capacity) {
-      return PN_ARG_ERR;
-    } else {
-      strncpy(dst, src, n);
-      return 0;
-    }
-  }
+  return pni_condition_str(condition->name);
 }
 
 int pn_condition_set_name(pn_condition_t *condition, const char *name)
 {
   assert(condition);
-  return pn_set_buf(condition->name, name, COND_NAME_MAX);
+  return pni_string_assign(&condition->name, name, name ? strlen(name) : 0);
 }
 
 const char *pn_condition_get_description(pn_condition_t *condition)
 {
   assert(condition);
-  return condition->description[0] ? condition->description : NULL;
+  return pni_condition_str(condition->description);
 }
 
 int pn_condition_set_description(pn_condition_t *condition, const char *description)
 {
   assert(condition);
-  return pn_set_buf(condition->description, description, COND_DESC_MAX);
+  return pni_string_assign(&condition->description, description,
+                           description ? strlen(description) : 0);
 }
 
 pn_data_t *pn_condition_info(pn_condition_t *condition)
 {
   assert(condition);
+  if (!condition->info) condition->info = pn_data(16);
   return condition->info;
 }
 
@@ -3374,12 +5318,29 @@ ssize_t pn_transport_pending(pn_transport_t *transport)      /* <0 == done */
 
 const char *pn_transport_head(pn_transport_t *transport)
 {
-  if (transport && transport->output_pending) {
-    return transport->output_buf;
+  pni_chunk_t *head = transport ? transport->output_head : NULL;
+  if (head && head->end > head->start) {
+    return &head->bytes[head->start];
   }
   return NULL;
 }
 
+int pn_transport_head_vec(pn_transport_t *transport, pn_bytes_t *vec, int count)
+{
+  if (!transport) return PN_ARG_ERR;
+  int n = 0;
+  pni_chunk_t *chunk = transport->output_head;
+  while (chunk && n < count) {
+    if (chunk->end > chunk->start) {
+      vec[n].start = &chunk->bytes[chunk->start];
+      vec[n].size = chunk->end - chunk->start;
+      n++;
+    }
+    chunk = chunk->next;
+  }
+  return n;
+}
+
 int pn_transport_peek(pn_transport_t *transport, char *dst, size_t size)
 {
   assert(transport);
@@ -3387,16 +5348,11 @@ int pn_transport_peek(pn_transport_t *transport, char *dst, size_t size)
   ssize_t pending = pn_transport_pending(transport);
   if (pending < 0) {
     return pending;
-  } else if (size > (size_t) pending) {
+  } else if (size > transport->output_pending) {
     return PN_UNDERFLOW;
   }
 
-  if (pending > 0) {
-    const char *src = pn_transport_head(transport);
-    assert(src);
-    memmove(dst, src, size);
-  }
-
+  pni_output_copy(transport, dst, size);
   return 0;
 }
 
@@ -3406,9 +5362,12 @@ void pn_transport_pop(pn_transport_t *transport, size_t size)
     assert( transport->output_pending >= size );
     transport->output_pending -= size;
     transport->bytes_output += size;
-    if (transport->output_pending) {
-      memmove( transport->output_buf,  &transport->output_buf[size],
-               transport->output_pending );
+    while (size) {
+      pni_chunk_t *head = transport->output_head;
+      size_t n = pn_min(size, head->end - head->start);
+      head->start += n;
+      size -= n;
+      if (head->start == head->end) pni_chunk_release(transport);
     }
   }
 }
@@ -31,6 +31,12 @@ struct pn_error_t {
   pn_error_t *root;
 };
 
+size_t pni_error_footprint(pn_error_t *error)
+{
+  if (!error) return 0;
+  return sizeof(pn_error_t) + (error->text ? strlen(error->text) + 1 : 0);
+}
+
 pn_error_t *pn_error()
 {
   pn_error_t *error = (pn_error_t *) malloc(sizeof(pn_error_t));
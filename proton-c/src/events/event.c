@@ -0,0 +1,205 @@
+/*
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <proton/event.h>
+#include <proton/object.h>
+#include <stdlib.h>
+#include "../engine/engine-internal.h"
+
+struct pn_event_t {
+  pn_event_type_t type;
+  void *context;    // referenced until the event is popped
+  pn_event_t *next;
+};
+
+struct pn_collector_t {
+  pn_event_t *head;
+  pn_event_t *tail;
+  pn_event_t *free_head;  // popped events kept for reuse
+  bool freed;
+};
+
+static void pni_collector_drain(pn_collector_t *collector)
+{
+  while (pn_collector_pop(collector));
+  while (collector->free_head) {
+    pn_event_t *event = collector->free_head;
+    collector->free_head = event->next;
+    free(event);
+  }
+}
+
+static void pn_collector_finalize(void *object)
+{
+  pni_collector_drain((pn_collector_t *) object);
+}
+
+pn_collector_t *pn_collector(void)
+{
+  static pn_class_t clazz = {pn_collector_finalize};
+  pn_collector_t *collector = (pn_collector_t *) pn_new(sizeof(pn_collector_t), &clazz);
+  if (!collector) return NULL;
+  collector->head = NULL;
+  collector->tail = NULL;
+  collector->free_head = NULL;
+  collector->freed = false;
+  return collector;
+}
+
+void pn_collector_free(pn_collector_t *collector)
+{
+  if (!collector) return;
+  // connections still pointing here hold references of their own, so
+  // just stop recording and let the last of them finalize it
+  collector->freed = true;
+  pni_collector_drain(collector);
+  pn_decref(collector);
+}
+
+void pn_collector_put(pn_collector_t *collector, pn_event_type_t type, void *context)
+{
+  if (!collector || collector->freed) return;
+
+  pn_event_t *tail = collector->tail;
+  if (tail && tail->type == type && tail->context == context) return;
+
+  pn_event_t *event = collector->free_head;
+  if (event) {
+    collector->free_head = event->next;
+  } else {
+    event = (pn_event_t *) malloc(sizeof(pn_event_t));
+    if (!event) return;
+  }
+
+  event->type = type;
+  event->context = pn_incref(context);
+  event->next = NULL;
+  if (tail) {
+    tail->next = event;
+  } else {
+    collector->head = event;
+  }
+  collector->tail = event;
+}
+
+pn_event_t *pn_collector_peek(pn_collector_t *collector)
+{
+  return collector ? collector->head : NULL;
+}
+
+bool pn_collector_pop(pn_collector_t *collector)
+{
+  pn_event_t *event = collector ? collector->head : NULL;
+  if (!event) return false;
+
+  collector->head = event->next;
+  if (!collector->head) collector->tail = NULL;
+  // the context may be finalized here, which can put more events
+  void *context = event->context;
+  event->context = NULL;
+  event->next = collector->free_head;
+  collector->free_head = event;
+  pn_decref(context);
+  return true;
+}
+
+const char *pn_event_type_name(pn_event_type_t type)
+{
+  switch (type) {
+  case PN_EVENT_NONE:
+    return "PN_EVENT_NONE";
+  case PN_CONNECTION_LOCAL_STATE:
+    return "PN_CONNECTION_LOCAL_STATE";
+  case PN_CONNECTION_REMOTE_STATE:
+    return "PN_CONNECTION_REMOTE_STATE";
+  case PN_SESSION_LOCAL_STATE:
+    return "PN_SESSION_LOCAL_STATE";
+  case PN_SESSION_REMOTE_STATE:
+    return "PN_SESSION_REMOTE_STATE";
+  case PN_LINK_LOCAL_STATE:
+    return "PN_LINK_LOCAL_STATE";
+  case PN_LINK_REMOTE_STATE:
+    return "PN_LINK_REMOTE_STATE";
+  case PN_LINK_FLOW:
+    return "PN_LINK_FLOW";
+  case PN_DELIVERY:
+    return "PN_DELIVERY";
+  case PN_TRANSPORT:
+    return "PN_TRANSPORT";
+  case PN_DELIVERY_RANGE:
+    return "PN_DELIVERY_RANGE";
+  }
+
+  return "<unrecognized>";
+}
+
+pn_event_type_t pn_event_type(pn_event_t *event)
+{
+  return event ? event->type : PN_EVENT_NONE;
+}
+
+pn_delivery_t *pn_event_delivery(pn_event_t *event)
+{
+  if (event && event->type == PN_DELIVERY)
+    return (pn_delivery_t *) event->context;
+  return NULL;
+}
+
+pn_link_t *pn_event_link(pn_event_t *event)
+{
+  if (!event) return NULL;
+  switch (event->type) {
+  case PN_LINK_LOCAL_STATE:
+  case PN_LINK_REMOTE_STATE:
+  case PN_LINK_FLOW:
+    return (pn_link_t *) event->context;
+  case PN_DELIVERY:
+    return ((pn_delivery_t *) event->context)->link;
+  default:
+    return NULL;
+  }
+}
+
+pn_session_t *pn_event_session(pn_event_t *event)
+{
+  if (event && (event->type == PN_SESSION_LOCAL_STATE ||
+                event->type == PN_SESSION_REMOTE_STATE ||
+                event->type == PN_DELIVERY_RANGE))
+    return (pn_session_t *) event->context;
+  pn_link_t *link = pn_event_link(event);
+  return link ? link->session : NULL;
+}
+
+pn_connection_t *pn_event_connection(pn_event_t *event)
+{
+  if (event && (event->type == PN_CONNECTION_LOCAL_STATE ||
+                event->type == PN_CONNECTION_REMOTE_STATE ||
+                event->type == PN_TRANSPORT))
+    return (pn_connection_t *) event->context;
+  pn_session_t *session = pn_event_session(event);
+  return session ? session->connection : NULL;
+}
+
+pn_transport_t *pn_event_transport(pn_event_t *event)
+{
+  pn_connection_t *connection = pn_event_connection(event);
+  return connection ? connection->transport : NULL;
+}
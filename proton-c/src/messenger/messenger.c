@@ -32,6 +32,7 @@
 #include "../util.h"
 #include "../platform.h"
 #include "../platform_fmt.h"
+#include "../protocol.h"
 #include "store.h"
 #include "transform.h"
 
@@ -60,6 +61,11 @@ struct pn_messenger_t {
   int credit_batch;
   int credit;
   int distributed;
+  // the rate the application takes messages at, see pn_messenger_flow
+  pn_hash_t *link_rates;
+  int drained;
+  double drain_rate;
+  pn_timestamp_t rate_sampled;
   uint64_t next_tag;
   pni_store_t *outgoing;
   pni_store_t *incoming;
@@ -75,6 +81,8 @@ struct pn_messenger_t {
   pn_tracker_t incoming_tracker;
   pn_string_t *original;
   pn_string_t *rewritten;
+  int txn_batch;
+  pn_data_t *txn_body;
   bool worked;
 };
 
@@ -118,6 +126,14 @@ static void pn_listener_ctx_free(pn_listener_t *lnr)
   pn_listener_set_context(lnr, NULL);
 }
 
+typedef enum {
+  PNI_TXN_NONE,
+  PNI_TXN_DECLARING,
+  PNI_TXN_ACTIVE,
+  PNI_TXN_DISCHARGING,
+  PNI_TXN_UNSUPPORTED
+} pni_txn_state_t;
+
 typedef struct {
   char *address;
   char *scheme;
@@ -125,6 +141,13 @@ typedef struct {
   char *pass;
   char *host;
   char *port;
+  // the transaction sends and acknowledgements on the connection are
+  // part of, see pn_messenger_set_txn_batch
+  pn_link_t *txn_link;
+  pn_delivery_t *txn_control;
+  pn_buffer_t *txn_id;
+  int txn_count;
+  pni_txn_state_t txn_state;
 } pn_connection_ctx_t;
 
 static pn_connection_ctx_t *pn_connection_ctx(pn_connection_t *conn,
@@ -142,6 +165,11 @@ static pn_connection_ctx_t *pn_connection_ctx(pn_connection_t *conn,
   ctx->pass = pn_strdup(pass);
   ctx->host = pn_strdup(host);
   ctx->port = pn_strdup(port);
+  ctx->txn_link = NULL;
+  ctx->txn_control = NULL;
+  ctx->txn_id = NULL;
+  ctx->txn_count = 0;
+  ctx->txn_state = PNI_TXN_NONE;
   pn_connection_set_context(conn, ctx);
   return ctx;
 }
@@ -154,6 +182,7 @@ static void pn_connection_ctx_free(pn_connection_t *conn)
   free(ctx->pass);
   free(ctx->host);
   free(ctx->port);
+  pn_buffer_free(ctx->txn_id);
   free(ctx);
   pn_connection_set_context(conn, NULL);
 }
@@ -165,6 +194,8 @@ static void pn_connection_ctx_free(pn_connection_t *conn)
 #define pn_tracker_direction(tracker) ((tracker) & (0x1000000000000000))
 #define pn_tracker_sequence(tracker) ((pn_sequence_t) ((tracker) & (0x00000000FFFFFFFF)))
 
+static void pni_txn_apply(void *context, pn_delivery_t *delivery, uint64_t outcome);
+
 static char *build_name(const char *name)
 {
   if (name) {
@@ -191,6 +222,10 @@ pn_messenger_t *pn_messenger(const char *name)
     m->credit_batch = 1024;
     m->credit = 0;
     m->distributed = 0;
+    m->link_rates = pn_hash(0, 0.75, 0);
+    m->drained = 0;
+    m->drain_rate = 0;
+    m->rate_sampled = 0;
     m->next_tag = 0;
     m->outgoing = pni_store();
     m->incoming = pni_store();
@@ -206,6 +241,9 @@ pn_messenger_t *pn_messenger(const char *name)
     m->address.text = pn_string(NULL);
     m->original = pn_string(NULL);
     m->rewritten = pn_string(NULL);
+    m->txn_batch = 0;
+    m->txn_body = pn_data(16);
+    pni_store_set_apply(m->incoming, pni_txn_apply, m);
   }
 
   return m;
@@ -300,6 +338,7 @@ static void pni_driver_reclaim(pn_driver_t *driver)
 void pn_messenger_free(pn_messenger_t *messenger)
 {
   if (messenger) {
+    pn_data_free(messenger->txn_body);
     pn_free(messenger->rewritten);
     pn_free(messenger->original);
     pn_free(messenger->address.text);
@@ -319,6 +358,11 @@ void pn_messenger_free(pn_messenger_t *messenger)
     free(messenger->subscriptions);
     pn_free(messenger->rewrites);
     pn_free(messenger->routes);
+    for (pn_handle_t entry = pn_hash_head(messenger->link_rates); entry;
+         entry = pn_hash_next(messenger->link_rates, entry)) {
+      free(pn_hash_value(messenger->link_rates, entry));
+    }
+    pn_free(messenger->link_rates);
     free(messenger);
   }
 }
@@ -338,16 +382,102 @@ pn_error_t *pn_messenger_error(pn_messenger_t *messenger)
   return messenger->error;
 }
 
+// How many messages a receiving link has been bringing in, so that
+// credit goes to the links the messages come from.
+typedef struct {
+  int arrived;      // since the last sample
+  double share;     // smoothed arrivals per sample
+} pni_link_rate_t;
+
+#define PNI_RATE_INTERVAL (100)   // ms between samples of the drain rate
+#define PNI_CREDIT_HORIZON (1000) // ms of draining credit is granted for
+
+static pni_link_rate_t *pni_link_rate(pn_messenger_t *messenger, pn_link_t *link)
+{
+  uintptr_t key = (uintptr_t) link;
+  pni_link_rate_t *rate = (pni_link_rate_t *) pn_hash_get(messenger->link_rates, key);
+  if (!rate) {
+    rate = (pni_link_rate_t *) malloc(sizeof(pni_link_rate_t));
+    if (!rate) return NULL;
+    rate->arrived = 0;
+    rate->share = 0;
+    if (pn_hash_put(messenger->link_rates, key, rate)) {
+      free(rate);
+      return NULL;
+    }
+  }
+  return rate;
+}
+
+static void pni_link_rate_free(pn_messenger_t *messenger, pn_link_t *link)
+{
+  uintptr_t key = (uintptr_t) link;
+  pni_link_rate_t *rate = (pni_link_rate_t *) pn_hash_get(messenger->link_rates, key);
+  if (rate) {
+    pn_hash_del(messenger->link_rates, key);
+    free(rate);
+  }
+}
+
+// Samples how fast the application has been taking messages with
+// pn_messenger_get, and how the messages were spread over the links.
+// Intervals in which nothing arrived or was taken say nothing about
+// the rate and leave the estimate as it was.
+static void pni_rate_sample(pn_messenger_t *messenger)
+{
+  pn_timestamp_t now = pn_i_now();
+  pn_timestamp_t elapsed = now - messenger->rate_sampled;
+  if (messenger->rate_sampled && elapsed < PNI_RATE_INTERVAL) return;
+
+  bool arrived = false;
+  for (pn_handle_t entry = pn_hash_head(messenger->link_rates); entry;
+       entry = pn_hash_next(messenger->link_rates, entry)) {
+    pni_link_rate_t *rate = (pni_link_rate_t *) pn_hash_value(messenger->link_rates, entry);
+    if (rate->arrived) arrived = true;
+    rate->share = (rate->share + rate->arrived) / 2;
+    rate->arrived = 0;
+  }
+
+  if (messenger->rate_sampled && (arrived || messenger->drained)) {
+    double drain_rate = messenger->drained * 1000.0 / elapsed;
+    messenger->drain_rate = messenger->drain_rate ?
+      (messenger->drain_rate + drain_rate) / 2 : drain_rate;
+  }
+  messenger->drained = 0;
+  messenger->rate_sampled = now;
+}
+
+// The credit to keep outstanding when receiving without a limit: as
+// much as the application drains in PNI_CREDIT_HORIZON, which is
+// longer than a round trip on any link worth using, so a consumer that
+// keeps up sees its credit grow to the ceiling of credit_batch per
+// link while a slow one is not sent more than it can take.
+static int pni_credit_target(pn_messenger_t *messenger, int link_ct)
+{
+  int ceiling = link_ct * messenger->credit_batch;
+  if (!messenger->drain_rate) return ceiling;
+  double target = messenger->drain_rate * PNI_CREDIT_HORIZON / 1000;
+  if (target < link_ct) return link_ct;
+  if (target > ceiling) return ceiling;
+  return (int) target;
+}
+
 void pn_messenger_flow(pn_messenger_t *messenger)
 {
   int link_ct = 0;
+  double weights = 0;
+  pni_rate_sample(messenger);
   pn_connector_t *ctor = pn_connector_head(messenger->driver);
   while (ctor) {
     pn_connection_t *conn = pn_connector_connection(ctor);
 
     pn_link_t *link = pn_link_head(conn, PN_LOCAL_ACTIVE);
     while (link) {
-      if (pn_link_is_receiver(link)) link_ct++;
+      if (pn_link_is_receiver(link)) {
+        pni_link_rate_t *rate = pni_link_rate(messenger, link);
+        weights += 1 + (rate ? rate->share : 0);
+        link_ct++;
+      }
       link = pn_link_next(link, PN_LOCAL_ACTIVE);
     }
     ctor = pn_connector_next(ctor);
@@ -356,22 +486,26 @@ void pn_messenger_flow(pn_messenger_t *messenger)
   if (link_ct == 0) return;
 
   if (messenger->receiving == -1) {
-    messenger->credit = link_ct * messenger->credit_batch - pn_messenger_incoming(messenger);
+    messenger->credit = pni_credit_target(messenger, link_ct) - pn_messenger_incoming(messenger);
   } else {
     int total = messenger->credit + messenger->distributed;
     if (messenger->receiving > total)
       messenger->credit += (messenger->receiving - total);
   }
+  if (messenger->credit <= 0) return;
 
-  int batch = (messenger->credit < link_ct) ? 1
-    : (messenger->credit/link_ct);
-
+  // each link's part of the credit follows its share of the arrivals,
+  // and every link keeps at least one so that an idle one can start
+  int credit = messenger->credit;
   ctor = pn_connector_head(messenger->driver);
   while (ctor) {
     pn_connection_t *conn = pn_connector_connection(ctor);
     pn_link_t *link = pn_link_head(conn, PN_LOCAL_ACTIVE);
     while (link) {
       if (pn_link_is_receiver(link)) {
+        pni_link_rate_t *rate = pni_link_rate(messenger, link);
+        int batch = (int) (credit * (1 + (rate ? rate->share : 0)) / weights);
+        if (batch < 1) batch = 1;
 
         int have = pn_link_credit(link);
         if (have < batch) {
@@ -448,7 +582,7 @@ static void pn_condition_report(const char *pfx, pn_condition_t *condition)
 int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *receiver)
 {
   pn_delivery_t *d = pn_link_current(receiver);
-  if (!pn_delivery_readable(d) && !pn_delivery_partial(d)) {
+  if (!pn_delivery_readable(d) || pn_delivery_partial(d)) {
     return 0;
   }
 
@@ -459,6 +593,9 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
   pn_subscription_t *sub = (pn_subscription_t *) pn_link_get_context(receiver);
   pni_entry_set_context(entry, sub);
 
+  pni_link_rate_t *rate = pni_link_rate(messenger, receiver);
+  if (rate) rate->arrived++;
+
   size_t pending = pn_delivery_pending(d);
   int err = pn_buffer_ensure(buf, pending + 1);
   if (err) return pn_error_format(messenger->error, err, "get: error growing buffer");
@@ -480,6 +617,183 @@ int pni_pump_in(pn_messenger_t *messenger, const char *address, pn_link_t *recei
 }
 
 int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *sender);
+pn_link_t *pn_messenger_target(pn_messenger_t *messenger, const char *target);
+
+// the connection context of a link if its work is grouped into
+// transactions
+static pn_connection_ctx_t *pni_txn_ctx(pn_messenger_t *messenger, pn_link_t *link)
+{
+  if (!messenger->txn_batch) return NULL;
+  pn_connection_t *conn = pn_session_connection(pn_link_session(link));
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (!ctx || ctx->txn_state == PNI_TXN_UNSUPPORTED || link == ctx->txn_link) return NULL;
+  return ctx;
+}
+
+// sends a declare, or a discharge of the active transaction, to the
+// coordinator of the connection
+static int pni_txn_control(pn_messenger_t *messenger, pn_connection_t *conn, bool discharge)
+{
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (!ctx->txn_link) {
+    pn_session_t *ssn = pn_session(conn);
+    pn_session_open(ssn);
+    pn_link_t *link = pn_sender(ssn, "txn-ctl");
+    pn_terminus_t *target = pn_link_target(link);
+    pn_terminus_set_type(target, PN_COORDINATOR);
+    pn_data_t *caps = pn_terminus_capabilities(target);
+    pn_data_put_array(caps, false, PN_SYMBOL);
+    pn_data_enter(caps);
+    pn_data_put_symbol(caps, pn_bytes(strlen("amqp:local-transactions"),
+                                      (char *) "amqp:local-transactions"));
+    pn_data_exit(caps);
+    pn_link_set_snd_settle_mode(link, PN_SND_UNSETTLED);
+    pn_link_open(link);
+    ctx->txn_link = link;
+  }
+
+  pn_data_t *body = messenger->txn_body;
+  pn_data_clear(body);
+  pn_bytes_t id = ctx->txn_id ? pn_buffer_bytes(ctx->txn_id) : pn_bytes(0, NULL);
+  int err = discharge ?
+    pn_data_fill(body, "DLDL[zo]", AMQP_VALUE, DISCHARGE, id.size, id.start, false) :
+    pn_data_fill(body, "DLDL[]", AMQP_VALUE, DECLARE);
+  if (err) return pn_error_format(messenger->error, err, "transaction encode error");
+
+  size_t size = 32 + id.size;
+  char *encoded = (char *) malloc(size);
+  if (!encoded) return pn_error_format(messenger->error, PN_ERR, "transaction encode error");
+  ssize_t n = pn_data_encode(body, encoded, size);
+  if (n < 0) {
+    free(encoded);
+    return pn_error_format(messenger->error, n, "transaction encode error");
+  }
+
+  char tag[8];
+  void *ptr = &tag;
+  *((uint64_t *) ptr) = messenger->next_tag++;
+  ctx->txn_control = pn_delivery(ctx->txn_link, pn_dtag(tag, 8));
+  n = pn_link_send(ctx->txn_link, encoded, n);
+  free(encoded);
+  if (n < 0) {
+    return pn_error_format(messenger->error, n, "send error: %s",
+                           pn_error_text(pn_link_error(ctx->txn_link)));
+  }
+  pn_link_advance(ctx->txn_link);
+  ctx->txn_state = discharge ? PNI_TXN_DISCHARGING : PNI_TXN_DECLARING;
+  return 0;
+}
+
+// true if the sender can send in a transaction now, otherwise starts
+// on getting one ready
+static bool pni_txn_ready(pn_messenger_t *messenger, pn_connection_ctx_t *ctx,
+                          pn_link_t *sender)
+{
+  pn_connection_t *conn = pn_session_connection(pn_link_session(sender));
+  switch (ctx->txn_state) {
+  case PNI_TXN_NONE:
+    pni_txn_control(messenger, conn, false);
+    return false;
+  case PNI_TXN_ACTIVE:
+    if (ctx->txn_count < messenger->txn_batch) return true;
+    pni_txn_control(messenger, conn, true);
+    return false;
+  default:
+    return false;
+  }
+}
+
+// acknowledges a delivery in the active transaction of its connection,
+// or outside any transaction if there is none yet
+static void pni_txn_apply(void *context, pn_delivery_t *delivery, uint64_t outcome)
+{
+  pn_messenger_t *messenger = (pn_messenger_t *) context;
+  pn_connection_ctx_t *ctx = pni_txn_ctx(messenger, pn_delivery_link(delivery));
+  if (ctx && ctx->txn_state == PNI_TXN_ACTIVE) {
+    pn_disposition_set_txn(pn_delivery_local(delivery), pn_buffer_bytes(ctx->txn_id),
+                           outcome);
+    pn_delivery_update(delivery, PN_TRANSACTIONAL_STATE);
+    ctx->txn_count++;
+    return;
+  }
+
+  if (ctx && ctx->txn_state == PNI_TXN_NONE) {
+    pn_link_t *link = pn_delivery_link(delivery);
+    pni_txn_control(messenger, pn_session_connection(pn_link_session(link)), false);
+  }
+  pn_delivery_update(delivery, outcome);
+}
+
+// sends what was held back while no transaction was active
+static void pni_txn_flush(pn_messenger_t *messenger, pn_connection_t *conn)
+{
+  // entries are held under the address they were put to, which may be
+  // longer than the target of the link they go out on
+  pni_stream_t *stream = pni_stream_head(messenger->outgoing);
+  while (stream) {
+    const char *address = pni_stream_address(stream);
+    if (pni_store_get(messenger->outgoing, address)) {
+      pn_link_t *link = pn_messenger_target(messenger, address);
+      if (link && pn_session_connection(pn_link_session(link)) == conn) {
+        size_t size;
+        do {
+          size = pni_store_size(messenger->outgoing);
+          pni_pump_out(messenger, address, link);
+        } while (pni_store_size(messenger->outgoing) < size);
+      }
+    }
+    stream = pni_stream_next(stream);
+  }
+}
+
+// the coordinator has replied to a declare or a discharge
+static void pni_txn_updated(pn_messenger_t *messenger, pn_connection_t *conn,
+                            pn_delivery_t *d)
+{
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  uint64_t state = pn_delivery_remote_state(d);
+  if (d != ctx->txn_control || !state) return;
+
+  if (ctx->txn_state == PNI_TXN_DECLARING) {
+    if (state == PN_DECLARED) {
+      pn_bytes_t id = pn_disposition_get_txn(pn_delivery_remote(d));
+      if (!ctx->txn_id) ctx->txn_id = pn_buffer(id.size);
+      pn_buffer_clear(ctx->txn_id);
+      pn_buffer_append(ctx->txn_id, id.start, id.size);
+      ctx->txn_count = 0;
+      ctx->txn_state = PNI_TXN_ACTIVE;
+    } else {
+      pn_condition_report("TRANSACTION", pn_disposition_condition(pn_delivery_remote(d)));
+      ctx->txn_state = PNI_TXN_UNSUPPORTED;
+    }
+  } else if (ctx->txn_state == PNI_TXN_DISCHARGING) {
+    if (state != PN_ACCEPTED) {
+      pn_condition_report("TRANSACTION", pn_disposition_condition(pn_delivery_remote(d)));
+    }
+    // the next one is declared once there is work for it
+    ctx->txn_state = PNI_TXN_NONE;
+  }
+  pn_delivery_settle(d);
+  ctx->txn_control = NULL;
+  pni_txn_flush(messenger, conn);
+}
+
+// discharges the transaction of the connection once it is full
+static void pni_txn_process(pn_messenger_t *messenger, pn_connection_t *conn)
+{
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
+  if (!messenger->txn_batch || !ctx) return;
+  if (ctx->txn_state != PNI_TXN_UNSUPPORTED && ctx->txn_link &&
+      (pn_link_state(ctx->txn_link) & PN_REMOTE_CLOSED)) {
+    // the peer has no coordinator
+    if (ctx->txn_control) pn_delivery_settle(ctx->txn_control);
+    ctx->txn_control = NULL;
+    ctx->txn_state = PNI_TXN_UNSUPPORTED;
+    pni_txn_flush(messenger, conn);
+  } else if (ctx->txn_state == PNI_TXN_ACTIVE && ctx->txn_count >= messenger->txn_batch) {
+    pni_txn_control(messenger, conn, true);
+  }
+}
 
 void pn_messenger_endpoints(pn_messenger_t *messenger, pn_connection_t *conn, pn_connector_t *ctor)
 {
@@ -487,12 +801,26 @@ void pn_messenger_endpoints(pn_messenger_t *messenger, pn_connection_t *conn, pn
     pn_connection_open(conn);
   }
 
+  pn_connection_ctx_t *ctx = (pn_connection_ctx_t *) pn_connection_get_context(conn);
   pn_delivery_t *d = pn_work_head(conn);
   while (d) {
     pn_link_t *link = pn_delivery_link(d);
+    if (ctx && link == ctx->txn_link) {
+      pn_delivery_t *next = pn_work_next(d);
+      if (pn_delivery_updated(d)) {
+        pn_delivery_clear(d);
+        pni_txn_updated(messenger, conn, d);
+      }
+      d = next;
+      continue;
+    }
     if (pn_delivery_updated(d)) {
-      if (pn_link_is_sender(link)) {
-        pn_delivery_update(d, pn_delivery_remote_state(d));
+      // the peer's outcome is echoed back, but a transactional state
+      // or a declaration only ever comes from the peer
+      uint64_t state = pn_delivery_remote_state(d);
+      if (pn_link_is_sender(link) && state != PN_TRANSACTIONAL_STATE &&
+          state != PN_DECLARED) {
+        pn_delivery_update(d, state);
       }
       pni_entry_t *e = (pni_entry_t *) pn_delivery_get_context(d);
       if (e) pni_entry_updated(e);
@@ -522,6 +850,11 @@ void pn_messenger_endpoints(pn_messenger_t *messenger, pn_connection_t *conn, pn
     pn_terminus_copy(pn_link_source(link), pn_link_remote_source(link));
     pn_terminus_copy(pn_link_target(link), pn_link_remote_target(link));
     pn_link_open(link);
+    if (pn_terminus_get_type(pn_link_remote_target(link)) == PN_COORDINATOR) {
+      // transactions can only be declared with a broker
+      pn_condition_set_name(pn_link_condition(link), "amqp:not-implemented");
+      pn_link_close(link);
+    }
     if (pn_link_is_receiver(link)) {
       pn_listener_t *listener = pn_connector_listener(ctor);
       pn_listener_ctx_t *ctx = (pn_listener_ctx_t *) pn_listener_context(listener);
@@ -532,12 +865,13 @@ void pn_messenger_endpoints(pn_messenger_t *messenger, pn_connection_t *conn, pn
 
   link = pn_link_head(conn, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
   while (link) {
-    if (pn_link_is_sender(link)) {
+    if (pn_link_is_sender(link) && !(ctx && link == ctx->txn_link)) {
       pni_pump_out(messenger, pn_terminus_get_address(pn_link_target(link)), link);
     }
     link = pn_link_next(link, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
   }
 
+  pni_txn_process(messenger, conn);
   pn_messenger_flow(messenger);
 
   ssn = pn_session_head(conn, PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED);
@@ -587,6 +921,7 @@ void pn_messenger_reclaim(pn_messenger_t *messenger, pn_connection_t *conn)
       messenger->credit += credit;
       messenger->distributed -= credit;
     }
+    pni_link_rate_free(messenger, link);
 
     pn_delivery_t *d = pn_unsettled_head(link);
     while (d) {
@@ -995,6 +1330,18 @@ int pn_messenger_set_outgoing_window(pn_messenger_t *messenger, int window)
   return 0;
 }
 
+int pn_messenger_get_txn_batch(pn_messenger_t *messenger)
+{
+  return messenger->txn_batch;
+}
+
+int pn_messenger_set_txn_batch(pn_messenger_t *messenger, int batch)
+{
+  if (batch < 0) return pn_error_format(messenger->error, PN_ARG_ERR, "invalid batch: %i", batch);
+  messenger->txn_batch = batch;
+  return 0;
+}
+
 int pn_messenger_get_incoming_window(pn_messenger_t *messenger)
 {
   return pni_store_get_window(messenger->incoming);
@@ -1035,21 +1382,46 @@ static void outward_munge(pn_messenger_t *mng, pn_message_t *msg)
 
 int pni_pump_out(pn_messenger_t *messenger, const char *address, pn_link_t *sender)
 {
+  // nothing goes out while a transaction is declared or discharged
+  pn_connection_ctx_t *txn = pni_txn_ctx(messenger, sender);
+  if (txn && !pni_txn_ready(messenger, txn, sender)) return 0;
+
   pni_entry_t *entry = pni_store_get(messenger->outgoing, address);
   if (!entry) return 0;
   pn_buffer_t *buf = pni_entry_bytes(entry);
-  pn_bytes_t bytes = pn_buffer_bytes(buf);
-  char *encoded = bytes.start;
-  size_t size = bytes.size;
+  pn_bytes_t head, tail;
+  pn_buffer_segments(buf, &head, &tail);
 
   // XXX: proper tag
   char tag[8];
   void *ptr = &tag;
   uint64_t next = messenger->next_tag++;
   *((uint64_t *) ptr) = next;
+
+  // without an outgoing window nothing is tracked, so the message can
+  // go out pre-settled without a delivery
+  if (!txn && !pni_store_get_window(messenger->outgoing) &&
+      pn_link_snd_settle_mode(sender) != PN_SND_UNSETTLED) {
+    // this one needs the message in one piece
+    pn_bytes_t bytes = tail.size ? pn_buffer_bytes(buf) : head;
+    ssize_t n = pn_link_send_settled(sender, pn_dtag(tag, 8), bytes.start, bytes.size);
+    pni_entry_free(entry);
+    if (n < 0) {
+      return pn_error_format(messenger->error, n, "send error: %s",
+                             pn_error_text(pn_link_error(sender)));
+    }
+    return 0;
+  }
+
   pn_delivery_t *d = pn_delivery(sender, pn_dtag(tag, 8));
   pni_entry_set_delivery(entry, d);
-  ssize_t n = pn_link_send(sender, encoded, size);
+  if (txn) {
+    pn_disposition_set_txn(pn_delivery_local(d), pn_buffer_bytes(txn->txn_id), 0);
+    pn_delivery_update(d, PN_TRANSACTIONAL_STATE);
+    txn->txn_count++;
+  }
+  ssize_t n = pn_link_send(sender, head.start, head.size);
+  if (n >= 0 && tail.size) n = pn_link_send(sender, tail.start, tail.size);
   if (n < 0) {
     pni_entry_free(entry);
     return pn_error_format(messenger->error, n, "send error: %s",
@@ -1274,6 +1646,35 @@ int pn_messenger_send(pn_messenger_t *messenger, int n)
   return pn_messenger_sync(messenger, pn_messenger_sent);
 }
 
+// true once no transaction is being discharged
+static bool pni_txn_discharged(pn_messenger_t *messenger)
+{
+  pn_connector_t *ctor = pn_connector_head(messenger->driver);
+  while (ctor) {
+    pn_connection_t *conn = pn_connector_connection(ctor);
+    pn_connection_ctx_t *ctx = conn ? (pn_connection_ctx_t *) pn_connection_get_context(conn) : NULL;
+    if (ctx && ctx->txn_state == PNI_TXN_DISCHARGING) return false;
+    ctor = pn_connector_next(ctor);
+  }
+  return true;
+}
+
+int pn_messenger_commit(pn_messenger_t *messenger)
+{
+  if (!messenger) return PN_ARG_ERR;
+  pn_connector_t *ctor = pn_connector_head(messenger->driver);
+  while (ctor) {
+    pn_connection_t *conn = pn_connector_connection(ctor);
+    pn_connection_ctx_t *ctx = conn ? (pn_connection_ctx_t *) pn_connection_get_context(conn) : NULL;
+    if (ctx && ctx->txn_state == PNI_TXN_ACTIVE && ctx->txn_count) {
+      int err = pni_txn_control(messenger, conn, true);
+      if (err) return err;
+    }
+    ctor = pn_connector_next(ctor);
+  }
+  return pn_messenger_sync(messenger, pni_txn_discharged);
+}
+
 int pn_messenger_recv(pn_messenger_t *messenger, int n)
 {
   if (!messenger) return PN_ARG_ERR;
@@ -1315,6 +1716,7 @@ int pn_messenger_get(pn_messenger_t *messenger, pn_message_t *msg)
   size_t size = bytes.size;
 
   messenger->distributed--;
+  messenger->drained++;
   messenger->incoming_subscription = (pn_subscription_t *) pni_entry_get_context(entry);
 
   if (msg) {
@@ -31,8 +31,6 @@
 #include "../util.h"
 #include "store.h"
 
-typedef struct pni_stream_t pni_stream_t;
-
 struct pni_store_t {
   size_t size;
   pni_stream_t *streams;
@@ -42,6 +40,9 @@ struct pni_store_t {
   pn_sequence_t lwm;
   pn_sequence_t hwm;
   pn_hash_t *tracked;
+  // gives a delivery the outcome it is updated with, see pni_store_update
+  pni_store_apply_t apply;
+  void *apply_context;
 };
 
 struct pni_stream_t {
@@ -90,6 +91,8 @@ pni_store_t *pni_store()
   store->lwm = 0;
   store->hwm = 0;
   store->tracked = pn_hash(0, 0.75, PN_REFCOUNT);
+  store->apply = NULL;
+  store->apply_context = NULL;
 
   return store;
 }
@@ -147,6 +150,12 @@ pni_stream_t *pni_stream_next(pni_stream_t *stream)
   return stream->next;
 }
 
+const char *pni_stream_address(pni_stream_t *stream)
+{
+  assert(stream);
+  return stream->address;
+}
+
 void pni_entry_free(pni_entry_t *entry)
 {
   if (!entry) return;
@@ -205,7 +214,7 @@ pni_entry_t *pni_store_put(pni_store_t *store, const char *address)
   if (!address) address = "";
   pni_stream_t *stream = pni_stream_put(store, address);
   if (!stream) return NULL;
-  pni_entry_t *entry = (pni_entry_t *) pn_new(sizeof(pni_entry_t), &clazz);
+  pni_entry_t *entry = (pni_entry_t *) pni_new(sizeof(pni_entry_t), &clazz, 256);
   if (!entry) return NULL;
   entry->stream = stream;
   entry->free = false;
@@ -305,15 +314,24 @@ static pn_status_t disp2status(uint64_t disp)
 }
 
 
+// the outcome of a disposition, that of the transaction it is part of
+// for a transactional state
+static uint64_t disp2outcome(pn_disposition_t *disp)
+{
+  uint64_t type = pn_disposition_type(disp);
+  if (type == PN_TRANSACTIONAL_STATE) return pn_disposition_get_txn_outcome(disp);
+  return type;
+}
+
 void pni_entry_updated(pni_entry_t *entry)
 {
   assert(entry);
   pn_delivery_t *d = entry->delivery;
   if (d) {
     if (pn_delivery_remote_state(d)) {
-      entry->status = disp2status(pn_delivery_remote_state(d));
+      entry->status = disp2status(disp2outcome(pn_delivery_remote(d)));
     } else if (pn_delivery_settled(d)) {
-      entry->status = disp2status(pn_delivery_local_state(d));
+      entry->status = disp2status(disp2outcome(pn_delivery_local(d)));
     } else {
       entry->status = PN_STATUS_PENDING;
     }
@@ -358,6 +376,24 @@ pn_sequence_t pni_entry_track(pni_entry_t *entry)
   return entry->id;
 }
 
+static void pni_store_apply(pni_store_t *store, pn_delivery_t *delivery, uint64_t outcome)
+{
+  if (store->apply) {
+    store->apply(store->apply_context, delivery, outcome);
+  } else {
+    pn_delivery_update(delivery, outcome);
+  }
+}
+
+// settles the deliveries of a link up to one that is still unsettled,
+// so at least that one is settled
+static void pni_store_settle_upto(pn_delivery_t *upto)
+{
+  int count = pn_link_settle_upto(pn_delivery_link(upto), upto, 0);
+  assert(count > 0);
+  (void) count;
+}
+
 int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
                      int flags, bool settle, bool match)
 {
@@ -374,6 +410,10 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
     start = id;
   }
 
+  // cumulative settlement is done a link at a time, up to the newest
+  // delivery of each run of entries on the same link
+  pn_delivery_t *upto = NULL;
+
   for (pn_sequence_t i = start; i <= id; i++) {
     pni_entry_t *e = pni_store_entry(store, i);
     if (e) {
@@ -385,10 +425,10 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
           } else {
             switch (status) {
             case PN_STATUS_ACCEPTED:
-              pn_delivery_update(d, PN_ACCEPTED);
+              pni_store_apply(store, d, PN_ACCEPTED);
               break;
             case PN_STATUS_REJECTED:
-              pn_delivery_update(d, PN_REJECTED);
+              pni_store_apply(store, d, PN_REJECTED);
               break;
             default:
               break;
@@ -398,7 +438,15 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
           pni_entry_updated(e);
         }
       }
-      if (settle) {
+      if (settle && (PN_CUMULATIVE & flags)) {
+        // a run can only end on a delivery that is still unsettled
+        if (d && !pn_disposition_is_settled(pn_delivery_local(d))) {
+          if (upto && pn_delivery_link(upto) != pn_delivery_link(d)) {
+            pni_store_settle_upto(upto);
+          }
+          upto = d;
+        }
+      } else if (settle) {
         if (d) {
           pn_delivery_settle(d);
         }
@@ -407,6 +455,15 @@ int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
     }
   }
 
+  if (upto) {
+    pni_store_settle_upto(upto);
+  }
+  if (settle && (PN_CUMULATIVE & flags)) {
+    for (pn_sequence_t i = start; i <= id; i++) {
+      pn_hash_del(store->tracked, i);
+    }
+  }
+
   while (store->hwm - store->lwm > 0 &&
          !pn_hash_get(store->tracked, store->lwm)) {
     store->lwm++;
@@ -421,6 +478,13 @@ int pni_store_get_window(pni_store_t *store)
   return store->window;
 }
 
+void pni_store_set_apply(pni_store_t *store, pni_store_apply_t apply, void *context)
+{
+  assert(store);
+  store->apply = apply;
+  store->apply_context = context;
+}
+
 void pni_store_set_window(pni_store_t *store, int window)
 {
   assert(store);
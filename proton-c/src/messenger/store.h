@@ -25,6 +25,7 @@
 #include <proton/buffer.h>
 
 typedef struct pni_store_t pni_store_t;
+typedef struct pni_stream_t pni_stream_t;
 typedef struct pni_entry_t pni_entry_t;
 
 pni_store_t *pni_store();
@@ -33,6 +34,10 @@ size_t pni_store_size(pni_store_t *store);
 pni_entry_t *pni_store_put(pni_store_t *store, const char *address);
 pni_entry_t *pni_store_get(pni_store_t *store, const char *address);
 
+pni_stream_t *pni_stream_head(pni_store_t *store);
+pni_stream_t *pni_stream_next(pni_stream_t *stream);
+const char *pni_stream_address(pni_stream_t *stream);
+
 pn_buffer_t *pni_entry_bytes(pni_entry_t *entry);
 pn_status_t pni_entry_get_status(pni_entry_t *entry);
 void pni_entry_set_status(pni_entry_t *entry, pn_status_t status);
@@ -47,6 +52,8 @@ pn_sequence_t pni_entry_track(pni_entry_t *entry);
 pni_entry_t *pni_store_entry(pni_store_t *store, pn_sequence_t id);
 int pni_store_update(pni_store_t *store, pn_sequence_t id, pn_status_t status,
                      int flags, bool settle, bool match);
+typedef void (*pni_store_apply_t)(void *context, pn_delivery_t *delivery, uint64_t outcome);
+void pni_store_set_apply(pni_store_t *store, pni_store_apply_t apply, void *context);
 int pni_store_get_window(pni_store_t *store);
 void pni_store_set_window(pni_store_t *store, int window);
 
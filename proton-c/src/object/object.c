@@ -20,6 +20,7 @@
  */
 
 #include "../platform.h"
+#include "../util.h"
 #include <proton/error.h>
 #include <proton/object.h>
 #include <stdio.h>
@@ -36,17 +37,177 @@ typedef struct {
 #define pni_head(PTR) \
   (((pni_head_t *) (PTR)) - 1)
 
-void *pn_new(size_t size, pn_class_t *clazz)
+// An object made with a pool is marked in the low bit of its class
+// pointer, so that freeing any other object needs no lookup.
+#define PNI_POOLED ((uintptr_t) 0x1)
+#define pni_head_class(HEAD) \
+  ((pn_class_t *) ((uintptr_t) (HEAD)->clazz & ~PNI_POOLED))
+#define pni_head_pooled(HEAD) \
+  (((uintptr_t) (HEAD)->clazz & PNI_POOLED) != 0)
+
+// Each thread keeps the objects of a class made with a pool for reuse,
+// and counts the objects of those classes it makes and frees, or of
+// every class once counting is turned on. Classes are found by their
+// address in a small table, a full table leaves further classes
+// uncounted and unpooled.
+#define PNI_CLASS_SLOTS (64)
+
+typedef struct {
+  pn_class_t *clazz;
+  size_t pool;       // objects kept, learned from the first one made
+  size_t size;       // of the objects pooled, 0 until one is made
+  pni_head_t *free;  // linked through the first word of each head
+  pn_class_stats_t stats;
+} pni_slot_t;
+
+#ifdef PN_THREAD_LOCAL
+static PN_THREAD_LOCAL pni_slot_t pni_slots[PNI_CLASS_SLOTS];
+static PN_THREAD_LOCAL bool pni_counting;
+// 0 until something is kept, then 1, or -1 if it cannot be released
+// when the thread exits and nothing may be kept
+static PN_THREAD_LOCAL int pni_keeping;
+
+static pni_slot_t *pni_slot(pn_class_t *clazz)
+{
+  if (!clazz) return NULL;
+  size_t start = ((uintptr_t) clazz >> 3) % PNI_CLASS_SLOTS;
+  for (size_t i = 0; i < PNI_CLASS_SLOTS; i++) {
+    pni_slot_t *slot = &pni_slots[(start + i) % PNI_CLASS_SLOTS];
+    if (slot->clazz == clazz) return slot;
+    if (!slot->clazz) {
+      slot->clazz = clazz;
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+static void pni_slot_release(pni_slot_t *slot)
+{
+  while (slot->free) {
+    pni_head_t *head = slot->free;
+    slot->free = *(pni_head_t **) head;
+    free(head);
+  }
+  slot->stats.pooled = 0;
+}
+
+static void pni_slots_exit(void)
+{
+  for (int i = 0; i < PNI_CLASS_SLOTS; i++) pni_slot_release(&pni_slots[i]);
+}
+
+static bool pni_slot_keeps(pni_slot_t *slot)
+{
+  if (!slot->size || slot->stats.pooled >= slot->pool) return false;
+  if (!pni_keeping) pni_keeping = pn_i_thread_exit(pni_slots_exit) ? -1 : 1;
+  return pni_keeping > 0;
+}
+#else
+static bool pni_counting;
+
+static pni_slot_t *pni_slot(pn_class_t *clazz)
 {
-  pni_head_t *obj = (pni_head_t *) malloc(sizeof(pni_head_t) + size);
-  obj->clazz = clazz;
+  return NULL;
+}
+
+static bool pni_slot_keeps(pni_slot_t *slot)
+{
+  return false;
+}
+#endif
+
+void *pni_new(size_t size, pn_class_t *clazz, size_t pool)
+{
+  pni_head_t *obj = NULL;
+  pni_slot_t *slot = pool || pni_counting ? pni_slot(clazz) : NULL;
+  if (slot) {
+    if (pool) {
+      assert(!slot->size || slot->size == size);
+      slot->size = size;
+      slot->pool = pool;
+      if (slot->free) {
+        obj = slot->free;
+        slot->free = *(pni_head_t **) obj;
+        slot->stats.pooled--;
+        slot->stats.reused++;
+      }
+    }
+    slot->stats.created++;
+    if (++slot->stats.live > slot->stats.peak) slot->stats.peak = slot->stats.live;
+  }
+  if (!obj) obj = (pni_head_t *) malloc(sizeof(pni_head_t) + size);
+  obj->clazz = slot && pool ? (pn_class_t *) ((uintptr_t) clazz | PNI_POOLED) : clazz;
   obj->refcount = 1;
   return obj + 1;
 }
 
+void *pn_new(size_t size, pn_class_t *clazz)
+{
+  return pni_new(size, clazz, 0);
+}
+
+static void pni_release(pni_head_t *head)
+{
+  bool pooled = pni_head_pooled(head);
+  pni_slot_t *slot = pooled || pni_counting ? pni_slot(pni_head_class(head)) : NULL;
+  if (slot) {
+    slot->stats.live--;
+    // an object made by another thread is only kept once this one
+    // knows the size of the class
+    if (pooled && pni_slot_keeps(slot)) {
+      *(pni_head_t **) head = slot->free;
+      slot->free = head;
+      slot->stats.pooled++;
+      return;
+    }
+  }
+  free(head);
+}
+
+void pn_class_stats(pn_class_t *clazz, pn_class_stats_t *stats)
+{
+  assert(stats);
+  pni_slot_t *slot = pni_slot(clazz);
+  if (slot) {
+    *stats = slot->stats;
+  } else {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+void pn_class_set_counting(bool counting)
+{
+  pni_counting = counting;
+}
+
+bool pn_class_get_counting(void)
+{
+  return pni_counting;
+}
+
+void pn_class_release(pn_class_t *clazz)
+{
+#ifdef PN_THREAD_LOCAL
+  if (clazz) {
+    pni_slot_t *slot = pni_slot(clazz);
+    if (slot) pni_slot_release(slot);
+  } else {
+    pni_slots_exit();
+  }
+#endif
+}
+
+size_t pni_object_footprint(size_t size)
+{
+  return sizeof(pni_head_t) + size;
+}
+
 void pn_convert(void *object, pn_class_t *clazz)
 {
   pni_head_t *head = pni_head(object);
+  // the size of a converted object need not suit the pool of its new
+  // class, so it is no longer kept for reuse
   head->clazz = clazz;
 }
 
@@ -64,10 +225,11 @@ void pn_decref(void *object)
     pni_head_t *head = pni_head(object);
     head->refcount--;
     if (!head->refcount) {
-      if (head->clazz && head->clazz->finalize) {
-        head->clazz->finalize(object);
+      pn_class_t *clazz = pni_head_class(head);
+      if (clazz && clazz->finalize) {
+        clazz->finalize(object);
       }
-      free(head);
+      pni_release(head);
     }
   }
 }
@@ -89,7 +251,7 @@ void pn_free(void *object)
 pn_class_t *pn_class(void *object)
 {
   assert(object);
-  return pni_head(object)->clazz;
+  return pni_head_class(pni_head(object));
 }
 
 uintptr_t pn_hashcode(void *object)
@@ -97,8 +259,9 @@ uintptr_t pn_hashcode(void *object)
   if (!object) return 0;
 
   pni_head_t *head = pni_head(object);
-  if (head->clazz && head->clazz->hashcode) {
-    return head->clazz->hashcode(object);
+  pn_class_t *clazz = pni_head_class(head);
+  if (clazz && clazz->hashcode) {
+    return clazz->hashcode(object);
   } else {
     return (uintptr_t) head;
   }
@@ -111,8 +274,8 @@ intptr_t pn_compare(void *a, void *b)
     pni_head_t *ha = pni_head(a);
     pni_head_t *hb = pni_head(b);
 
-    if (ha->clazz && hb->clazz && ha->clazz == hb->clazz) {
-      pn_class_t *clazz = ha->clazz;
+    pn_class_t *clazz = pni_head_class(ha);
+    if (clazz && clazz == pni_head_class(hb)) {
       if (clazz->compare) {
         return clazz->compare(a, b);
       }
@@ -135,8 +298,8 @@ int pn_inspect(void *object, pn_string_t *dst)
 
   if (object) {
     pni_head_t *head = pni_head(object);
-    if (head->clazz) {
-      pn_class_t *clazz = head->clazz;
+    pn_class_t *clazz = pni_head_class(head);
+    if (clazz) {
       if (clazz->inspect) {
         return clazz->inspect(object, dst);
       }
@@ -154,6 +317,12 @@ struct pn_list_t {
   int options;
 };
 
+size_t pni_list_footprint(pn_list_t *list)
+{
+  if (!list) return 0;
+  return pni_object_footprint(sizeof(pn_list_t)) + list->capacity * sizeof(void *);
+}
+
 size_t pn_list_size(pn_list_t *list)
 {
   assert(list);
@@ -311,7 +480,7 @@ pn_list_t *pn_list(size_t capacity, int options)
 {
   static pn_class_t clazz = PN_CLASS(pn_list);
 
-  pn_list_t *list = (pn_list_t *) pn_new(sizeof(pn_list_t), &clazz);
+  pn_list_t *list = (pn_list_t *) pni_new(sizeof(pn_list_t), &clazz, 64);
   list->capacity = capacity ? capacity : 16;
   list->elements = (void **) malloc(list->capacity * sizeof(void *));
   list->size = 0;
@@ -419,7 +588,7 @@ pn_map_t *pn_map(size_t capacity, float load_factor, int options)
 {
   static pn_class_t clazz = PN_CLASS(pn_map);
 
-  pn_map_t *map = (pn_map_t *) pn_new(sizeof(pn_map_t), &clazz);
+  pn_map_t *map = (pn_map_t *) pni_new(sizeof(pn_map_t), &clazz, 64);
   map->capacity = capacity ? capacity : 16;
   map->addressable = (size_t) (map->capacity * 0.86);
   if (!map->addressable) map->addressable = map->capacity;
@@ -440,7 +609,7 @@ size_t pn_map_size(pn_map_t *map)
 
 static bool pni_map_ensure(pn_map_t *map, size_t capacity)
 {
-  float load = map->size / map->addressable;
+  float load = (float) map->size / map->addressable;
   if (capacity <= map->capacity && load < map->load_factor) {
     return false;
   }
@@ -448,7 +617,7 @@ static bool pni_map_ensure(pn_map_t *map, size_t capacity)
   size_t oldcap = map->capacity;
 
   while (map->capacity < capacity ||
-         (map->size / map->addressable) > map->load_factor) {
+         ((float) map->size / map->addressable) >= map->load_factor) {
     map->capacity *= 2;
     map->addressable = (size_t) (0.86 * map->capacity);
   }
@@ -605,83 +774,274 @@ void *pn_map_value(pn_map_t *map, pn_handle_t entry)
   return map->entries[entry - 1].value;
 }
 
+// pn_hash_t is an open addressed table using robin hood hashing. An
+// entry is never further from its home bucket than one that follows
+// it, which keeps probes short and lets a lookup stop at the first
+// entry closer to home than the key would be. Deletion shifts the run
+// after an entry back by one rather than leaving a tombstone.
+
+typedef struct {
+  uintptr_t key;
+  void *value;
+  size_t dist;  // 1 + distance from the home bucket, 0 if empty
+} pni_bucket_t;
+
 struct pn_hash_t {
-  pn_map_t map;
+  pni_bucket_t *buckets;  // allocated by the first put
+  size_t capacity;        // a power of two, or 0 before the first put
+  size_t size;
+  float load_factor;
+  bool count_values;
 };
 
-static uintptr_t pni_identity_hashcode(void *obj)
+static inline size_t pni_hash_home(pn_hash_t *hash, uintptr_t key)
 {
-  return (uintptr_t ) obj;
+  // keys are often small consecutive integers, multiplying spreads
+  // strided ones as well
+  uint64_t h = (uint64_t) key * 0x9E3779B97F4A7C15ULL;
+  return (size_t) (h >> 32) & (hash->capacity - 1);
 }
 
-static bool pni_identity_equals(void *a, void *b)
+static inline pni_bucket_t *pni_hash_find(pn_hash_t *hash, uintptr_t key)
 {
-  return a == b;
+  if (!hash->size) return NULL;
+  size_t mask = hash->capacity - 1;
+  size_t i = pni_hash_home(hash, key);
+  for (size_t dist = 1; ; dist++) {
+    pni_bucket_t *bucket = &hash->buckets[i];
+    if (bucket->dist < dist) return NULL;
+    if (bucket->key == key) return bucket;
+    i = (i + 1) & mask;
+  }
+}
+
+static void pni_hash_insert(pn_hash_t *hash, uintptr_t key, void *value)
+{
+  size_t mask = hash->capacity - 1;
+  size_t i = pni_hash_home(hash, key);
+  size_t dist = 1;
+  while (true) {
+    pni_bucket_t *bucket = &hash->buckets[i];
+    if (!bucket->dist) {
+      bucket->key = key;
+      bucket->value = value;
+      bucket->dist = dist;
+      hash->size++;
+      return;
+    }
+    if (bucket->dist < dist) {
+      // the entry here is closer to home, it moves on instead
+      pni_bucket_t displaced = *bucket;
+      bucket->key = key;
+      bucket->value = value;
+      bucket->dist = dist;
+      key = displaced.key;
+      value = displaced.value;
+      dist = displaced.dist;
+    }
+    i = (i + 1) & mask;
+    dist++;
+  }
+}
+
+static void pni_hash_ensure(pn_hash_t *hash, size_t size)
+{
+  if (hash->capacity && size <= hash->capacity * hash->load_factor) return;
+
+  size_t oldcap = hash->capacity;
+  pni_bucket_t *old = hash->buckets;
+  size_t capacity = oldcap ? oldcap : 16;
+  while (size > capacity * hash->load_factor) capacity *= 2;
+
+  hash->buckets = (pni_bucket_t *) calloc(capacity, sizeof(pni_bucket_t));
+  hash->capacity = capacity;
+  hash->size = 0;
+  for (size_t i = 0; i < oldcap; i++) {
+    if (old[i].dist) pni_hash_insert(hash, old[i].key, old[i].value);
+  }
+  free(old);
+}
+
+static void pn_hash_finalize(void *object)
+{
+  pn_hash_t *hash = (pn_hash_t *) object;
+  if (hash->count_values) {
+    for (size_t i = 0; i < hash->capacity; i++) {
+      if (hash->buckets[i].dist) pn_decref(hash->buckets[i].value);
+    }
+  }
+  free(hash->buckets);
+}
+
+static uintptr_t pn_hash_hashcode(void *object)
+{
+  pn_hash_t *hash = (pn_hash_t *) object;
+  uintptr_t hashcode = 0;
+  for (size_t i = 0; i < hash->capacity; i++) {
+    if (hash->buckets[i].dist) {
+      hashcode += hash->buckets[i].key ^ pn_hashcode(hash->buckets[i].value);
+    }
+  }
+  return hashcode;
+}
+
+static int pn_hash_inspect(void *obj, pn_string_t *dst)
+{
+  assert(obj);
+  pn_hash_t *hash = (pn_hash_t *) obj;
+  int err = pn_string_addf(dst, "{");
+  if (err) return err;
+  pn_handle_t entry = pn_hash_head(hash);
+  bool first = true;
+  while (entry) {
+    if (first) {
+      first = false;
+    } else {
+      err = pn_string_addf(dst, ", ");
+      if (err) return err;
+    }
+    err = pn_string_addf(dst, "%lu: ", (unsigned long) pn_hash_key(hash, entry));
+    if (err) return err;
+    err = pn_inspect(pn_hash_value(hash, entry), dst);
+    if (err) return err;
+    entry = pn_hash_next(hash, entry);
+  }
+  return pn_string_addf(dst, "}");
+}
+
+#define pn_hash_compare NULL
+
+size_t pni_hash_footprint(pn_hash_t *hash)
+{
+  if (!hash) return 0;
+  return pni_object_footprint(sizeof(pn_hash_t)) +
+    hash->capacity * sizeof(pni_bucket_t);
 }
 
 pn_hash_t *pn_hash(size_t capacity, float load_factor, int options)
 {
-  pn_hash_t *hash = (pn_hash_t *) pn_map(capacity, load_factor, 0);
-  hash->map.hashcode = pni_identity_hashcode;
-  hash->map.equals = pni_identity_equals;
-  hash->map.count_keys = false;
-  hash->map.count_values = options & PN_REFCOUNT;
+  static pn_class_t clazz = PN_CLASS(pn_hash);
+
+  pn_hash_t *hash = (pn_hash_t *) pn_new(sizeof(pn_hash_t), &clazz);
+  hash->buckets = NULL;
+  hash->capacity = 0;
+  hash->size = 0;
+  // robin hood probing stays short up to a high load, but not a full one
+  hash->load_factor = (load_factor > 0 && load_factor <= 0.9f) ? load_factor : 0.9f;
+  hash->count_values = options & PN_REFCOUNT;
+  if (capacity) pni_hash_ensure(hash, capacity);
   return hash;
 }
 
 size_t pn_hash_size(pn_hash_t *hash)
 {
-  return pn_map_size(&hash->map);
+  assert(hash);
+  return hash->size;
 }
 
 int pn_hash_put(pn_hash_t *hash, uintptr_t key, void *value)
 {
-  return pn_map_put(&hash->map, (void *) key, value);
+  assert(hash);
+  pni_bucket_t *bucket = pni_hash_find(hash, key);
+  if (hash->count_values) pn_incref(value);
+  if (bucket) {
+    if (hash->count_values) pn_decref(bucket->value);
+    bucket->value = value;
+  } else {
+    pni_hash_ensure(hash, hash->size + 1);
+    pni_hash_insert(hash, key, value);
+  }
+  return 0;
 }
 
 void *pn_hash_get(pn_hash_t *hash, uintptr_t key)
 {
-  return pn_map_get(&hash->map, (void *) key);
+  assert(hash);
+  pni_bucket_t *bucket = pni_hash_find(hash, key);
+  return bucket ? bucket->value : NULL;
 }
 
 void pn_hash_del(pn_hash_t *hash, uintptr_t key)
 {
-  pn_map_del(&hash->map, (void *) key);
+  assert(hash);
+  pni_bucket_t *bucket = pni_hash_find(hash, key);
+  if (!bucket) return;
+
+  void *value = bucket->value;
+  size_t mask = hash->capacity - 1;
+  size_t i = bucket - hash->buckets;
+  size_t next = (i + 1) & mask;
+  while (hash->buckets[next].dist > 1) {
+    hash->buckets[i] = hash->buckets[next];
+    hash->buckets[i].dist--;
+    i = next;
+    next = (next + 1) & mask;
+  }
+  hash->buckets[i].key = 0;
+  hash->buckets[i].value = NULL;
+  hash->buckets[i].dist = 0;
+  hash->size--;
+  if (hash->count_values) pn_decref(value);
 }
 
 pn_handle_t pn_hash_head(pn_hash_t *hash)
 {
-  return pn_map_head(&hash->map);
+  assert(hash);
+  return pn_hash_next(hash, 0);
 }
 
 pn_handle_t pn_hash_next(pn_hash_t *hash, pn_handle_t entry)
 {
-  return pn_map_next(&hash->map, entry);
+  for (size_t i = entry; i < hash->capacity; i++) {
+    if (hash->buckets[i].dist) {
+      return i + 1;
+    }
+  }
+
+  return 0;
 }
 
 uintptr_t pn_hash_key(pn_hash_t *hash, pn_handle_t entry)
 {
-  return (uintptr_t) pn_map_key(&hash->map, entry);
+  assert(hash);
+  assert(entry);
+  return hash->buckets[entry - 1].key;
 }
 
 void *pn_hash_value(pn_hash_t *hash, pn_handle_t entry)
 {
-  return pn_map_value(&hash->map, entry);
+  assert(hash);
+  assert(entry);
+  return hash->buckets[entry - 1].value;
 }
 
 
 #define PNI_NULL_SIZE (-1)
 
+// strings up to this size, terminator included, are kept inside the
+// object and only longer ones go to the heap
+#define PNI_STRING_INLINE (32)
+
 struct pn_string_t {
-  char *bytes;
+  char *bytes;        // inline unless the string has outgrown it
   ssize_t size;       // PNI_NULL_SIZE (-1) means null
   size_t capacity;
+  char inline_bytes[PNI_STRING_INLINE];
 };
 
+#define pni_string_inline(STRING) ((STRING)->bytes == (STRING)->inline_bytes)
+
+size_t pni_string_footprint(pn_string_t *string)
+{
+  if (!string) return 0;
+  return pni_object_footprint(sizeof(pn_string_t)) +
+    (pni_string_inline(string) ? 0 : string->capacity);
+}
+
 static void pn_string_finalize(void *object)
 {
   pn_string_t *string = (pn_string_t *) object;
-  free(string->bytes);
+  if (!pni_string_inline(string)) free(string->bytes);
 }
 
 static uintptr_t pn_string_hashcode(void *object)
@@ -746,9 +1106,9 @@ static pn_class_t clazz = PN_CLASS(pn_string);
 pn_string_t *pn_stringn(const char *bytes, size_t n)
 {
 
-  pn_string_t *string = (pn_string_t *) pn_new(sizeof(pn_string_t), &clazz);
-  string->capacity = n ? n * sizeof(char) : 16;
-  string->bytes = (char *) malloc(string->capacity);
+  pn_string_t *string = (pn_string_t *) pni_new(sizeof(pn_string_t), &clazz, 256);
+  string->capacity = PNI_STRING_INLINE;
+  string->bytes = string->inline_bytes;
   pn_string_setn(string, bytes, n);
   return string;
 }
@@ -780,16 +1140,22 @@ int pn_string_set(pn_string_t *string, const char *bytes)
 
 int pn_string_grow(pn_string_t *string, size_t capacity)
 {
-  bool grow = false;
-  while (string->capacity < (capacity*sizeof(char) + 1)) {
-    string->capacity *= 2;
-    grow = true;
+  size_t newcap = string->capacity;
+  while (newcap < (capacity*sizeof(char) + 1)) {
+    newcap *= 2;
   }
 
-  if (grow) {
-    char *growed = (char *) realloc(string->bytes, string->capacity);
+  if (newcap != string->capacity) {
+    char *growed;
+    if (pni_string_inline(string)) {
+      growed = (char *) malloc(newcap);
+      if (growed) memcpy(growed, string->inline_bytes, PNI_STRING_INLINE);
+    } else {
+      growed = (char *) realloc(string->bytes, newcap);
+    }
     if (growed) {
       string->bytes = growed;
+      string->capacity = newcap;
     } else {
       return PN_ERR;
     }
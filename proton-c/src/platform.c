@@ -32,6 +32,13 @@ pn_timestamp_t pn_i_now(void)
   if (clock_gettime(CLOCK_REALTIME, &now)) pn_fatal("clock_gettime() failed\n");
   return ((pn_timestamp_t)now.tv_sec) * 1000 + (now.tv_nsec / 1000000);
 }
+
+uint64_t pn_i_now_usec(void)
+{
+  struct timespec now;
+  if (clock_gettime(CLOCK_MONOTONIC, &now)) pn_fatal("clock_gettime() failed\n");
+  return ((uint64_t)now.tv_sec) * 1000000 + (now.tv_nsec / 1000);
+}
 #elif defined(USE_WIN_FILETIME)
 #include <windows.h>
 pn_timestamp_t pn_i_now(void)
@@ -44,6 +51,15 @@ pn_timestamp_t pn_i_now(void)
   // Convert to milliseconds and adjust base epoch
   return t.QuadPart / 10000 - 11644473600000;
 }
+
+uint64_t pn_i_now_usec(void)
+{
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&freq);
+  return (uint64_t) (now.QuadPart / freq.QuadPart) * 1000000 +
+    (uint64_t) (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
 #else
 #include <sys/time.h>
 pn_timestamp_t pn_i_now(void)
@@ -52,6 +68,13 @@ pn_timestamp_t pn_i_now(void)
   if (gettimeofday(&now, NULL)) pn_fatal("gettimeofday failed\n");
   return ((pn_timestamp_t)now.tv_sec) * 1000 + (now.tv_usec / 1000);
 }
+
+uint64_t pn_i_now_usec(void)
+{
+  struct timeval now;
+  if (gettimeofday(&now, NULL)) pn_fatal("gettimeofday failed\n");
+  return ((uint64_t)now.tv_sec) * 1000000 + now.tv_usec;
+}
 #endif
 
 #ifdef USE_UUID_GENERATE
@@ -134,6 +157,142 @@ int64_t pn_i_atoll(const char* num) {
 #error "Don't know how to convert int64_t values on this platform"
 #endif
 
+FILE *pn_i_tmpfile(void)
+{
+  return tmpfile();
+}
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+int pn_i_fseek(FILE *file, uint64_t offset)
+{
+  return _fseeki64(file, (__int64) offset, SEEK_SET);
+}
+
+void *pn_i_map_file(FILE *file, uint64_t size)
+{
+  if (!size || fflush(file)) return NULL;
+  HANDLE handle = (HANDLE) _get_osfhandle(_fileno(file));
+  HANDLE mapping = CreateFileMapping(handle, NULL, PAGE_READONLY,
+                                     (DWORD) (size >> 32), (DWORD) size, NULL);
+  if (!mapping) return NULL;
+  // the view keeps the mapping open
+  void *addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T) size);
+  CloseHandle(mapping);
+  return addr;
+}
+
+void pn_i_unmap_file(void *addr, uint64_t size)
+{
+  if (addr) UnmapViewOfFile(addr);
+}
+#else
+#include <sys/mman.h>
+#include <sys/types.h>
+int pn_i_fseek(FILE *file, uint64_t offset)
+{
+  return fseeko(file, (off_t) offset, SEEK_SET);
+}
+
+void *pn_i_map_file(FILE *file, uint64_t size)
+{
+  if (!size || size > (size_t) -1 || fflush(file)) return NULL;
+  void *addr = mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, fileno(file), 0);
+  return addr == MAP_FAILED ? NULL : addr;
+}
+
+void pn_i_unmap_file(void *addr, uint64_t size)
+{
+  if (addr) munmap(addr, (size_t) size);
+}
+#endif
+
+// Functions run at thread exit are listed per thread. Running them
+// empties the list, so any they register again run on a later pass.
+#define PNI_THREAD_EXITS (4)
+
+typedef struct {
+  int count;
+  void (*fns[PNI_THREAD_EXITS])(void);
+} pni_thread_exits_t;
+
+#if defined(PN_THREAD_LOCAL) && (defined(USE_PTHREAD_KEY) || defined(USE_WIN_FLS))
+static PN_THREAD_LOCAL pni_thread_exits_t pni_thread_exits;
+
+static void pni_thread_exits_run(pni_thread_exits_t *exits)
+{
+  while (exits->count) {
+    void (*fn)(void) = exits->fns[--exits->count];
+    fn();
+  }
+}
+
+static int pni_thread_exits_add(void (*fn)(void))
+{
+  pni_thread_exits_t *exits = &pni_thread_exits;
+  for (int i = 0; i < exits->count; i++) {
+    if (exits->fns[i] == fn) return 0;
+  }
+  if (exits->count == PNI_THREAD_EXITS) return PN_ERR;
+  exits->fns[exits->count++] = fn;
+  return 0;
+}
+#endif
+
+#if defined(PN_THREAD_LOCAL) && defined(USE_PTHREAD_KEY)
+#include <pthread.h>
+static pthread_key_t pni_thread_exit_key;
+static int pni_thread_exit_err;
+static pthread_once_t pni_thread_exit_once = PTHREAD_ONCE_INIT;
+
+static void pni_thread_exit_run(void *value)
+{
+  pni_thread_exits_run((pni_thread_exits_t *) value);
+}
+
+static void pni_thread_exit_init(void)
+{
+  pni_thread_exit_err = pthread_key_create(&pni_thread_exit_key, pni_thread_exit_run);
+}
+
+int pn_i_thread_exit(void (*fn)(void))
+{
+  pthread_once(&pni_thread_exit_once, pni_thread_exit_init);
+  if (pni_thread_exit_err) return PN_ERR;
+  // the key's destructor only runs for threads with a value set
+  if (pthread_setspecific(pni_thread_exit_key, &pni_thread_exits)) return PN_ERR;
+  return pni_thread_exits_add(fn);
+}
+#elif defined(PN_THREAD_LOCAL) && defined(USE_WIN_FLS)
+#include <windows.h>
+static volatile LONG pni_thread_exit_index = (LONG) FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI pni_thread_exit_run(PVOID value)
+{
+  if (value) pni_thread_exits_run((pni_thread_exits_t *) value);
+}
+
+int pn_i_thread_exit(void (*fn)(void))
+{
+  if (pni_thread_exit_index == (LONG) FLS_OUT_OF_INDEXES) {
+    DWORD index = FlsAlloc(pni_thread_exit_run);
+    if (index == FLS_OUT_OF_INDEXES) return PN_ERR;
+    // another thread may have got there first
+    if (InterlockedCompareExchange(&pni_thread_exit_index, (LONG) index,
+                                   (LONG) FLS_OUT_OF_INDEXES) != (LONG) FLS_OUT_OF_INDEXES)
+      FlsFree(index);
+  }
+  if (!FlsSetValue((DWORD) pni_thread_exit_index, &pni_thread_exits)) return PN_ERR;
+  return pni_thread_exits_add(fn);
+}
+#else
+int pn_i_thread_exit(void (*fn)(void))
+{
+  return PN_ERR;
+}
+#endif
+
 #ifdef _MSC_VER
 // [v]snprintf on Windows only matches C99 when no errors or overflow.
 int pn_i_vsnprintf(char *buf, size_t count, const char *fmt, va_list ap) {
@@ -24,6 +24,7 @@
 
 #include "proton/types.h"
 #include "proton/error.h"
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,6 +40,17 @@ extern "C" {
  */
 pn_timestamp_t pn_i_now(void);
 
+/** Get a high resolution timestamp for measuring intervals.
+ *
+ * Returns microseconds from an arbitrary, monotonic origin where the
+ * platform provides one. Only differences between two values are
+ * meaningful.
+ *
+ * @return current interval timer value in microseconds
+ * @internal
+ */
+uint64_t pn_i_now_usec(void);
+
 /** Generate a UUID in string format.
  *
  * Returns a newly generated UUID in the standard 36 char format.
@@ -72,6 +84,49 @@ int pn_i_error_from_errno(pn_error_t *error, const char *msg);
  */
 int64_t pn_i_atoll(const char* num);
 
+/** Temporary files for delivery payload that is too large to buffer
+ * in memory.
+ *
+ * pn_i_tmpfile creates an anonymous file that is removed once closed.
+ * Offsets and sizes are 64 bit so that files past 2GB work everywhere.
+ * pn_i_map_file maps the first size bytes of a file read only, and
+ * returns NULL if that is not possible.
+ *
+ * @internal
+ */
+FILE *pn_i_tmpfile(void);
+int pn_i_fseek(FILE *file, uint64_t offset);
+void *pn_i_map_file(FILE *file, uint64_t size);
+void pn_i_unmap_file(void *addr, uint64_t size);
+
+/** Storage private to each thread.
+ *
+ * PN_THREAD_LOCAL qualifies a static variable so that each thread has
+ * its own copy. It is left undefined where the compiler offers no way
+ * to do this, and code using it must then do without.
+ *
+ * @internal
+ */
+#if defined(_MSC_VER)
+#define PN_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define PN_THREAD_LOCAL __thread
+#endif
+
+/** Release storage private to a thread as the thread exits.
+ *
+ * pn_i_thread_exit arranges for fn to be called on the calling thread
+ * when that thread exits. Code that keeps memory in PN_THREAD_LOCAL
+ * storage calls it once per thread before keeping anything, and keeps
+ * nothing if it fails: it returns PN_ERR where the platform has no way
+ * to run code at thread exit. The main thread may end without fn being
+ * called.
+ *
+ * @return 0 on success, PN_ERR otherwise
+ * @internal
+ */
+int pn_i_thread_exit(void (*fn)(void));
+
 #ifdef _MSC_VER
 /** Windows snprintf and vsnprintf substitutes.
  *
@@ -22,9 +22,11 @@
 #include <assert.h>
 #include <poll.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -46,18 +48,25 @@
 #define PN_SEL_RD (0x0001)
 #define PN_SEL_WR (0x0002)
 
+// segments of queued transport output handed to each gathering write
+#define PN_SEND_SEGMENTS (16)
+
 /* Abstract away turning off SIGPIPE */
 #ifdef MSG_NOSIGNAL
-static inline ssize_t pn_send(int sockfd, const void *buf, size_t len) {
-    return send(sockfd, buf, len, MSG_NOSIGNAL);
+static inline ssize_t pn_sendv(int sockfd, struct iovec *iov, int count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(sockfd, &msg, MSG_NOSIGNAL);
 }
 
 static inline int pn_create_socket() {
     return socket(AF_INET, SOCK_STREAM, getprotobyname("tcp")->p_proto);
 }
 #elif defined(SO_NOSIGPIPE)
-static inline ssize_t pn_send(int sockfd, const void *buf, size_t len) {
-    return send(sockfd, buf, len, 0);
+static inline ssize_t pn_sendv(int sockfd, struct iovec *iov, int count) {
+    return writev(sockfd, iov, count);
 }
 
 static inline int pn_create_socket() {
@@ -382,6 +391,14 @@ pn_connector_t *pn_connector(pn_driver_t *driver, const char *host,
   return c;
 }
 
+static void pni_send_buffer_hint(pn_transport_t *transport, int fd)
+{
+  int sndbuf = 0;
+  socklen_t len = sizeof(sndbuf);
+  if (!getsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void *) &sndbuf, &len) && sndbuf > 0)
+    pn_transport_set_send_buffer_hint(transport, sndbuf);
+}
+
 pn_connector_t *pn_connector_fd(pn_driver_t *driver, int fd, void *context)
 {
   if (!driver) return NULL;
@@ -403,6 +420,7 @@ pn_connector_t *pn_connector_fd(pn_driver_t *driver, int fd, void *context)
   c->wakeup = 0;
   c->connection = NULL;
   c->transport = pn_transport();
+  pni_send_buffer_hint(c->transport, fd);
   c->sasl = pn_sasl(c->transport);
   c->input_done = false;
   c->output_done = false;
@@ -605,7 +623,14 @@ void pn_connector_process(pn_connector_t *c)
         c->status |= PN_SEL_WR;
         if (c->pending_write) {
           c->pending_write = false;
-          ssize_t n = pn_send(c->fd, pn_transport_head(transport), pending);
+          pn_bytes_t segments[PN_SEND_SEGMENTS];
+          struct iovec iov[PN_SEND_SEGMENTS];
+          int count = pn_transport_head_vec(transport, segments, PN_SEND_SEGMENTS);
+          for (int i = 0; i < count; i++) {
+            iov[i].iov_base = segments[i].start;
+            iov[i].iov_len = segments[i].size;
+          }
+          ssize_t n = pn_sendv(c->fd, iov, count);
           if (n < 0) {
             // XXX
             if (errno != EAGAIN) {
@@ -616,8 +641,7 @@ void pn_connector_process(pn_connector_t *c)
             }
           } else if (n) {
             pn_transport_pop(transport, (size_t) n);
-            pending -= n;
-            if (pending == 0)
+            if (!pn_transport_head(transport))
               c->status &= ~PN_SEL_WR;
           }
         }
@@ -776,6 +800,10 @@ int pn_driver_wait_2(pn_driver_t *d, int timeout)
   int result = poll(d->fds, d->nfds, d->closed_count > 0 ? 0 : timeout);
   if (result == -1)
     pn_i_error_from_errno(d->error, "poll");
+  // a wait that ran its course with nothing to do hands half of the
+  // buffers kept for reuse back to the system
+  if (result == 0 && timeout && !d->closed_count)
+    pn_buffer_pool_trim(pn_buffer_pool_cached() / 2);
   return result;
 }
 
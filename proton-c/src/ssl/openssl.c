@@ -720,6 +720,7 @@ pn_ssl_t *pn_ssl(pn_transport_t *transport)
   pn_ssl_t *ssl = (pn_ssl_t *) calloc(1, sizeof(pn_ssl_t));
   if (!ssl) return NULL;
   ssl->out_size = APP_BUF_SIZE;
+  transport->record_size = PN_TLS_RECORD_SIZE;
   uint32_t max_frame = pn_transport_get_max_frame(transport);
   ssl->in_size =  max_frame ? max_frame : APP_BUF_SIZE;
   ssl->outbuf = (char *)malloc(ssl->out_size);
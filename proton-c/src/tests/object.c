@@ -179,6 +179,73 @@ static void test_compare()
   pn_free(b);
 }
 
+static void test_pool()
+{
+  pn_class_stats_t stats;
+  pn_string_t *strs[3];
+  for (int i = 0; i < 3; i++) strs[i] = pn_string("pooled");
+  pn_class_t *clazz = pn_class(strs[0]);
+  pn_class_release(clazz);
+  pn_class_stats(clazz, &stats);
+  // nothing is counted where threads have no storage of their own
+  if (!stats.created) {
+    for (int i = 0; i < 3; i++) pn_free(strs[i]);
+    return;
+  }
+  uint64_t created = stats.created;
+  uint64_t reused = stats.reused;
+  int64_t live = stats.live;
+  assert(stats.pooled == 0);
+
+  for (int i = 0; i < 3; i++) pn_free(strs[i]);
+  pn_class_stats(clazz, &stats);
+  assert(stats.live == live - 3 && stats.pooled == 3);
+
+  pn_string_t *str = pn_string("reused");
+  assert(str == strs[2]);
+  assert(pn_refcount(str) == 1);
+  assert(pn_class(str) == clazz);
+  assert(!strcmp(pn_string_get(str), "reused"));
+  pn_class_stats(clazz, &stats);
+  assert(stats.created == created + 1 && stats.reused == reused + 1);
+  assert(stats.live == live - 2 && stats.pooled == 2);
+  pn_free(str);
+
+  pn_class_release(clazz);
+  pn_class_stats(clazz, &stats);
+  assert(stats.pooled == 0);
+}
+
+static void test_counting()
+{
+  static pn_class_t clazz = {finalizer};
+  int called = 0;
+  pn_class_stats_t stats;
+
+  assert(!pn_class_get_counting());
+  void *obj = pn_new(sizeof(int *), &clazz);
+  *(int **) obj = &called;
+  pn_free(obj);
+  pn_class_stats(&clazz, &stats);
+  assert(stats.created == 0 && stats.live == 0);
+
+  pn_class_set_counting(true);
+  void *objs[2];
+  for (int i = 0; i < 2; i++) {
+    objs[i] = pn_new(sizeof(int *), &clazz);
+    *(int **) objs[i] = &called;
+  }
+  pn_free(objs[0]);
+  pn_class_stats(&clazz, &stats);
+  if (stats.created) {
+    assert(stats.created == 2 && stats.reused == 0);
+    assert(stats.live == 1 && stats.peak == 2 && stats.pooled == 0);
+  }
+  pn_free(objs[1]);
+  pn_class_set_counting(false);
+  assert(called == 3);
+}
+
 static void test_refcounting(int refs)
 {
   void *obj = pn_new(0, NULL);
@@ -499,6 +566,57 @@ static void test_hash()
   pn_decref(three);
 }
 
+static void test_hash_churn(uintptr_t stride)
+{
+  void *one = pn_new(0, NULL);
+  void *two = pn_new(0, NULL);
+  void *values[1024] = {NULL};
+
+  pn_hash_t *hash = pn_hash(0, 0.75, PN_REFCOUNT);
+  size_t size = 0;
+  unsigned seed = 1;
+  for (int n = 0; n < 20000; n++) {
+    seed = seed * 1103515245 + 12345;
+    int i = (seed >> 8) % 1024;
+    uintptr_t key = i * stride;
+    if (values[i] && (seed & 0x40)) {
+      pn_hash_del(hash, key);
+      values[i] = NULL;
+      size--;
+    } else {
+      if (!values[i]) size++;
+      values[i] = (seed & 0x80) ? one : two;
+      pn_hash_put(hash, key, values[i]);
+    }
+    assert(pn_hash_size(hash) == size);
+    assert(pn_hash_get(hash, key) == values[i]);
+  }
+
+  for (int i = 0; i < 1024; i++) {
+    assert(pn_hash_get(hash, i * stride) == values[i]);
+  }
+
+  size_t count = 0;
+  for (pn_handle_t entry = pn_hash_head(hash); entry; entry = pn_hash_next(hash, entry)) {
+    uintptr_t key = pn_hash_key(hash, entry);
+    assert(key % stride == 0 && key / stride < 1024);
+    assert(pn_hash_value(hash, entry) == values[key / stride]);
+    count++;
+  }
+  assert(count == size);
+
+  pn_handle_t entry;
+  while ((entry = pn_hash_head(hash))) {
+    pn_hash_del(hash, pn_hash_key(hash, entry));
+  }
+  assert(pn_hash_size(hash) == 0);
+  assert(pn_refcount(one) == 1 && pn_refcount(two) == 1);
+
+  pn_decref(hash);
+  pn_decref(one);
+  pn_decref(two);
+}
+
 static bool equals(const char *a, const char *b)
 {
   if (a == NULL && b == NULL) {
@@ -591,6 +709,39 @@ static void test_string_addf()
   pn_free(str);
 }
 
+static void test_string_spill()
+{
+  // starts out short enough to be held inline, then outgrows it
+  pn_string_t *str = pn_string("0123456789");
+  assert(str);
+  for (int i = 0; i < 10; i++) {
+    assert(pn_string_size(str) == 10 + 10 * (size_t) i);
+    int err = pn_string_addf(str, "%s", "0123456789");
+    assert(err == 0);
+  }
+  assert(pn_string_size(str) == 110);
+  const char *bytes = pn_string_get(str);
+  for (int i = 0; i < 110; i++) {
+    assert(bytes[i] == '0' + i % 10);
+  }
+  assert(bytes[110] == '\0');
+  assert(pn_string_capacity(str) >= 110);
+
+  pn_string_set(str, "short");
+  assert(equals(pn_string_get(str), "short"));
+  pn_free(str);
+
+  str = pn_stringn(NULL, 0);
+  assert(pn_string_get(str) == NULL);
+  assert(pn_string_resize(str, 31) == 0);
+  memset(pn_string_buffer(str), 'x', 31);
+  assert(pn_string_resize(str, 40) == 0);
+  for (int i = 0; i < 31; i++) {
+    assert(pn_string_get(str)[i] == 'x');
+  }
+  pn_free(str);
+}
+
 static void test_map_iteration(int n)
 {
   pn_list_t *pairs = pn_list(2*n, PN_REFCOUNT);
@@ -735,6 +886,8 @@ int main(int argc, char **argv)
 
   test_finalize();
   test_free();
+  test_pool();
+  test_counting();
   test_hashcode();
   test_compare();
 
@@ -755,6 +908,8 @@ int main(int argc, char **argv)
   test_map();
 
   test_hash();
+  test_hash_churn(1);
+  test_hash_churn(4096);
 
   test_string(NULL);
   test_string("");
@@ -766,6 +921,7 @@ int main(int argc, char **argv)
 
   test_string_format();
   test_string_addf();
+  test_string_spill();
 
   test_build_list();
   test_build_map();
@@ -31,6 +31,10 @@
 #include <string.h>
 #include <sys/types.h>
 #include <proton/types.h>
+#include <proton/buffer.h>
+#include <proton/codec.h>
+#include <proton/error.h>
+#include <proton/object.h>
 
 PN_EXTERN ssize_t pn_quote_data(char *dst, size_t capacity, const char *src, size_t size);
 PN_EXTERN void pn_fprint_data(FILE *stream, const char *bytes, size_t size);
@@ -99,9 +103,28 @@ pn_timestamp_t pn_timestamp_min(pn_timestamp_t a, pn_timestamp_t b);
     (NODE)-> LIST ## _prev = NULL;                                     \
   }
 
+// pn_new for classes of the library whose freed objects each thread
+// keeps for reuse, up to pool of them; every object of such a class
+// must be of the same size
+void *pni_new(size_t size, pn_class_t *clazz, size_t pool);
+
 char *pn_strdup(const char *src);
 char *pn_strndup(const char *src, size_t n);
 
+// Heap bytes held by an object, not counting allocator overhead. Each
+// accepts NULL. pni_object_footprint is for a size byte pn_new object.
+size_t pni_object_footprint(size_t size);
+size_t pni_buffer_footprint(pn_buffer_t *buf);
+size_t pni_data_footprint(pn_data_t *data);
+size_t pni_error_footprint(pn_error_t *error);
+size_t pni_string_footprint(pn_string_t *string);
+size_t pni_list_footprint(pn_list_t *list);
+size_t pni_hash_footprint(pn_hash_t *hash);
+
+// Trims the calling thread's buffer pool to what it keeps at rest, a
+// quarter of its capacity, and returns how much was freed.
+size_t pni_buffer_pool_rest(void);
+
 #define pn_min(X,Y) ((X) > (Y) ? (Y) : (X))
 #define pn_max(X,Y) ((X) < (Y) ? (Y) : (X))
 
@@ -424,6 +424,14 @@ pn_connector_t *pn_connector(pn_driver_t *driver, const char *hostarg,
 static void pn_connector_read(pn_connector_t *ctor);
 static void pn_connector_write(pn_connector_t *ctor);
 
+static void pni_send_buffer_hint(pn_transport_t *transport, pn_socket_t fd)
+{
+  int sndbuf = 0;
+  int len = sizeof(sndbuf);
+  if (!getsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char *) &sndbuf, &len) && sndbuf > 0)
+    pn_transport_set_send_buffer_hint(transport, sndbuf);
+}
+
 pn_connector_t *pn_connector_fd(pn_driver_t *driver, pn_socket_t fd, void *context)
 {
   if (!driver) return NULL;
@@ -445,6 +453,7 @@ pn_connector_t *pn_connector_fd(pn_driver_t *driver, pn_socket_t fd, void *conte
   c->wakeup = 0;
   c->connection = NULL;
   c->transport = pn_transport();
+  pni_send_buffer_hint(c->transport, fd);
   c->sasl = pn_sasl(c->transport);
   c->input_done = false;
   c->output_done = false;
@@ -861,6 +870,10 @@ int pn_driver_wait_2(pn_driver_t *d, int timeout)
     pn_i_error_from_errno(d->error, "select");
     return -1;
   }
+  // a wait that ran its course with nothing to do hands half of the
+  // buffers kept for reuse back to the system
+  if (nfds == 0 && timeout && !d->closed_count)
+    pn_buffer_pool_trim(pn_buffer_pool_cached() / 2);
   return 0;
 }
 
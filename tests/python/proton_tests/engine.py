@@ -17,7 +17,7 @@
 # under the License.
 #
 
-import os, common
+import os, common, random
 from time import time, sleep
 from proton import *
 from common import pump
@@ -407,6 +407,65 @@ class LinkTest(Test):
     conn.close()
     self.pump()
 
+  def links(self, conn, mask):
+    result = []
+    l = conn.link_head(mask)
+    while l:
+      result.append(l)
+      l = l.next(mask)
+    return result
+
+  def test_link_iteration(self):
+    ssn = self.snd.session
+    conn = ssn.connection
+    links = [self.snd] + [ssn.sender("link-%s" % i) for i in range(5)]
+    links[1].open()
+    links[3].open()
+    links[4].open()
+    links[4].close()
+
+    assert self.links(conn, 0) == links
+    assert self.links(conn, Endpoint.LOCAL_UNINIT) == [links[0], links[2], links[5]]
+    assert self.links(conn, Endpoint.LOCAL_ACTIVE | Endpoint.LOCAL_CLOSED) == \
+        [links[1], links[3], links[4]]
+    assert self.links(conn, Endpoint.LOCAL_ACTIVE | Endpoint.REMOTE_UNINIT) == \
+        [links[1], links[3]]
+    assert self.links(conn, Endpoint.LOCAL_CLOSED | Endpoint.REMOTE_ACTIVE) == []
+    assert self.links(conn, Endpoint.REMOTE_ACTIVE) == []
+
+    # links keep their place while the iteration changes their state
+    opened = []
+    l = conn.link_head(Endpoint.LOCAL_UNINIT)
+    while l:
+      l.open()
+      opened.append(l)
+      l = l.next(Endpoint.LOCAL_UNINIT)
+    assert opened == [links[0], links[2], links[5]]
+    assert self.links(conn, Endpoint.LOCAL_ACTIVE) == \
+        [links[0], links[1], links[2], links[3], links[5]]
+
+    self.pump()
+    c2 = self.rcv.session.connection
+    remote = self.links(c2, Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_ACTIVE)
+    # everything but the link that was closed before it was attached
+    assert len(remote) == 5
+    assert remote[0] == self.rcv
+
+  def test_attach_matches_name_and_role(self):
+    rssn = self.rcv.session
+    longer = rssn.receiver("named-10")
+    other_role = rssn.sender("named-1")
+    exact = rssn.receiver("named-1")
+    duplicate = rssn.receiver("named-1")
+
+    self.snd.session.sender("named-1").open()
+    self.pump()
+
+    assert longer.state == Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_UNINIT
+    assert other_role.state == Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_UNINIT
+    assert exact.state == Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_ACTIVE
+    assert duplicate.state == Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_UNINIT
+
   def test_closing_session(self):
     self.snd.open()
     self.rcv.open()
@@ -511,6 +570,20 @@ class LinkTest(Test):
     rcond = self.rcv.remote_condition
     assert rcond == cond, (rcond, cond)
 
+  def test_long_condition(self):
+    self.snd.open()
+    self.rcv.open()
+    self.pump()
+    assert self.rcv.remote_condition is None
+
+    cond = Condition("x:" + "n" * 300, "d" * 4096)
+    self.snd.condition = cond
+    self.snd.close()
+    self.pump()
+
+    rcond = self.rcv.remote_condition
+    assert rcond == cond, (rcond, cond)
+
   def test_settle_mode(self):
     self.snd.snd_settle_mode = Link.SND_UNSETTLED
     assert self.snd.snd_settle_mode == Link.SND_UNSETTLED
@@ -631,6 +704,29 @@ class TransferTest(Test):
     bytes = self.rcv.recv(1024)
     assert bytes is None
 
+  def test_tag_sizes(self):
+    # tags either side of the inline limit, with deliveries recycled
+    # between the two links of the connection
+    other = self.snd.session.sender("other-link")
+    other.open()
+    self.pump()
+    tags = ["", "t", "x"*31, "y"*32, "z"*33, "w"*200, "v"*32]
+    self.rcv.flow(len(tags))
+    self.pump()
+    for i, tag in enumerate(tags):
+      snd = (self.snd, other)[i % 2]
+      sd = snd.delivery(tag)
+      assert sd.tag == tag, (sd.tag, tag)
+      if snd is self.snd:
+        snd.send("x")
+        snd.advance()
+        self.pump()
+        rd = self.rcv.current
+        assert rd.tag == tag, (rd.tag, tag)
+        rd.settle()
+        self.pump()
+      sd.settle()
+
   def test_disposition(self):
     self.rcv.flow(1)
 
@@ -729,6 +825,41 @@ class TransferTest(Test):
       rd.update(Delivery.ACCEPTED)
       rd.settle()
 
+  def test_output_backlog(self):
+    self.rcv.flow(4)
+    self.pump()
+    body = "".join([chr(ord("a") + i % 26) for i in range(64*1024)])
+    for m in range(4):
+      self.snd.delivery("tag%s" % m)
+      assert self.snd.send(body) == len(body)
+      assert self.snd.advance()
+
+    t1 = self.c1._transport
+    t2 = self.c2._transport
+    # let the output back up over several chunks before taking any
+    for i in range(8):
+      assert t1.pending() > 0
+    head = t1.peek(48*1024)
+    assert len(head) == 48*1024
+
+    # then drain it in pieces that straddle the chunk boundaries
+    out = ""
+    while t1.pending() > 0:
+      piece = t1.peek(min(t1.pending(), 1000))
+      t1.pop(len(piece))
+      out += piece
+    assert out.startswith(head)
+    while out:
+      n = t2.input(out)
+      assert n > 0, n
+      out = out[n:]
+
+    for m in range(4):
+      rd = self.rcv.current
+      assert rd.tag == "tag%s" % m, (rd.tag, m)
+      assert self.rcv.recv(len(body)) == body
+      assert self.rcv.advance()
+
 
 class MaxFrameTransferTest(Test):
 
@@ -846,6 +977,96 @@ class MaxFrameTransferTest(Test):
     bytes = self.rcv.recv(1024)
     assert bytes == None
 
+  def _sendFrames(self, tag, size):
+    t_snd = self.snd.session.connection._transport
+    before = t_snd.frames_output
+    self.snd.delivery(tag)
+    msg = self.message(size)
+    assert self.snd.send(msg) == len(msg)
+    assert self.snd.advance()
+    self.pump()
+    assert self.rcv.recv(size) == msg
+    self.rcv.advance()
+    return t_snd.frames_output - before
+
+  def testAdaptiveFrame(self):
+    """
+    Verify that a big message is fragmented even though neither side
+    advertises a max-frame, and that the frame size follows the sizes
+    of recently sent messages.
+    """
+    self.snd, self.rcv = self.link("test-link")
+    self.c1 = self.snd.session.connection
+    self.c2 = self.rcv.session.connection
+    self.snd.open()
+    self.rcv.open()
+    self.rcv.flow(64)
+    self.pump()
+
+    t_snd = self.c1._transport
+    assert t_snd.adaptive_frame
+    assert t_snd.max_frame_size == 0
+    assert t_snd.output_frame_size == 64*1024, t_snd.output_frame_size
+    assert self._sendFrames("big", 1024*256) >= 4
+
+    for i in range(32):
+      self._sendFrames("small%s" % i, 100)
+    assert t_snd.output_frame_size <= 8*1024, t_snd.output_frame_size
+
+    t_snd.adaptive_frame = False
+    assert t_snd.output_frame_size == 0, t_snd.output_frame_size
+    assert self._sendFrames("whole", 1024*256) == 1
+
+  def _interleave(self, priority):
+    """
+    Queue several big messages on one link and then a small one on a
+    second link of the same session, and return how many bytes of the
+    big messages arrived before the small one.
+    """
+    self.snd, self.rcv = self.link("bulk")
+    self.c1 = self.snd.session.connection
+    self.c2 = self.rcv.session.connection
+    ping = self.snd.session.sender("ping")
+    ping.priority = priority
+    self.snd.open()
+    ping.open()
+    self.rcv.open()
+    self.pump()
+    pong = self.c2.link_head(Endpoint.LOCAL_UNINIT)
+    pong.open()
+    self.rcv.flow(4)
+    pong.flow(1)
+    self.pump()
+
+    for i in range(4):
+      self.snd.delivery("bulk%s" % i)
+      self.snd.send(self.message(1024*256))
+      self.snd.advance()
+    ping.delivery("ping")
+    ping.send("ping")
+    ping.advance()
+
+    t1 = self.c1._transport
+    t2 = self.c2._transport
+    ahead = 0
+    while True:
+      t2.push(t1.peek(4096))
+      t1.pop(4096)
+      d = pong.current
+      if d and not d.partial:
+        return ahead
+      if self.rcv.current:
+        ahead += len(self.rcv.recv(1024*1024) or "")
+        if not self.rcv.current.partial:
+          self.rcv.advance()
+
+  def testLinkInterleave(self):
+    ahead = self._interleave(0)
+    assert ahead < 1024*256, ahead
+
+  def testLinkPriority(self):
+    assert self._interleave(Link.PRIORITIES - 1) < self._interleave(0)
+
 
 class IdleTimeoutTest(Test):
 
@@ -967,6 +1188,33 @@ class CreditTest(Test):
     credit = self.snd.credit
     assert credit == 10 + count, credit
 
+  def testCreditStarvation(self):
+    self.c1._transport.stats_timing = True
+    assert self.snd.credit_starvation == 0
+    d = self.snd.delivery("tag")
+    assert d
+    assert self.snd.advance()
+    self.pump()
+    before = self.snd.credit_starvation
+    assert self.snd.credit_starvation >= before
+
+    self.rcv.flow(1)
+    self.pump()
+    starved = self.snd.credit_starvation
+    assert starved >= before, (starved, before)
+    assert self.snd.credit_starvation == starved
+    assert self.rcv.queued == 1, self.rcv.queued
+
+  def testCreditStarvationUntimed(self):
+    d = self.snd.delivery("tag")
+    assert d
+    assert self.snd.advance()
+    self.pump()
+    self.rcv.flow(1)
+    self.pump()
+    assert self.rcv.queued == 1, self.rcv.queued
+    assert self.snd.credit_starvation == 0, self.snd.credit_starvation
+
   def testCreditReceiver(self):
     self.rcv.flow(10)
     self.pump()
@@ -1285,6 +1533,205 @@ class SessionCreditTest(Test):
         available = rcv.session.incoming_capacity - rcv.session.incoming_bytes
         assert available < max_frame, available
 
+  def testWindowStalls(self):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    rcv.session.incoming_capacity = 4*1024
+    snd.open()
+    rcv.open()
+    rcv.flow(8)
+    self.pump()
+    assert snd.session.window_stalls == 0, snd.session.window_stalls
+
+    for i in range(8):
+      d = snd.delivery("tag%s" % i)
+      assert d
+      assert snd.send("x"*1024) == 1024
+      assert snd.advance()
+    self.pump()
+    assert snd.session.outgoing_bytes > 0, snd.session.outgoing_bytes
+    assert snd.session.window_stalls > 0, snd.session.window_stalls
+
+  def testWrappedPayload(self):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    rcv.session.incoming_capacity = 2*1024
+    snd.open()
+    rcv.open()
+    rcv.flow(1)
+    self.pump()
+
+    # the window takes the front of the sender's buffer, so the rest of
+    # the delivery wraps around to the start of it
+    first = "".join([chr(ord("a") + i % 26) for i in range(3000)])
+    rest = "".join([chr(ord("A") + i % 26) for i in range(2500)])
+    snd.delivery("tag")
+    assert snd.send(first) == len(first)
+    self.pump()
+    assert 0 < snd.session.outgoing_bytes < len(first), snd.session.outgoing_bytes
+    assert snd.send(rest) == len(rest)
+    assert snd.advance()
+
+    data = ""
+    while len(data) < len(first) + len(rest):
+      self.pump()
+      chunk = rcv.recv(1024)
+      assert chunk, len(data)
+      data += chunk
+    assert data == first + rest
+    assert not rcv.current.partial
+
+  def testEarlyWindowRefresh(self):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    rcv.session.incoming_capacity = 16*1024
+    snd.open()
+    rcv.open()
+    rcv.flow(1024)
+    self.pump()
+
+    # a consumer that keeps up should never let the window close
+    for i in range(64):
+      for j in range(3):
+        d = snd.delivery("tag%s-%s" % (i, j))
+        assert d
+        assert snd.send("x"*512) == 512
+        assert snd.advance()
+      self.pump()
+      while rcv.current:
+        assert rcv.recv(1024) == "x"*512
+        assert rcv.advance()
+      self.pump()
+    assert snd.session.outgoing_bytes == 0, snd.session.outgoing_bytes
+    assert snd.session.window_stalls == 0, snd.session.window_stalls
+
+  def testWindowSharedByLinks(self):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    rcv.session.incoming_capacity = 4*1024
+    senders = [snd] + [snd.session.sender("link-%s" % i) for i in range(7)]
+    for s in senders:
+      s.open()
+    rcv.open()
+    self.pump()
+    c2 = rcv.session.connection
+    l = c2.link_head(0)
+    while l:
+      l.open()
+      l.flow(1)
+      l = l.next(0)
+    self.pump()
+
+    # every link has credit, but the session window only admits four
+    for i, s in enumerate(senders):
+      assert s.credit == 1, (i, s.credit)
+      d = s.delivery("tag%s" % i)
+      assert s.send("x"*512) == 512
+      assert s.advance()
+    self.pump()
+    assert snd.session.connection.remote_condition is None
+    assert snd.session.window_stalls > 0, snd.session.window_stalls
+
+    received = 0
+    while received < len(senders):
+      d = c2.work_head
+      assert d, received
+      while d:
+        nxt = d.work_next
+        if d.readable and not d.partial:
+          assert d.link.recv(1024) == "x"*512
+          d.settle()
+          received += 1
+        d = nxt
+      self.pump()
+      assert snd.session.connection.remote_condition is None
+
+  def testSpill(self, size=64*1024):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    rcv.session.incoming_capacity = 4*1024
+    rcv.max_buffered = 2*1024
+    snd.open()
+    rcv.open()
+    rcv.flow(1)
+    self.pump()
+
+    body = "".join([chr(ord("a") + i % 26) for i in range(size)])
+    snd.delivery("tag")
+    assert snd.send(body) == size
+    assert snd.advance()
+    # many times the session's capacity, but once spilled the window
+    # stays open for the rest of the message
+    self.pump()
+
+    d = rcv.current
+    assert d.spilled
+    assert not d.partial
+    assert d.pending == size, d.pending
+    assert rcv.session.incoming_bytes == 0, rcv.session.incoming_bytes
+    assert rcv.recv(1000) == body[:1000]
+    assert d.pending == size - 1000, d.pending
+    assert rcv.recv(size) == body[1000:]
+    assert rcv.recv(1) is None
+    assert rcv.advance()
+    d.settle()
+    self.pump()
+    assert snd.session.connection.remote_condition is None
+
+  def rebind(self):
+    c1, t1, c2, t2 = self._wires.pop()
+    t1.unbind()
+    t2.unbind()
+    t1 = Transport()
+    t1.bind(c1)
+    c1._transport = t1
+    t2 = Transport()
+    t2.bind(c2)
+    c2._transport = t2
+    self._wires.append((c1, t1, c2, t2))
+    return t1, t2
+
+  def testResume(self, size=16*1024, resumable=True):
+    snd, rcv = self.link("test-link", max_frame=(1024, 1024))
+    snd.resumable = resumable
+    snd.open()
+    rcv.open()
+    rcv.flow(2)
+    self.pump()
+
+    body = "".join([chr(ord("a") + i % 26) for i in range(size)])
+    sd = snd.delivery("tag")
+    assert snd.send(body) == size
+    assert snd.advance()
+
+    # the connection drops with half the message through
+    t1 = snd.session.connection._transport
+    t2 = rcv.session.connection._transport
+    t2.push(t1.peek(size/2))
+    rd = rcv.current
+    assert rd.partial
+    received = rd.pending
+    assert received > 0
+    self.rebind()
+    self.pump()
+
+    assert rcv.current is rd
+    if resumable:
+      assert not rd.partial
+      assert rd.pending == size, (rd.pending, size)
+      assert rcv.recv(size) == body
+    else:
+      # the sender no longer has it, so the receiver takes it as settled
+      assert rd.settled
+      assert rd.pending == received
+    assert rcv.advance()
+    rd.update(Delivery.ACCEPTED)
+    rd.settle()
+    self.pump()
+    if resumable:
+      assert sd.remote_state == Delivery.ACCEPTED
+      assert sd.settled
+    assert rcv.credit == 1, rcv.credit
+    assert snd.session.connection.remote_condition is None
+
+  def testResumeNotResumable(self):
+    self.testResume(resumable=False)
+
   def testBufferingSize16(self):
     self.testBuffering(size=16)
 
@@ -1405,6 +1852,158 @@ class SettlementTest(Test):
     assert self.snd.unsettled == 1, self.snd.unsettled
     assert self.rcv.unsettled == 0, self.rcv.unsettled
 
+  def testRemoteSettledUpto(self, count=100):
+    self.rcv.flow(count)
+    self.pump()
+
+    sent = []
+    for i in range(count):
+      sent.append(self.snd.delivery("tag%s" % i))
+      self.snd.advance()
+    self.pump()
+    assert self.snd.remote_settled_upto is None
+
+    # settling a prefix on the receiver goes out as a single range
+    for i in range(count/2):
+      d = self.rcv.current
+      d.update(Delivery.ACCEPTED)
+      d.settle()
+    self.pump()
+    upto = self.snd.remote_settled_upto
+    assert upto.tag == "tag%s" % (count/2 - 1), upto.tag
+    assert upto.remote_state == Delivery.ACCEPTED
+
+    for d in sent[:10]:
+      d.settle()
+    assert self.snd.remote_settled_upto is upto
+
+    # a gap holds the cumulative view back
+    self.rcv.current.settle()
+    rest = self.rcv.current
+    self.rcv.advance()
+    for i in range(count/2 + 2, count):
+      self.rcv.current.settle()
+    self.pump()
+    upto = self.snd.remote_settled_upto
+    assert upto.tag == "tag%s" % (count/2), upto.tag
+    rest.settle()
+    self.pump()
+    assert self.snd.remote_settled_upto.tag == "tag%s" % (count - 1)
+
+  def testSettleUpto(self, count=20):
+    self.rcv.flow(count)
+    self.pump()
+
+    sent = []
+    for i in range(count):
+      sent.append(self.snd.delivery("tag%s" % i))
+      self.snd.advance()
+    self.pump()
+
+    received = []
+    for i in range(count):
+      received.append(self.rcv.current)
+      self.rcv.advance()
+
+    received[3].settle()
+    received[5].update(Delivery.REJECTED)
+    assert self.rcv.settle_upto(received[9], Delivery.ACCEPTED) == 9
+    assert self.rcv.unsettled == count - 10, self.rcv.unsettled
+    try:
+      self.rcv.settle_upto(received[9])
+      assert False, "settled delivery accepted"
+    except ProtonException:
+      pass
+
+    # outcome 0 leaves each delivery's own state
+    received[12].update(Delivery.RELEASED)
+    assert self.rcv.settle_upto(received[14]) == 5
+    self.pump()
+
+    for i, d in enumerate(sent):
+      if i < 15:
+        assert d.settled, i
+      else:
+        assert not d.settled, i
+      if i == 3 or i == 13 or i == 14:
+        assert d.remote_state == 0, (i, d.remote_state)
+      elif i == 12:
+        assert d.remote_state == Delivery.RELEASED, (i, d.remote_state)
+      elif i < 10:
+        assert d.remote_state == Delivery.ACCEPTED, (i, d.remote_state)
+    assert self.snd.remote_settled_upto is sent[14]
+
+  def testSendSettled(self):
+    # without credit the message is queued as an ordinary delivery
+    self.snd.send_settled("tag0", "early")
+    assert self.snd.unsettled == 0, self.snd.unsettled
+    self.rcv.flow(10)
+    self.pump()
+    for i in range(1, 4):
+      assert self.snd.send_settled("tag%s" % i, "msg%s" % i) == 4
+    assert self.snd.unsettled == 0, self.snd.unsettled
+    self.pump()
+
+    for i in range(4):
+      d = self.rcv.current
+      assert d.tag == "tag%s" % i, (i, d.tag)
+      assert d.settled, i
+      assert self.rcv.recv(1024) == (i and "msg%s" % i or "early")
+      self.rcv.advance()
+      d.settle()
+    assert self.rcv.current is None
+    assert self.snd.credit == 6, self.snd.credit
+
+    self.snd.delivery("pending")
+    try:
+      self.snd.send_settled("tag4", "msg")
+      assert False, "sent settled over a current delivery"
+    except ProtonException:
+      pass
+    self.snd.current.settle()
+    self.snd.snd_settle_mode = Link.SND_UNSETTLED
+    try:
+      self.snd.send_settled("tag5", "msg")
+      assert False, "sent settled on an unsettled link"
+    except ProtonException:
+      pass
+
+  def testOutOfOrderSettlement(self, count=64):
+    self.rcv.flow(count)
+    self.pump()
+
+    sent = []
+    for i in range(count):
+      sent.append(self.snd.delivery("tag%s" % i))
+      self.snd.advance()
+    self.pump()
+
+    received = []
+    for i in range(count):
+      received.append(self.rcv.current)
+      self.rcv.advance()
+
+    # pending dispositions are grouped by outcome and merged into ranges
+    # whatever order the deliveries are settled in
+    order = range(count)
+    random.Random(count).shuffle(order)
+    for i in order:
+      d = received[i]
+      if i % 3:
+        d.update(Delivery.ACCEPTED)
+      else:
+        d.update(Delivery.REJECTED)
+      if i % 4:
+        d.settle()
+    self.pump()
+
+    for i, d in enumerate(sent):
+      if i % 3:
+        assert d.remote_state == Delivery.ACCEPTED, (i, d.remote_state)
+      else:
+        assert d.remote_state == Delivery.REJECTED, (i, d.remote_state)
+      assert d.settled == bool(i % 4), (i, d.settled)
+
   def testMultipleUnsettled(self, count=1024, size=1024):
     self.rcv.flow(count)
     self.pump()
@@ -1772,3 +2371,219 @@ class DeliveryTest(Test):
 
   def testCustom(self):
     self.testDisposition(type=0x12345, value=CustomValue([1, 2, 3]))
+
+  def testStateReplaced(self):
+    snd, rcv = self.link("test-link")
+    snd.open()
+    rcv.open()
+    sd = snd.delivery("tag")
+    snd.advance()
+    rcv.flow(1)
+    self.pump()
+    rd = rcv.current
+
+    modified = ModifiedValue(failed=True, undeliverable=True,
+                             annotations={"key": "value"})
+    modified.apply(rd.local)
+    rd.update(Disposition.MODIFIED)
+    self.pump()
+    modified.check(sd.remote)
+
+    # nothing of the earlier outcome is left behind
+    received = ReceivedValue(1, 2)
+    rd.local.failed = False
+    rd.local.undeliverable = False
+    rd.local.annotations = None
+    received.apply(rd.local)
+    rd.update(Disposition.RECEIVED)
+    self.pump()
+    assert sd.remote_state == Disposition.RECEIVED
+    received.check(sd.remote)
+
+  def testTransaction(self):
+    ctl, crd = self.link("txn-ctl")
+    ctl.target.type = Terminus.COORDINATOR
+    TerminusConfig(capabilities=["amqp:local-transactions"])(ctl.target)
+    ctl.open()
+    crd.open()
+    crd.flow(1)
+    self.pump()
+
+    assert crd.remote_target.type == Terminus.COORDINATOR
+    assert crd.remote_target.address is None
+    assert crd.remote_target.capabilities.format() == \
+        '@PN_SYMBOL[:"amqp:local-transactions"]', crd.remote_target.capabilities.format()
+
+    # the coordinator declares a transaction in reply to the declare
+    declare = ctl.delivery("declare")
+    ctl.advance()
+    self.pump()
+    d = crd.current
+    crd.advance()
+    d.local.data = [b"txn-1"]
+    d.update(Delivery.DECLARED)
+    self.pump()
+    assert declare.remote_state == Delivery.DECLARED
+    assert declare.remote.txn_id == b"txn-1", declare.remote.txn_id
+    declare.settle()
+    d.settle()
+
+    # a transfer in the transaction, and its acceptance within it
+    snd = ctl.session.sender("txn-work")
+    rcv = crd.session.receiver("txn-work")
+    snd.open()
+    rcv.open()
+    rcv.flow(1)
+    self.pump()
+    sd = snd.delivery("work")
+    sd.local.data = [b"txn-1"]
+    sd.update(Delivery.TRANSACTIONAL_STATE)
+    snd.send("payload")
+    snd.advance()
+    self.pump()
+    rd = rcv.current
+    assert rd.remote_state == Delivery.TRANSACTIONAL_STATE
+    assert rd.remote.txn_id == b"txn-1"
+    assert rd.remote.txn_outcome == 0
+    assert rcv.recv(1024) == "payload"
+    rcv.advance()
+
+    rd.local.data = [b"txn-1", Described(ulong(Delivery.ACCEPTED), [])]
+    rd.update(Delivery.TRANSACTIONAL_STATE)
+    self.pump()
+    assert sd.remote_state == Delivery.TRANSACTIONAL_STATE
+    assert sd.remote.txn_id == b"txn-1"
+    assert sd.remote.txn_outcome == Delivery.ACCEPTED
+    sd.settle()
+    self.pump()
+    assert rd.settled
+    rd.settle()
+
+class EventTest(Test):
+
+  def teardown(self):
+    self.cleanup()
+
+  def expect(self, collector, *types):
+    events = []
+    while True:
+      ev = collector.peek()
+      if ev is None: break
+      collector.pop()
+      if ev.type != Event.TRANSPORT:
+        events.append(ev)
+    assert [ev.type for ev in events] == list(types), events
+    return events
+
+  def testEndpointEvents(self):
+    c1, c2 = self.connection()
+    coll = Collector()
+    c2.collect(coll)
+    c1.open()
+    ssn = c1.session()
+    ssn.open()
+    snd = ssn.sender("sender")
+    snd.open()
+    self.pump()
+    conn, s, l = self.expect(coll, Event.CONNECTION_REMOTE_STATE,
+                             Event.SESSION_REMOTE_STATE,
+                             Event.LINK_REMOTE_STATE)
+    assert conn.connection == c2
+    assert s.session.connection == c2
+    assert l.link.is_receiver
+    assert l.session == s.session
+    assert l.connection == c2
+    assert l.transport is not None
+
+    l.link.open()
+    self.expect(coll, Event.LINK_LOCAL_STATE)
+    snd.close()
+    self.pump()
+    self.expect(coll, Event.LINK_REMOTE_STATE)
+    c2.collect(None)
+
+  def testDeliveryEvents(self):
+    snd, rcv = self.link("test-link")
+    coll = Collector()
+    snd.session.connection.collect(coll)
+    rcoll = Collector()
+    rcv.session.connection.collect(rcoll)
+    snd.open()
+    rcv.open()
+    rcv.flow(1)
+    self.pump()
+    self.expect(coll, Event.LINK_LOCAL_STATE, Event.LINK_REMOTE_STATE,
+                Event.LINK_FLOW)
+    self.expect(rcoll, Event.LINK_LOCAL_STATE, Event.LINK_REMOTE_STATE)
+    assert snd.credit == 1
+
+    snd.delivery("tag")
+    snd.send("hello")
+    snd.advance()
+    self.pump()
+    ev, = self.expect(rcoll, Event.DELIVERY)
+    assert ev.delivery.tag == "tag"
+    assert ev.delivery.readable
+    assert ev.link == rcv
+
+    ev.delivery.update(Delivery.ACCEPTED)
+    ev.delivery.settle()
+    self.pump()
+    ev, = self.expect(coll, Event.DELIVERY)
+    assert ev.delivery.remote_state == Delivery.ACCEPTED
+    assert ev.delivery.settled
+    assert ev.link == snd
+    ev.delivery.settle()
+
+  def testDeliveryRangeEvent(self, count=10):
+    snd, rcv = self.link("test-link")
+    coll = Collector()
+    snd.session.connection.collect(coll)
+    snd.open()
+    rcv.open()
+    rcv.flow(count)
+    self.pump()
+    self.expect(coll, Event.LINK_LOCAL_STATE, Event.LINK_REMOTE_STATE,
+                Event.LINK_FLOW)
+
+    sent = []
+    for i in range(count):
+      sent.append(snd.delivery("tag%s" % i))
+      snd.advance()
+    self.pump()
+    self.expect(coll)
+
+    for i in range(count):
+      d = rcv.current
+      rcv.advance()
+      d.update(Delivery.ACCEPTED)
+      d.settle()
+    self.pump()
+    # one event for the whole range, every delivery on the work list
+    ev, = self.expect(coll, Event.DELIVERY_RANGE)
+    assert ev.session == snd.session
+    assert ev.delivery is None
+    work = []
+    d = snd.session.connection.work_head
+    while d:
+      work.append(d)
+      d = d.work_next
+    assert len(work) == count, len(work)
+    for d in sent:
+      assert d.settled
+      assert d.remote_state == Delivery.ACCEPTED
+      d.settle()
+
+  def testCollectorFreedFirst(self):
+    c1, c2 = self.connection()
+    coll = Collector()
+    c2.collect(coll)
+    c1.open()
+    self.pump()
+    assert coll.peek().type == Event.CONNECTION_REMOTE_STATE
+    # the connection keeps running without a collector to record into
+    del coll
+    c2.open()
+    c1.session().open()
+    self.pump()
+    assert c2.session_head(0).state == Endpoint.LOCAL_UNINIT | Endpoint.REMOTE_ACTIVE
@@ -235,6 +235,28 @@ class MessengerTest(Test):
     self.server.accept()
 
 
+  def testTxnBatchWithoutCoordinator(self):
+    self.server.incoming_window = 10
+    self.start()
+    msg = Message()
+    msg.address="amqp://0.0.0.0:12345"
+    msg.subject="Hello World!"
+
+    # the server refuses the coordinator, so the messages go out
+    # outside of any transaction
+    self.client.txn_batch = 5
+    assert self.client.txn_batch == 5
+    self.client.outgoing_window = 10
+    trackers = []
+    for i in range(10):
+      trackers.append(self.client.put(msg))
+
+    self.client.send()
+    self.client.commit()
+
+    for t in trackers:
+      assert self.client.status(t) is ACCEPTED, (t, self.client.status(t))
+
   def testIncomingWindow(self):
     self.server.incoming_window = 10
     self.server.outgoing_window = 10
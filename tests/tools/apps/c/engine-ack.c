@@ -0,0 +1,186 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-ack - counts the disposition frames a receiver sends when it
+ * accepts messages out of order, as a pool of parallel workers would.
+ * Each round the receiver accepts and settles a random selection of the
+ * messages it holds and grants the sender credit for as many again.
+ */
+
+#include "engine-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   msg_count;
+    int   window;
+    int   percent;
+    unsigned int seed;
+} Options_t;
+
+static char scratch[65536];
+
+static void usage(int rc)
+{
+    printf("Usage: engine-ack [OPTIONS] \n"
+           " -c # \tNumber of messages to send [100000]\n"
+           " -w # \tMessages outstanding at the receiver [256]\n"
+           " -p # \tPercentage of outstanding messages settled each round [25]\n"
+           " -s # \tSeed for the order of settlement [1]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->msg_count = 100000;
+    opts->window = 256;
+    opts->percent = 25;
+    opts->seed = 1;
+
+    while ((c = getopt(argc, argv, "c:w:p:s:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->msg_count = (int) value; break;
+        case 'w': opts->window = (int) value; break;
+        case 'p': opts->percent = (int) value; break;
+        case 's': opts->seed = (unsigned int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->msg_count <= 0 || opts->window <= 0 ||
+        opts->percent <= 0 || opts->percent > 100) {
+        usage(1);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+    srand(opts.seed);
+
+    pn_delivery_t **held = (pn_delivery_t **) calloc(opts.window, sizeof(pn_delivery_t *));
+    if (!held) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_link_t *snd = pn_sender(ssn, "ack");
+    pn_link_open(snd);
+    pn_connection_open(server);
+
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+    pn_link_t *rcv = pn_link_head(server, PN_LOCAL_ACTIVE);
+    pn_link_flow(rcv, opts.window);
+    engine_pump(st, ct, (size_t) -1);
+
+    pn_transport_stats_reset(ct);
+    pn_transport_stats_reset(st);
+
+    uint64_t tag = 0;
+    int sent = 0;
+    int received = 0;
+    int settled = 0;
+    int count = 0;
+
+    while (settled < opts.msg_count) {
+        while (sent < opts.msg_count && pn_link_credit(snd) > 0) {
+            tag++;
+            pn_delivery(snd, pn_dtag((char *) &tag, sizeof(tag)));
+            pn_link_send(snd, (char *) &tag, sizeof(tag));
+            pn_link_advance(snd);
+            sent++;
+        }
+
+        engine_pump(ct, st, (size_t) -1);
+
+        pn_delivery_t *d;
+        while ((d = pn_link_current(rcv)) && pn_delivery_readable(d) && !pn_delivery_partial(d)) {
+            while (pn_link_recv(rcv, scratch, sizeof(scratch)) > 0);
+            pn_link_advance(rcv);
+            held[count++] = d;
+            received++;
+        }
+
+        // settle a random selection, or everything once the sender is done
+        int n = count * opts.percent / 100;
+        if (!n || sent == opts.msg_count) n = count;
+        for (int i = 0; i < n; i++) {
+            int j = i + rand() % (count - i);
+            d = held[j];
+            held[j] = held[i];
+            pn_delivery_update(d, PN_ACCEPTED);
+            pn_delivery_settle(d);
+        }
+        memmove(held, held + n, (count - n) * sizeof(pn_delivery_t *));
+        count -= n;
+        settled += n;
+        pn_link_flow(rcv, n);
+
+        engine_pump(st, ct, (size_t) -1);
+
+        d = pn_work_head(client);
+        while (d) {
+            pn_delivery_t *next_work = pn_work_next(d);
+            if (pn_delivery_settled(d)) pn_delivery_settle(d);
+            d = next_work;
+        }
+    }
+
+    const pn_transport_stats_t *stats = pn_transport_stats(st);
+    uint64_t frames = stats->frames_output[PN_STATS_DISPOSITION];
+    printf("%d messages, %d outstanding, %d%% settled per round\n",
+           received, opts.window, opts.percent);
+    printf("  %10llu disposition frames %8.2f deliveries/frame\n",
+           (unsigned long long) frames, frames ? (double) received / frames : 0.0);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    free(held);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-alloc - counts allocator calls per message for a sender and
+ * receiver exchanging settled messages over an in-process connection.
+ * The first window's worth of messages warms up any pools and is
+ * reported separately from the steady state.
+ */
+
+#include "engine-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   msg_count;
+    size_t msg_size;
+    size_t tag_size;
+    int   window;
+    int   link_count;
+} Options_t;
+
+static char scratch[65536];
+
+static void usage(int rc)
+{
+    printf("Usage: engine-alloc [OPTIONS] \n"
+           " -c # \tNumber of messages to send [100000]\n"
+           " -b # \tSize of message body in bytes [64]\n"
+           " -t # \tSize of delivery tags in bytes [8]\n"
+           " -w # \tUnsettled deliveries per link [100]\n"
+           " -l # \tNumber of sender links [1]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->msg_count = 100000;
+    opts->msg_size = 64;
+    opts->tag_size = 8;
+    opts->window = 100;
+    opts->link_count = 1;
+
+    while ((c = getopt(argc, argv, "c:b:t:w:l:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->msg_count = (int) value; break;
+        case 'b': opts->msg_size = value; break;
+        case 't': opts->tag_size = value; break;
+        case 'w': opts->window = (int) value; break;
+        case 'l': opts->link_count = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->msg_count <= 0 || opts->window <= 0 || opts->link_count <= 0 ||
+        opts->tag_size < sizeof(uint64_t) || opts->tag_size > 1024) {
+        usage(1);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    if (engine_alloc_calls() < 0) {
+        fprintf(stderr, "allocator calls cannot be counted on this platform\n");
+        return 1;
+    }
+
+    char *body = (char *) calloc(1, opts.msg_size ? opts.msg_size : 1);
+    char *tag = (char *) calloc(1, opts.tag_size);
+    pn_link_t **senders = (pn_link_t **) calloc(opts.link_count, sizeof(pn_link_t *));
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    for (int i = 0; i < opts.link_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "link-%d", i);
+        senders[i] = pn_sender(ssn, name);
+        pn_link_open(senders[i]);
+    }
+    pn_connection_open(server);
+
+    uint64_t next_tag = 0;
+    int sent = 0;
+    int received = 0;
+    int warmup = opts.window * opts.link_count;
+    int64_t warm_allocs = 0;
+    int64_t start_allocs = engine_alloc_calls();
+    int measured_from = -1;
+
+    while (received < opts.msg_count) {
+        for (int i = 0; i < opts.link_count; i++) {
+            pn_link_t *snd = senders[i];
+            while (sent < opts.msg_count && pn_link_credit(snd) > 0 &&
+                   pn_link_unsettled(snd) < opts.window) {
+                next_tag++;
+                memcpy(tag, &next_tag, sizeof(next_tag));
+                pn_delivery(snd, pn_dtag(tag, opts.tag_size));
+                pn_link_send(snd, body, opts.msg_size);
+                pn_link_advance(snd);
+                sent++;
+            }
+        }
+
+        engine_pump(ct, st, (size_t) -1);
+
+        engine_accept(server);
+        pn_link_t *link = pn_link_head(server, PN_LOCAL_ACTIVE);
+        while (link) {
+            if (pn_link_credit(link) < opts.window) pn_link_flow(link, opts.window);
+            link = pn_link_next(link, PN_LOCAL_ACTIVE);
+        }
+
+        pn_delivery_t *d = pn_work_head(server);
+        while (d) {
+            pn_delivery_t *next = pn_work_next(d);
+            pn_link_t *rcv = pn_delivery_link(d);
+            if (pn_delivery_readable(d) && pn_link_current(rcv) == d) {
+                while (pn_link_recv(rcv, scratch, sizeof(scratch)) > 0);
+                if (!pn_delivery_partial(d)) {
+                    pn_delivery_update(d, PN_ACCEPTED);
+                    pn_delivery_settle(d);
+                    received++;
+                }
+            }
+            d = next;
+        }
+
+        engine_pump(st, ct, (size_t) -1);
+
+        d = pn_work_head(client);
+        while (d) {
+            pn_delivery_t *next = pn_work_next(d);
+            if (pn_delivery_settled(d)) pn_delivery_settle(d);
+            d = next;
+        }
+
+        if (measured_from < 0 && received >= warmup) {
+            warm_allocs = engine_alloc_calls() - start_allocs;
+            start_allocs = engine_alloc_calls();
+            measured_from = received;
+        }
+    }
+
+    int64_t steady_allocs = engine_alloc_calls() - start_allocs;
+    int measured = received - (measured_from < 0 ? 0 : measured_from);
+    printf("%d messages (%u byte body, %u byte tag) on %d link(s), window %d\n",
+           received, (unsigned int) opts.msg_size, (unsigned int) opts.tag_size,
+           opts.link_count, opts.window);
+    printf("  warm-up      %10lld allocator calls, %8.2f per message\n",
+           (long long) warm_allocs, measured_from > 0 ? (double) warm_allocs / measured_from : 0.0);
+    printf("  steady state %10lld allocator calls, %8.2f per message\n",
+           (long long) steady_allocs, measured > 0 ? (double) steady_allocs / measured : 0.0);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    free(senders);
+    free(tag);
+    free(body);
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-attach - measures attach throughput on a single session with
+ * many links. The client attaches every link at once; the receiving end
+ * has none of them yet and creates each one as its attach arrives. The
+ * attaches the receiver sends back are then matched against the links
+ * the client already has. Both phases are timed separately.
+ */
+
+#include "engine-common.h"
+#include <pncompat/misc_funcs.inc>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   link_count;
+    int   batch;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: engine-attach [OPTIONS] \n"
+           " -l # \tNumber of links to attach [50000]\n"
+           " -b # \tLinks opened between pumps, 0 for all at once [0]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->link_count = 50000;
+    opts->batch = 0;
+
+    while ((c = getopt(argc, argv, "l:b:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'l': opts->link_count = (int) value; break;
+        case 'b': opts->batch = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->link_count <= 0) usage(1);
+    if (!opts->batch || opts->batch > opts->link_count) opts->batch = opts->link_count;
+}
+
+static void report(const char *label, int count, pn_timestamp_t msecs)
+{
+    printf("  %-8s %8d attaches %8llu ms %12.0f attaches/sec\n", label, count,
+           (unsigned long long) msecs,
+           msecs ? (double) count * 1000.0 / msecs : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_connection_open(server);
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+    engine_pump(st, ct, (size_t) -1);
+
+    pn_timestamp_t incoming = 0;
+    pn_timestamp_t outgoing = 0;
+    int opened = 0;
+
+    while (opened < opts.link_count) {
+        int end = opened + opts.batch;
+        if (end > opts.link_count) end = opts.link_count;
+        for (; opened < end; opened++) {
+            char name[32];
+            snprintf(name, sizeof(name), "link-%d", opened);
+            pn_link_open(pn_sender(ssn, name));
+        }
+
+        // the receiving end looks up and creates a link per attach
+        pn_timestamp_t start = time_now();
+        engine_pump(ct, st, (size_t) -1);
+        incoming += time_now() - start;
+
+        engine_accept(server);
+
+        // the client finds the link each returned attach is for
+        start = time_now();
+        engine_pump(st, ct, (size_t) -1);
+        outgoing += time_now() - start;
+    }
+
+    int active = 0;
+    pn_link_t *link = pn_link_head(client, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
+    while (link) {
+        active++;
+        link = pn_link_next(link, PN_LOCAL_ACTIVE | PN_REMOTE_ACTIVE);
+    }
+    if (active != opts.link_count) {
+        fprintf(stderr, "only %d of %d links attached\n", active, opts.link_count);
+        return 1;
+    }
+
+    printf("%d links on one session, %d opened between pumps\n",
+           opts.link_count, opts.batch);
+    report("receiver", opts.link_count, incoming);
+    report("sender", opts.link_count, outgoing);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+/*
+ * engine-churn - opens a connection, exchanges a few messages over it
+ * and tears it down again, over and over. Reports allocator calls and
+ * time per connection, once with freed buffers kept for reuse and once
+ * with the buffer pool turned off.
+ */
+
+#include "engine-common.h"
+#include <proton/buffer.h>
+#include <pncompat/misc_funcs.inc>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   conn_count;
+    int   msg_count;
+    size_t msg_size;
+} Options_t;
+
+static char scratch[65536];
+
+static void usage(int rc)
+{
+    printf("Usage: engine-churn [OPTIONS] \n"
+           " -c # \tNumber of connections to open [2000]\n"
+           " -m # \tMessages sent on each connection [10]\n"
+           " -b # \tSize of message body in bytes [1024]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->conn_count = 2000;
+    opts->msg_count = 10;
+    opts->msg_size = 1024;
+
+    while ((c = getopt(argc, argv, "c:m:b:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->conn_count = (int) value; break;
+        case 'm': opts->msg_count = (int) value; break;
+        case 'b': opts->msg_size = value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->conn_count <= 0 || opts->msg_count < 0 || opts->msg_size > sizeof(scratch)) {
+        usage(1);
+    }
+}
+
+// one connection from open to free, returns the messages received
+static int churn(const Options_t *opts, const char *body)
+{
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_link_t *snd = pn_sender(ssn, "churn");
+    pn_link_open(snd);
+    pn_connection_open(server);
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+    pn_link_t *rcv = pn_link_head(server, PN_LOCAL_ACTIVE);
+    pn_link_flow(rcv, opts->msg_count);
+    engine_pump(st, ct, (size_t) -1);
+
+    for (int i = 0; i < opts->msg_count; i++) {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "%d", i);
+        pn_delivery(snd, pn_dtag(tag, strlen(tag)));
+        pn_link_send(snd, body, opts->msg_size);
+        pn_link_advance(snd);
+    }
+    engine_pump(ct, st, (size_t) -1);
+
+    int received = 0;
+    pn_delivery_t *d;
+    while ((d = pn_link_current(rcv)) && !pn_delivery_partial(d)) {
+        while (pn_link_recv(rcv, scratch, sizeof(scratch)) > 0);
+        pn_link_advance(rcv);
+        pn_delivery_update(d, PN_ACCEPTED);
+        pn_delivery_settle(d);
+        received++;
+    }
+    engine_pump(st, ct, (size_t) -1);
+
+    // the connection is dropped rather than closed, the close frame
+    // would end the input of the server
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    return received;
+}
+
+static int run(const Options_t *opts, const char *body, bool pooled)
+{
+    pn_buffer_pool_set_capacity(pooled ? 1024*1024 : 0);
+    // the first connection warms up the pool and is not counted
+    churn(opts, body);
+
+    int received = 0;
+    int64_t allocs = engine_alloc_calls();
+    pn_timestamp_t start = time_now();
+    for (int i = 0; i < opts->conn_count; i++) received += churn(opts, body);
+    pn_timestamp_t msecs = time_now() - start;
+    allocs = engine_alloc_calls() - allocs;
+
+    printf("%s:\n", pooled ? "buffer pool" : "without pool");
+    printf("  %10.2f allocator calls per connection\n",
+           allocs >= 0 ? (double) allocs / opts->conn_count : -1.0);
+    printf("  %10llu ms, %d of %d messages received\n", (unsigned long long) msecs,
+           received, opts->conn_count * opts->msg_count);
+    if (pooled) {
+        size_t cached = pn_buffer_pool_cached();
+        size_t released = pn_buffer_pool_trim(0);
+        printf("  %10lu bytes kept for reuse, %lu released by a trim\n",
+               (unsigned long) cached, (unsigned long) released);
+    }
+    return received == opts->conn_count * opts->msg_count ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    char *body = (char *) calloc(1, opts.msg_size ? opts.msg_size : 1);
+    printf("%d connections, %d messages of %u bytes on each\n",
+           opts.conn_count, opts.msg_count, (unsigned int) opts.msg_size);
+    int rc = run(&opts, body, false);
+    rc |= run(&opts, body, true);
+    free(body);
+    return rc;
+}
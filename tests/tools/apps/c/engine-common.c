@@ -0,0 +1,113 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "engine-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char wire[65536];
+
+size_t engine_pump(pn_transport_t *from, pn_transport_t *to, size_t limit)
+{
+    size_t moved = 0;
+    while (moved < limit) {
+        size_t want = limit - moved;
+        ssize_t n = pn_transport_output(from, wire, want < sizeof(wire) ? want : sizeof(wire));
+        if (n <= 0) break;
+        ssize_t offset = 0;
+        while (offset < n) {
+            ssize_t m = pn_transport_input(to, wire + offset, n - offset);
+            if (m <= 0) {
+                fprintf(stderr, "transport input failed: %d\n", (int) m);
+                exit(1);
+            }
+            offset += m;
+        }
+        moved += n;
+    }
+    return moved;
+}
+
+void engine_accept(pn_connection_t *conn)
+{
+    pn_session_t *ssn = pn_session_head(conn, PN_LOCAL_UNINIT);
+    while (ssn) {
+        pn_session_open(ssn);
+        ssn = pn_session_next(ssn, PN_LOCAL_UNINIT);
+    }
+
+    pn_link_t *link = pn_link_head(conn, PN_LOCAL_UNINIT);
+    while (link) {
+        pn_link_open(link);
+        link = pn_link_next(link, PN_LOCAL_UNINIT);
+    }
+}
+
+#if defined(__GLIBC__)
+
+// glibc lets the executable interpose the allocator, including for the
+// calls made from inside libqpid-proton
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static int64_t alloc_calls;
+
+void *malloc(size_t size)
+{
+    alloc_calls++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_calls++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_calls++;
+    return __libc_realloc(ptr, size);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+int64_t engine_alloc_calls()
+{
+    return alloc_calls;
+}
+
+#else
+
+int64_t engine_alloc_calls()
+{
+    return -1;
+}
+
+#endif
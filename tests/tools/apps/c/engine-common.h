@@ -0,0 +1,36 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "pncompat/misc_defs.h"
+
+#include "proton/engine.h"
+
+/* helpers shared by the engine-only benchmarks: both ends of a
+ * connection live in one process and are pumped through memory */
+
+/* moves at most limit bytes of output from one transport into the other */
+size_t engine_pump(pn_transport_t *from, pn_transport_t *to, size_t limit);
+
+/* opens any sessions and links the remote end has opened */
+void engine_accept(pn_connection_t *conn);
+
+/* number of malloc, calloc and realloc calls made so far by the whole
+ * process, or -1 where the allocator cannot be counted */
+int64_t engine_alloc_calls();
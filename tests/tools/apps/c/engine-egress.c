@@ -0,0 +1,244 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-egress - measures small message latency on one link while a
+ * second link on the same connection keeps the wire saturated with bulk
+ * transfers.  Both ends run in process and are pumped through a simulated
+ * link that carries a fixed number of bytes per tick, so the latency of
+ * each small message is reported as the number of wire bytes that went
+ * out ahead of it (and the equivalent time at the given link rate).
+ */
+
+#include "engine-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   ping_count;
+    size_t ping_size;
+    size_t bulk_size;
+    int   bulk_window;
+    size_t link_bytes;  // per tick
+    int   link_mbps;
+    int   ping_priority;
+    unsigned int ping_weight;
+    unsigned int bulk_weight;
+} Options_t;
+
+static char scratch[65536];
+
+static void usage(int rc)
+{
+    printf("Usage: engine-egress [OPTIONS] \n"
+           " -c # \tNumber of small messages to time [1000]\n"
+           " -s # \tSize of each small message in bytes [64]\n"
+           " -b # \tSize of each bulk message in bytes [262144]\n"
+           " -n # \tBulk messages kept outstanding [4]\n"
+           " -l # \tBytes the simulated link carries per tick [16384]\n"
+           " -r # \tLink rate in Mbit/s used to convert bytes to time [1000]\n"
+           " -p # \tPriority of the small message link (bulk uses 0) [1]\n"
+           " -w # \tWeight of the small message link [1]\n"
+           " -W # \tWeight of the bulk link [1]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->ping_count = 1000;
+    opts->ping_size = 64;
+    opts->bulk_size = 262144;
+    opts->bulk_window = 4;
+    opts->link_bytes = 16384;
+    opts->link_mbps = 1000;
+    opts->ping_priority = 1;
+    opts->ping_weight = 1;
+    opts->bulk_weight = 1;
+
+    while ((c = getopt(argc, argv, "c:s:b:n:l:r:p:w:W:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->ping_count = (int) value; break;
+        case 's': opts->ping_size = value; break;
+        case 'b': opts->bulk_size = value; break;
+        case 'n': opts->bulk_window = (int) value; break;
+        case 'l': opts->link_bytes = value; break;
+        case 'r': opts->link_mbps = (int) value; break;
+        case 'p': opts->ping_priority = (int) value; break;
+        case 'w': opts->ping_weight = (unsigned int) value; break;
+        case 'W': opts->bulk_weight = (unsigned int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->ping_count <= 0 || !opts->ping_size || !opts->bulk_size ||
+        opts->bulk_window <= 0 || !opts->link_bytes || opts->link_mbps <= 0) {
+        usage(1);
+    }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void report(const char *label, uint64_t bytes, int mbps)
+{
+    printf("  %-4s %10llu wire bytes %10.1f us\n", label,
+           (unsigned long long) bytes, (double) bytes * 8.0 / mbps);
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    char *bulk_body = (char *) calloc(1, opts.bulk_size);
+    char *ping_body = (char *) calloc(1, opts.ping_size);
+    uint64_t *latency = (uint64_t *) calloc(opts.ping_count, sizeof(uint64_t));
+    if (!bulk_body || !ping_body || !latency) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_link_t *bulk = pn_sender(ssn, "bulk");
+    pn_link_t *ping = pn_sender(ssn, "ping");
+    if (pn_link_set_priority(ping, opts.ping_priority) ||
+        pn_link_set_weight(ping, opts.ping_weight) ||
+        pn_link_set_weight(bulk, opts.bulk_weight)) {
+        fprintf(stderr, "invalid priority or weight\n");
+        return 1;
+    }
+    pn_link_open(bulk);
+    pn_link_open(ping);
+    pn_connection_open(server);
+
+    uint64_t wire_bytes = 0;
+    uint64_t ping_sent_at = 0;
+    uint64_t bulk_bytes = 0;
+    uint64_t tag = 0;
+    uint64_t ticks = 0;
+    bool ping_outstanding = false;
+    int pings = 0;
+
+    while (pings < opts.ping_count) {
+        // keep the bulk link saturated and a single small message in flight
+        while (pn_link_credit(bulk) > 0 && pn_link_unsettled(bulk) < opts.bulk_window) {
+            tag++;
+            pn_delivery(bulk, pn_dtag((char *) &tag, sizeof(tag)));
+            pn_link_send(bulk, bulk_body, opts.bulk_size);
+            pn_link_advance(bulk);
+        }
+        if (!ping_outstanding && pn_link_credit(ping) > 0) {
+            tag++;
+            pn_delivery(ping, pn_dtag((char *) &tag, sizeof(tag)));
+            pn_link_send(ping, ping_body, opts.ping_size);
+            pn_link_advance(ping);
+            ping_sent_at = wire_bytes;
+            ping_outstanding = true;
+        }
+
+        wire_bytes += engine_pump(ct, st, opts.link_bytes);
+        ticks++;
+
+        engine_accept(server);
+        pn_link_t *link = pn_link_head(server, PN_LOCAL_ACTIVE);
+        while (link) {
+            if (pn_link_credit(link) < 512) pn_link_flow(link, 1024);
+            link = pn_link_next(link, PN_LOCAL_ACTIVE);
+        }
+
+        pn_delivery_t *d = pn_work_head(server);
+        while (d) {
+            pn_delivery_t *next = pn_work_next(d);
+            pn_link_t *rcv = pn_delivery_link(d);
+            if (pn_delivery_readable(d) && pn_link_current(rcv) == d) {
+                ssize_t n;
+                while ((n = pn_link_recv(rcv, scratch, sizeof(scratch))) > 0) {
+                    if (!strcmp(pn_link_name(rcv), "bulk")) bulk_bytes += n;
+                }
+                if (!pn_delivery_partial(d)) {
+                    if (!strcmp(pn_link_name(rcv), "ping")) {
+                        latency[pings++] = wire_bytes - ping_sent_at;
+                        ping_outstanding = false;
+                    }
+                    pn_delivery_update(d, PN_ACCEPTED);
+                    pn_delivery_settle(d);
+                    pn_link_advance(rcv);
+                }
+            }
+            d = next;
+        }
+
+        engine_pump(st, ct, (size_t) -1);
+
+        d = pn_work_head(client);
+        while (d) {
+            pn_delivery_t *next = pn_work_next(d);
+            if (pn_delivery_settled(d)) pn_delivery_settle(d);
+            d = next;
+        }
+    }
+
+    qsort(latency, opts.ping_count, sizeof(uint64_t), compare_u64);
+    printf("%d small messages (%u bytes, priority %d, weight %u) against "
+           "%u byte bulk messages (weight %u)\n", opts.ping_count,
+           (unsigned int) opts.ping_size, opts.ping_priority, opts.ping_weight,
+           (unsigned int) opts.bulk_size, opts.bulk_weight);
+    printf("  bulk %10llu bytes delivered in %llu ticks\n",
+           (unsigned long long) bulk_bytes, (unsigned long long) ticks);
+    report("p50", latency[opts.ping_count / 2], opts.link_mbps);
+    report("p99", latency[(opts.ping_count * 99) / 100], opts.link_mbps);
+    report("max", latency[opts.ping_count - 1], opts.link_mbps);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    free(latency);
+    free(ping_body);
+    free(bulk_body);
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-memory - reports the memory held by both ends of a connection
+ * once many links are attached, optionally with unsettled deliveries
+ * on each, and projects it per link to help size hosts.
+ */
+
+#include "engine-common.h"
+#include <pncompat/misc_funcs.inc>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   link_count;
+    int   unsettled;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: engine-memory [OPTIONS] \n"
+           " -l # \tNumber of links to attach [50000]\n"
+           " -u # \tUnsettled deliveries per link [0]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->link_count = 50000;
+    opts->unsettled = 0;
+
+    while ((c = getopt(argc, argv, "l:u:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'l': opts->link_count = (int) value; break;
+        case 'u': opts->unsettled = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->link_count <= 0) usage(1);
+}
+
+static void report(const char *label, pn_connection_t *conn)
+{
+    pn_memory_usage_t usage;
+    if (pn_connection_memory_usage(conn, &usage)) {
+        fprintf(stderr, "cannot measure the %s\n", label);
+        exit(1);
+    }
+    printf("%s: %lu links, %lu deliveries\n", label,
+           (unsigned long) usage.link_count, (unsigned long) usage.delivery_count);
+    printf("  connection %12lu bytes\n", (unsigned long) usage.connection);
+    printf("  sessions   %12lu bytes\n", (unsigned long) usage.sessions);
+    printf("  links      %12lu bytes\n", (unsigned long) usage.links);
+    printf("  deliveries %12lu bytes\n", (unsigned long) usage.deliveries);
+    printf("  transport  %12lu bytes\n", (unsigned long) usage.transport);
+    printf("  total      %12lu bytes, %.0f bytes per link, %.2f GB per 1M links\n",
+           (unsigned long) usage.total,
+           (double) usage.total / usage.link_count,
+           (double) usage.total / usage.link_count * 1e6 / 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_connection_open(server);
+
+    for (int i = 0; i < opts.link_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "link-%d", i);
+        pn_link_t *link = pn_sender(ssn, name);
+        pn_terminus_set_address(pn_link_target(link), name);
+        pn_link_open(link);
+    }
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+
+    pn_link_t *rcv = pn_link_head(server, PN_LOCAL_ACTIVE);
+    while (rcv) {
+        if (opts.unsettled) pn_link_flow(rcv, opts.unsettled);
+        rcv = pn_link_next(rcv, PN_LOCAL_ACTIVE);
+    }
+    engine_pump(st, ct, (size_t) -1);
+
+    if (opts.unsettled) {
+        pn_link_t *snd = pn_link_head(client, PN_LOCAL_ACTIVE);
+        while (snd) {
+            for (int i = 0; i < opts.unsettled; i++) {
+                char tag[16];
+                snprintf(tag, sizeof(tag), "%d", i);
+                pn_delivery(snd, pn_dtag(tag, strlen(tag)));
+                pn_link_send(snd, "x", 1);
+                pn_link_advance(snd);
+            }
+            snd = pn_link_next(snd, PN_LOCAL_ACTIVE);
+        }
+        while (engine_pump(ct, st, (size_t) -1) || engine_pump(st, ct, (size_t) -1));
+    }
+
+    printf("%d links on one session, %d unsettled deliveries per link\n",
+           opts.link_count, opts.unsettled);
+    report("client", client);
+    report("server", server);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-process - measures the CPU spent in the transport's process
+ * pass on a connection with many attached links of which only a few
+ * carry traffic at any one time. Each round sends one message on each
+ * of the next few links in turn, and the receiver accepts and settles
+ * it and tops up that link's credit, so every pass has a small amount
+ * of work regardless of the number of links.
+ */
+
+#include "engine-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   msg_count;
+    int   link_count;
+    int   active;
+    size_t msg_size;
+} Options_t;
+
+static char scratch[65536];
+
+static void usage(int rc)
+{
+    printf("Usage: engine-process [OPTIONS] \n"
+           " -c # \tNumber of messages to send [20000]\n"
+           " -l # \tNumber of attached links [1000]\n"
+           " -a # \tLinks sending in each round [1]\n"
+           " -b # \tSize of message body in bytes [64]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->msg_count = 20000;
+    opts->link_count = 1000;
+    opts->active = 1;
+    opts->msg_size = 64;
+
+    while ((c = getopt(argc, argv, "c:l:a:b:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->msg_count = (int) value; break;
+        case 'l': opts->link_count = (int) value; break;
+        case 'a': opts->active = (int) value; break;
+        case 'b': opts->msg_size = value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->msg_count <= 0 || opts->link_count <= 0 || opts->active <= 0 ||
+        opts->active > opts->link_count) {
+        usage(1);
+    }
+}
+
+static void report(const char *label, pn_transport_t *transport)
+{
+    const pn_transport_stats_t *stats = pn_transport_stats(transport);
+    printf("  %-8s %10llu passes %10llu us %8.2f us/pass\n", label,
+           (unsigned long long) stats->process_calls,
+           (unsigned long long) stats->process_time,
+           stats->process_calls ? (double) stats->process_time / stats->process_calls : 0.0);
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    char *body = (char *) calloc(1, opts.msg_size ? opts.msg_size : 1);
+    pn_link_t **senders = (pn_link_t **) calloc(opts.link_count, sizeof(pn_link_t *));
+    if (!body || !senders) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    for (int i = 0; i < opts.link_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "link-%d", i);
+        senders[i] = pn_sender(ssn, name);
+        pn_link_open(senders[i]);
+    }
+    pn_connection_open(server);
+
+    // attach everything and hand out initial credit before measuring
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+    pn_link_t *link = pn_link_head(server, PN_LOCAL_ACTIVE);
+    while (link) {
+        pn_link_flow(link, 1);
+        link = pn_link_next(link, PN_LOCAL_ACTIVE);
+    }
+    engine_pump(st, ct, (size_t) -1);
+    engine_pump(ct, st, (size_t) -1);
+
+    pn_transport_stats_reset(ct);
+    pn_transport_stats_reset(st);
+    pn_transport_set_stats_timing(ct, true);
+    pn_transport_set_stats_timing(st, true);
+
+    uint64_t tag = 0;
+    int next = 0;
+    int sent = 0;
+    int received = 0;
+
+    while (received < opts.msg_count) {
+        for (int i = 0; i < opts.active && sent < opts.msg_count; i++) {
+            pn_link_t *snd = senders[next];
+            next = (next + 1) % opts.link_count;
+            if (pn_link_credit(snd) <= 0) continue;
+            tag++;
+            pn_delivery(snd, pn_dtag((char *) &tag, sizeof(tag)));
+            pn_link_send(snd, body, opts.msg_size);
+            pn_link_advance(snd);
+            sent++;
+        }
+
+        engine_pump(ct, st, (size_t) -1);
+
+        pn_delivery_t *d = pn_work_head(server);
+        while (d) {
+            pn_delivery_t *next_work = pn_work_next(d);
+            pn_link_t *rcv = pn_delivery_link(d);
+            if (pn_delivery_readable(d) && pn_link_current(rcv) == d) {
+                while (pn_link_recv(rcv, scratch, sizeof(scratch)) > 0);
+                if (!pn_delivery_partial(d)) {
+                    pn_delivery_update(d, PN_ACCEPTED);
+                    pn_delivery_settle(d);
+                    pn_link_flow(rcv, 1);
+                    received++;
+                }
+            }
+            d = next_work;
+        }
+
+        engine_pump(st, ct, (size_t) -1);
+
+        d = pn_work_head(client);
+        while (d) {
+            pn_delivery_t *next_work = pn_work_next(d);
+            if (pn_delivery_settled(d)) pn_delivery_settle(d);
+            d = next_work;
+        }
+    }
+
+    printf("%d messages over %d link(s), %d sending per round\n",
+           received, opts.link_count, opts.active);
+    report("sender", ct);
+    report("receiver", st);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    free(senders);
+    free(body);
+    return 0;
+}
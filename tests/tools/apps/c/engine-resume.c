@@ -0,0 +1,270 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * engine-resume - drops the connection part way through sending large
+ * messages, binds both ends to new transports and reports how many
+ * bytes it takes to complete the transfer. This is done once with a
+ * resumable sender, which carries on from where each receiver got to,
+ * and once without, where the application has to send every unsettled
+ * message again. The payload received is checked in both cases.
+ */
+
+#include "engine-common.h"
+#include <pncompat/misc_funcs.inc>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int      count;
+    size_t   size;
+    int      percent;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: engine-resume [OPTIONS] \n"
+           " -c # \tNumber of messages to send [4]\n"
+           " -s # \tSize of each message in bytes [1048576]\n"
+           " -d # \tDrop the connection after this percentage of the bytes [50]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->count = 4;
+    opts->size = 1048576;
+    opts->percent = 50;
+
+    while ((c = getopt(argc, argv, "c:s:d:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->count = (int) value; break;
+        case 's': opts->size = (size_t) value; break;
+        case 'd': opts->percent = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->count <= 0 || !opts->size || opts->percent < 0 || opts->percent > 100) usage(1);
+}
+
+static char pattern(int message, size_t offset)
+{
+    return (char) ((offset * 7 + message) & 0xff);
+}
+
+static void send_message(pn_link_t *snd, int message, size_t size, char *payload)
+{
+    char tag[16];
+    snprintf(tag, sizeof(tag), "%d", message);
+    pn_delivery(snd, pn_dtag(tag, strlen(tag)));
+    for (size_t i = 0; i < size; i++) payload[i] = pattern(message, i);
+    pn_link_send(snd, payload, size);
+    pn_link_advance(snd);
+}
+
+// the number of the message a delivery carries, from its tag
+static int message_number(pn_delivery_t *d)
+{
+    pn_delivery_tag_t tag = pn_delivery_tag(d);
+    char name[16];
+    size_t n = tag.size < sizeof(name) - 1 ? tag.size : sizeof(name) - 1;
+    memcpy(name, tag.bytes, n);
+    name[n] = '\0';
+    return atoi(name);
+}
+
+static size_t pump_all(pn_transport_t *ct, pn_transport_t *st)
+{
+    size_t total = 0;
+    size_t moved;
+    do {
+        moved = engine_pump(ct, st, (size_t) -1);
+        moved += engine_pump(st, ct, (size_t) -1);
+        total += moved;
+    } while (moved);
+    return total;
+}
+
+static pn_link_t *first_link(pn_connection_t *conn)
+{
+    return pn_link_head(conn, 0);
+}
+
+// reads and checks every delivery on the receiver, returns how many
+// were complete and intact
+static int verify(pn_link_t *rcv, size_t size, char *payload)
+{
+    int intact = 0;
+    pn_delivery_t *d = pn_link_current(rcv);
+    while (d && !pn_delivery_partial(d)) {
+        int message = message_number(d);
+        ssize_t got = pn_link_recv(rcv, payload, size + 1);
+        bool ok = got == (ssize_t) size;
+        for (size_t i = 0; ok && i < size; i++) ok = payload[i] == pattern(message, i);
+        if (ok) intact++;
+        else fprintf(stderr, "message %d damaged, %d bytes\n", message, (int) got);
+
+        pn_link_advance(rcv);
+        pn_delivery_update(d, PN_ACCEPTED);
+        pn_delivery_settle(d);
+        d = pn_link_current(rcv);
+    }
+    return intact;
+}
+
+static int run(const Options_t *opts, bool resumable, char *payload)
+{
+    pn_connection_t *client = pn_connection();
+    pn_connection_t *server = pn_connection();
+    pn_transport_t *ct = pn_transport();
+    pn_transport_t *st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+
+    pn_connection_open(client);
+    pn_session_t *ssn = pn_session(client);
+    pn_session_open(ssn);
+    pn_link_t *snd = pn_sender(ssn, "resume");
+    pn_terminus_set_address(pn_link_target(snd), "resume");
+    pn_link_set_resumable(snd, resumable);
+    pn_link_open(snd);
+    pn_connection_open(server);
+    engine_pump(ct, st, (size_t) -1);
+    engine_accept(server);
+    pn_session_set_incoming_capacity(pn_session_head(server, 0),
+                                     opts->size * (opts->count + 1));
+    pn_link_t *rcv = first_link(server);
+    pn_link_flow(rcv, opts->count);
+    engine_pump(st, ct, (size_t) -1);
+
+    for (int i = 0; i < opts->count; i++) send_message(snd, i, opts->size, payload);
+
+    // the connection drops once this much has reached the receiver, and
+    // whatever the sender had not written yet is lost with it
+    size_t total = opts->size * opts->count;
+    size_t drop = total / 100 * opts->percent;
+    size_t before = 0;
+    while (before < drop) {
+        size_t moved = engine_pump(ct, st, drop - before);
+        engine_pump(st, ct, (size_t) -1);
+        if (!moved) break;
+        before += moved;
+    }
+
+    pn_transport_unbind(ct);
+    pn_transport_unbind(st);
+    pn_transport_free(ct);
+    pn_transport_free(st);
+
+    if (!resumable) {
+        // the application has to send again every message that went out
+        // in whole or in part, the engine keeps nothing of those; the
+        // receiver drops what it has of them once the sender no longer
+        // lists them
+        int *resend = (int *) malloc(opts->count * sizeof(int));
+        int count = 0;
+        pn_delivery_t *d = pn_unsettled_head(snd);
+        while (d) {
+            pn_delivery_t *next = pn_unsettled_next(d);
+            if (!pn_delivery_pending(d)) {
+                resend[count++] = message_number(d);
+                pn_delivery_settle(d);
+            }
+            d = next;
+        }
+        for (int i = 0; i < count; i++)
+            send_message(snd, resend[i], opts->size, payload);
+        free(resend);
+    }
+
+    ct = pn_transport();
+    st = pn_transport();
+    pn_transport_bind(ct, client);
+    pn_transport_bind(st, server);
+    pn_timestamp_t start = time_now();
+    size_t after = pump_all(ct, st);
+
+    if (!resumable) {
+        pn_delivery_t *d = pn_unsettled_head(rcv);
+        while (d) {
+            pn_delivery_t *next = pn_unsettled_next(d);
+            if (pn_delivery_settled(d)) {
+                if (d == pn_link_current(rcv)) pn_link_advance(rcv);
+                pn_delivery_settle(d);
+            }
+            d = next;
+        }
+        pn_link_flow(rcv, opts->count);
+        after += pump_all(ct, st);
+    }
+    pn_timestamp_t msecs = time_now() - start;
+
+    int intact = verify(rcv, opts->size, payload);
+    after += pump_all(ct, st);
+
+    const pn_transport_stats_t *stats = pn_transport_stats(ct);
+    printf("%s:\n", resumable ? "resumable sender" : "without resumption");
+    printf("  %12lu bytes before the drop\n", (unsigned long) before);
+    printf("  %12lu bytes after, %llu ms\n", (unsigned long) after,
+           (unsigned long long) msecs);
+    printf("  %12lu bytes of payload sent again, %lu already received\n",
+           (unsigned long) stats->resent_bytes, (unsigned long) stats->resumed_bytes);
+    printf("  %12d of %d messages intact\n", intact, opts->count);
+
+    pn_transport_free(ct);
+    pn_transport_free(st);
+    pn_connection_free(client);
+    pn_connection_free(server);
+    return intact == opts->count ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    char *payload = (char *) malloc(opts.size + 1);
+    if (!payload) {
+        fprintf(stderr, "cannot allocate %lu bytes\n", (unsigned long) opts.size);
+        return 1;
+    }
+
+    printf("%d messages of %lu bytes, dropped after %d%% of them\n",
+           opts.count, (unsigned long) opts.size, opts.percent);
+    int rc = run(&opts, true, payload);
+    rc |= run(&opts, false, payload);
+    free(payload);
+    return rc;
+}
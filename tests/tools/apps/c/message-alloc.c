@@ -0,0 +1,148 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+/*
+ * message-alloc - counts allocator calls per pn_message_decode for a
+ * message carrying the usual string properties, once decoding into the
+ * same message every time and once into a message made for each one,
+ * the way a receiver handing messages on to other code would.
+ */
+
+#include "engine-common.h"
+#include <proton/message.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   msg_count;
+    size_t msg_size;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: message-alloc [OPTIONS] \n"
+           " -c # \tNumber of messages to decode [100000]\n"
+           " -b # \tSize of message body in bytes [64]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->msg_count = 100000;
+    opts->msg_size = 64;
+
+    while ((c = getopt(argc, argv, "c:b:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->msg_count = (int) value; break;
+        case 'b': opts->msg_size = value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->msg_count <= 0) usage(1);
+}
+
+// a message with the property strings a broker or client would set
+static size_t encode(const Options_t *opts, char *encoded, size_t capacity)
+{
+    pn_message_t *msg = pn_message();
+    pn_message_set_address(msg, "amqp://broker.example.com/orders");
+    pn_message_set_subject(msg, "order created");
+    pn_message_set_reply_to(msg, "amqp://client-0001/replies");
+    pn_message_set_content_type(msg, "application/json");
+    pn_message_set_content_encoding(msg, "utf-8");
+    pn_message_set_group_id(msg, "customer-42");
+    pn_message_set_reply_to_group_id(msg, "session-7");
+    pn_message_set_user_id(msg, pn_bytes(5, (char *) "guest"));
+
+    char *body = (char *) calloc(1, opts->msg_size ? opts->msg_size : 1);
+    pn_data_put_binary(pn_message_body(msg), pn_bytes(opts->msg_size, body));
+    free(body);
+
+    size_t size = capacity;
+    if (pn_message_encode(msg, encoded, &size)) {
+        fprintf(stderr, "encode failed: %s\n", pn_error_text(pn_message_error(msg)));
+        exit(1);
+    }
+    pn_message_free(msg);
+    return size;
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    if (engine_alloc_calls() < 0) {
+        fprintf(stderr, "allocator calls cannot be counted on this platform\n");
+        return 1;
+    }
+
+    size_t capacity = opts.msg_size + 4096;
+    char *encoded = (char *) malloc(capacity);
+    size_t size = encode(&opts, encoded, capacity);
+
+    // decoding into one message over and over
+    pn_message_t *msg = pn_message();
+    pn_message_decode(msg, encoded, size);
+    int64_t start = engine_alloc_calls();
+    for (int i = 0; i < opts.msg_count; i++) {
+        if (pn_message_decode(msg, encoded, size)) {
+            fprintf(stderr, "decode failed: %s\n", pn_error_text(pn_message_error(msg)));
+            return 1;
+        }
+    }
+    int64_t reused = engine_alloc_calls() - start;
+    pn_message_free(msg);
+
+    // a new message for each one
+    start = engine_alloc_calls();
+    for (int i = 0; i < opts.msg_count; i++) {
+        msg = pn_message();
+        if (pn_message_decode(msg, encoded, size)) {
+            fprintf(stderr, "decode failed: %s\n", pn_error_text(pn_message_error(msg)));
+            return 1;
+        }
+        pn_message_free(msg);
+    }
+    int64_t fresh = engine_alloc_calls() - start;
+
+    printf("%d messages of %u encoded bytes\n", opts.msg_count, (unsigned int) size);
+    printf("  same message %10lld allocator calls, %8.2f per message\n",
+           (long long) reused, (double) reused / opts.msg_count);
+    printf("  new message  %10lld allocator calls, %8.2f per message\n",
+           (long long) fresh, (double) fresh / opts.msg_count);
+
+    free(encoded);
+    return 0;
+}
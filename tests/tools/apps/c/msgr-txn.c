@@ -0,0 +1,345 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/*
+ * msgr-txn - sends messages with a Messenger to a stand-in broker in
+ * the same process, once settling each message on its own and once
+ * with the messages grouped into transactions. The broker makes each
+ * message it has to keep durable wait for a simulated disk flush, once
+ * per message outside of a transaction and once per discharge inside
+ * one, and the throughput of both runs is reported.
+ */
+
+#include "msgr-common.h"
+#include "proton/message.h"
+#include "proton/messenger.h"
+#include "proton/driver.h"
+#include "proton/engine.h"
+#include "proton/sasl.h"
+#include "proton/error.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   count;
+    int   batch;
+    int   size;
+    int   flush;
+    const char *port;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: msgr-txn [OPTIONS] \n"
+           " -c # \tNumber of messages to send [2000]\n"
+           " -b # \tMessages per transaction [100]\n"
+           " -s # \tSize of message body in bytes [64]\n"
+           " -f # \tMilliseconds the broker waits for each disk flush [1]\n"
+           " -p <port> \tPort the stand-in broker listens on [56720]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->count = 2000;
+    opts->batch = 100;
+    opts->size = 64;
+    opts->flush = 1;
+    opts->port = "56720";
+
+    while ((c = getopt(argc, argv, "c:b:s:f:p:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == 'p' && optarg) {
+            opts->port = optarg;
+            continue;
+        }
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'c': opts->count = (int) value; break;
+        case 'b': opts->batch = (int) value; break;
+        case 's': opts->size = (int) value; break;
+        case 'f': opts->flush = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->count <= 0 || opts->batch <= 0) usage(1);
+}
+
+// the stand-in broker, it keeps nothing but counts what it would have
+// had to flush to disk
+typedef struct {
+    pn_driver_t *driver;
+    int flush;
+    int next_txn;
+    uint64_t flushes;
+    uint64_t received;
+    pn_data_t *body;
+    char *buffer;
+    size_t capacity;
+} Broker_t;
+
+static void broker_flush(Broker_t *b)
+{
+    b->flushes++;
+    if (b->flush) {
+        pn_timestamp_t until = msgr_now() + b->flush;
+        while (msgr_now() <= until);
+    }
+}
+
+static ssize_t broker_read(Broker_t *b, pn_link_t *link, pn_delivery_t *d)
+{
+    size_t pending = pn_delivery_pending(d);
+    if (pending > b->capacity) {
+        b->capacity = pending;
+        b->buffer = (char *) realloc(b->buffer, b->capacity);
+        check(b->buffer, "out of memory");
+    }
+    ssize_t n = pn_link_recv(link, b->buffer, pending);
+    pn_link_advance(link);
+    return n;
+}
+
+// a declare or discharge sent to the coordinator
+static void broker_control(Broker_t *b, pn_link_t *link, pn_delivery_t *d)
+{
+    ssize_t n = broker_read(b, link, d);
+    uint64_t type = 0;
+    pn_data_clear(b->body);
+    check(n >= 0 && pn_data_decode(b->body, b->buffer, n) == n, "bad control message");
+    check(!pn_data_scan(b->body, "D.DL.", &type), "bad control message");
+
+    if (type == 0x31) {            // declare
+        char id[32];
+        snprintf(id, sizeof(id), "txn-%d", b->next_txn++);
+        pn_disposition_set_txn(pn_delivery_local(d), pn_bytes(strlen(id), id), 0);
+        pn_delivery_update(d, PN_DECLARED);
+    } else if (type == 0x32) {     // discharge
+        broker_flush(b);
+        pn_delivery_update(d, PN_ACCEPTED);
+    } else {
+        pn_delivery_update(d, PN_REJECTED);
+    }
+    pn_link_flow(link, 1);
+}
+
+static void broker_transfer(Broker_t *b, pn_link_t *link, pn_delivery_t *d)
+{
+    broker_read(b, link, d);
+    b->received++;
+    pn_disposition_t *remote = pn_delivery_remote(d);
+    if (pn_disposition_type(remote) == PN_TRANSACTIONAL_STATE) {
+        // flushed when the transaction is discharged
+        pn_disposition_set_txn(pn_delivery_local(d), pn_disposition_get_txn(remote),
+                               PN_ACCEPTED);
+        pn_delivery_update(d, PN_TRANSACTIONAL_STATE);
+    } else {
+        if (!pn_delivery_settled(d)) broker_flush(b);
+        pn_delivery_update(d, PN_ACCEPTED);
+    }
+    if (pn_delivery_settled(d)) pn_delivery_settle(d);
+    pn_link_flow(link, 1);
+}
+
+static void broker_endpoints(Broker_t *b, pn_connection_t *conn)
+{
+    if (pn_connection_state(conn) & PN_LOCAL_UNINIT) pn_connection_open(conn);
+
+    pn_session_t *ssn = pn_session_head(conn, PN_LOCAL_UNINIT);
+    while (ssn) {
+        pn_session_open(ssn);
+        ssn = pn_session_next(ssn, PN_LOCAL_UNINIT);
+    }
+
+    pn_link_t *link = pn_link_head(conn, PN_LOCAL_UNINIT);
+    while (link) {
+        pn_terminus_copy(pn_link_source(link), pn_link_remote_source(link));
+        pn_terminus_copy(pn_link_target(link), pn_link_remote_target(link));
+        pn_link_open(link);
+        if (pn_link_is_receiver(link)) pn_link_flow(link, 1024);
+        link = pn_link_next(link, PN_LOCAL_UNINIT);
+    }
+
+    pn_delivery_t *d = pn_work_head(conn);
+    while (d) {
+        pn_delivery_t *next = pn_work_next(d);
+        pn_link_t *link = pn_delivery_link(d);
+        if (pn_delivery_readable(d) && !pn_delivery_partial(d)) {
+            if (pn_terminus_get_type(pn_link_remote_target(link)) == PN_COORDINATOR) {
+                broker_control(b, link, d);
+            } else {
+                broker_transfer(b, link, d);
+            }
+        } else if (pn_delivery_updated(d) && pn_delivery_settled(d)) {
+            pn_delivery_settle(d);
+        }
+        d = next;
+    }
+
+    link = pn_link_head(conn, PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED);
+    while (link) {
+        pn_link_close(link);
+        link = pn_link_next(link, PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED);
+    }
+    ssn = pn_session_head(conn, PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED);
+    while (ssn) {
+        pn_session_close(ssn);
+        ssn = pn_session_next(ssn, PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED);
+    }
+    if (pn_connection_state(conn) == (PN_LOCAL_ACTIVE | PN_REMOTE_CLOSED)) {
+        pn_connection_close(conn);
+    }
+}
+
+static void broker_poll(Broker_t *b)
+{
+    pn_driver_wait(b->driver, 0);
+
+    pn_listener_t *l;
+    while ((l = pn_driver_listener(b->driver))) {
+        pn_connector_t *c = pn_listener_accept(l);
+        pn_sasl_t *sasl = pn_sasl(pn_connector_transport(c));
+        pn_sasl_mechanisms(sasl, "ANONYMOUS");
+        pn_sasl_server(sasl);
+        pn_sasl_done(sasl, PN_SASL_OK);
+        pn_connector_set_connection(c, pn_connection());
+    }
+
+    pn_connector_t *c;
+    while ((c = pn_driver_connector(b->driver))) {
+        pn_connector_process(c);
+        pn_connection_t *conn = pn_connector_connection(c);
+        broker_endpoints(b, conn);
+        if (pn_connector_closed(c)) {
+            pn_connector_free(c);
+            pn_connection_free(conn);
+        } else {
+            pn_connector_process(c);
+        }
+    }
+}
+
+// runs the messenger and the broker until pred returns 0
+static void run_until(Broker_t *b, pn_messenger_t *m, int (*pred)(pn_messenger_t *))
+{
+    int err;
+    while ((err = pred(m)) == PN_INPROGRESS) {
+        broker_poll(b);
+    }
+    check(!err, pn_error_text(pn_messenger_error(m)));
+}
+
+static int send_all(pn_messenger_t *m)
+{
+    return pn_messenger_send(m, -1);
+}
+
+static int run(Broker_t *b, const Options_t *opts, int batch)
+{
+    pn_messenger_t *m = pn_messenger(NULL);
+    pn_messenger_set_blocking(m, false);
+    pn_messenger_set_outgoing_window(m, opts->count);
+    pn_messenger_set_txn_batch(m, batch);
+    pn_messenger_start(m);
+    check_messenger(m);
+
+    char address[64];
+    snprintf(address, sizeof(address), "amqp://127.0.0.1:%s/queue", opts->port);
+    pn_message_t *msg = pn_message();
+    pn_message_set_address(msg, address);
+    pn_message_set_durable(msg, true);
+    char *payload = (char *) calloc(1, opts->size + 1);
+    memset(payload, 'x', opts->size);
+    pn_data_put_binary(pn_message_body(msg), pn_bytes(opts->size, payload));
+
+    uint64_t flushes = b->flushes;
+    uint64_t received = b->received;
+    pn_timestamp_t start = msgr_now();
+    for (int i = 0; i < opts->count; i++) {
+        pn_messenger_put(m, msg);
+        check_messenger(m);
+        if (i % 64 == 63) broker_poll(b);
+    }
+    run_until(b, m, send_all);
+    if (batch) run_until(b, m, pn_messenger_commit);
+    pn_timestamp_t msecs = msgr_now() - start;
+
+    int accepted = 0;
+    pn_tracker_t last = pn_messenger_outgoing_tracker(m);
+    for (int i = 0; i < opts->count; i++) {
+        if (pn_messenger_status(m, last - i) == PN_STATUS_ACCEPTED) accepted++;
+    }
+
+    printf("%s:\n", batch ? "transactions" : "settled per message");
+    printf("  %8d messages, %8d accepted, %8lu received by the broker\n", opts->count,
+           accepted, (unsigned long) (b->received - received));
+    printf("  %8lu disk flushes\n", (unsigned long) (b->flushes - flushes));
+    printf("  %8llu ms %12.0f messages/sec\n", (unsigned long long) msecs,
+           msecs ? (double) opts->count * 1000.0 / msecs : 0.0);
+
+    pn_messenger_stop(m);
+    while (!pn_messenger_stopped(m)) {
+        pn_messenger_work(m, 0);
+        broker_poll(b);
+    }
+    pn_messenger_free(m);
+    pn_message_free(msg);
+    free(payload);
+    return accepted == opts->count ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    Broker_t broker;
+    memset(&broker, 0, sizeof(broker));
+    broker.driver = pn_driver();
+    broker.flush = opts.flush;
+    broker.body = pn_data(16);
+    if (!pn_listener(broker.driver, "127.0.0.1", opts.port, NULL)) {
+        fprintf(stderr, "cannot listen on port %s\n", opts.port);
+        return 1;
+    }
+
+    printf("%d messages of %d bytes, %d per transaction, %d ms per disk flush\n",
+           opts.count, opts.size, opts.batch, opts.flush);
+    int rc = run(&broker, &opts, 0);
+    rc |= run(&broker, &opts, opts.batch);
+
+    pn_data_free(broker.body);
+    free(broker.buffer);
+    pn_driver_free(broker.driver);
+    return rc;
+}
@@ -0,0 +1,340 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+/*
+ * object-hash - times insert, lookup and delete on pn_hash_t with the
+ * kinds of keys the engine uses: channels and handles counting up from
+ * zero, and keys spread over a wider range. The same operations are
+ * timed on a copy of the chained table pn_hash_t used to be built on,
+ * so the two can be compared in one run.
+ */
+
+#include <proton/object.h>
+#include <pncompat/misc_funcs.inc>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int   key_count;
+    int   rounds;
+} Options_t;
+
+static void usage(int rc)
+{
+    printf("Usage: object-hash [OPTIONS] \n"
+           " -k # \tNumber of keys in the table [1000]\n"
+           " -r # \tTimes each operation is repeated over all keys [2000]\n"
+           );
+    exit(rc);
+}
+
+static void parse_options( int argc, char **argv, Options_t *opts )
+{
+    int c;
+    opterr = 0;
+
+    memset( opts, 0, sizeof(*opts) );
+    opts->key_count = 1000;
+    opts->rounds = 2000;
+
+    while ((c = getopt(argc, argv, "k:r:h")) != -1) {
+        unsigned long value = 0;
+        if (c == 'h') usage(0);
+        if (c == '?' || !optarg || sscanf( optarg, "%lu", &value ) != 1) {
+            fprintf(stderr, "Option -%c requires an integer argument.\n", optopt ? optopt : c);
+            usage(1);
+        }
+        switch(c) {
+        case 'k': opts->key_count = (int) value; break;
+        case 'r': opts->rounds = (int) value; break;
+        default:
+            usage(1);
+        }
+    }
+
+    if (opts->key_count <= 0 || opts->rounds <= 0) usage(1);
+}
+
+/* The chained table behind pn_map_t, with the identity hash pn_hash_t
+ * used to give it, calls through function pointers included. */
+
+#define CHAINED_FREE (0)
+#define CHAINED_LINK (1)
+#define CHAINED_TAIL (2)
+
+typedef struct {
+    void *key;
+    void *value;
+    size_t next;
+    uint8_t state;
+} chained_entry_t;
+
+typedef struct {
+    chained_entry_t *entries;
+    size_t capacity;
+    size_t addressable;
+    size_t size;
+    float load_factor;
+    uintptr_t (*hashcode)(void *key);
+    bool (*equals)(void *a, void *b);
+} chained_t;
+
+static uintptr_t identity_hashcode(void *obj) { return (uintptr_t) obj; }
+static bool identity_equals(void *a, void *b) { return a == b; }
+
+static void chained_allocate(chained_t *map)
+{
+    map->entries = (chained_entry_t *) calloc(map->capacity, sizeof(chained_entry_t));
+    map->size = 0;
+}
+
+static chained_t *chained(size_t capacity, float load_factor)
+{
+    chained_t *map = (chained_t *) malloc(sizeof(chained_t));
+    map->capacity = capacity ? capacity : 16;
+    map->addressable = (size_t) (map->capacity * 0.86);
+    if (!map->addressable) map->addressable = map->capacity;
+    map->load_factor = load_factor;
+    map->hashcode = identity_hashcode;
+    map->equals = identity_equals;
+    chained_allocate(map);
+    return map;
+}
+
+static void chained_free(chained_t *map)
+{
+    free(map->entries);
+    free(map);
+}
+
+static void chained_put(chained_t *map, uintptr_t key, void *value);
+
+static bool chained_ensure(chained_t *map, size_t capacity)
+{
+    float load = (float) map->size / map->addressable;
+    if (capacity <= map->capacity && load < map->load_factor) return false;
+
+    size_t oldcap = map->capacity;
+    while (map->capacity < capacity ||
+           ((float) map->size / map->addressable) >= map->load_factor) {
+        map->capacity *= 2;
+        map->addressable = (size_t) (0.86 * map->capacity);
+    }
+
+    chained_entry_t *entries = map->entries;
+    chained_allocate(map);
+    for (size_t i = 0; i < oldcap; i++) {
+        if (entries[i].state != CHAINED_FREE)
+            chained_put(map, (uintptr_t) entries[i].key, entries[i].value);
+    }
+    free(entries);
+    return true;
+}
+
+static chained_entry_t *chained_entry(chained_t *map, void *key, chained_entry_t **pprev, bool create)
+{
+    uintptr_t hashcode = map->hashcode(key);
+    chained_entry_t *entry = &map->entries[hashcode % map->addressable];
+    chained_entry_t *prev = NULL;
+
+    if (entry->state == CHAINED_FREE) {
+        if (!create) return NULL;
+        entry->state = CHAINED_TAIL;
+        entry->key = key;
+        map->size++;
+        return entry;
+    }
+
+    while (true) {
+        if (map->equals(entry->key, key)) {
+            if (pprev) *pprev = prev;
+            return entry;
+        }
+        if (entry->state == CHAINED_TAIL) break;
+        prev = entry;
+        entry = &map->entries[entry->next];
+    }
+
+    if (!create) return NULL;
+    if (chained_ensure(map, map->size + 1)) return chained_entry(map, key, pprev, create);
+
+    size_t empty = 0;
+    for (size_t i = 0; i < map->capacity; i++) {
+        size_t idx = map->capacity - i - 1;
+        if (map->entries[idx].state == CHAINED_FREE) {
+            empty = idx;
+            break;
+        }
+    }
+    entry->next = empty;
+    entry->state = CHAINED_LINK;
+    map->entries[empty].state = CHAINED_TAIL;
+    map->entries[empty].key = key;
+    if (pprev) *pprev = entry;
+    map->size++;
+    return &map->entries[empty];
+}
+
+static void chained_put(chained_t *map, uintptr_t key, void *value)
+{
+    chained_entry(map, (void *) key, NULL, true)->value = value;
+}
+
+static void *chained_get(chained_t *map, uintptr_t key)
+{
+    chained_entry_t *entry = chained_entry(map, (void *) key, NULL, false);
+    return entry ? entry->value : NULL;
+}
+
+static void chained_del(chained_t *map, uintptr_t key)
+{
+    chained_entry_t *prev = NULL;
+    chained_entry_t *entry = chained_entry(map, (void *) key, &prev, false);
+    if (entry) {
+        if (prev) {
+            prev->next = entry->next;
+            prev->state = entry->state;
+        }
+        entry->state = CHAINED_FREE;
+        entry->next = 0;
+        entry->key = NULL;
+        entry->value = NULL;
+        map->size--;
+    }
+}
+
+/* both tables are driven through the same calls, so neither is
+ * inlined into the loops below */
+
+typedef struct {
+    void *(*create)(void);
+    void (*destroy)(void *table);
+    void (*put)(void *table, uintptr_t key, void *value);
+    void *(*get)(void *table, uintptr_t key);
+    void (*del)(void *table, uintptr_t key);
+} Table_t;
+
+static void *hash_create(void) { return pn_hash(0, 0.75, 0); }
+static void hash_destroy(void *table) { pn_free(table); }
+static void hash_put(void *table, uintptr_t key, void *value) { pn_hash_put((pn_hash_t *) table, key, value); }
+static void *hash_get(void *table, uintptr_t key) { return pn_hash_get((pn_hash_t *) table, key); }
+static void hash_del(void *table, uintptr_t key) { pn_hash_del((pn_hash_t *) table, key); }
+
+static void *chained_create(void) { return chained(0, 0.75); }
+static void chained_destroy(void *table) { chained_free((chained_t *) table); }
+static void chained_put_op(void *table, uintptr_t key, void *value) { chained_put((chained_t *) table, key, value); }
+static void *chained_get_op(void *table, uintptr_t key) { return chained_get((chained_t *) table, key); }
+static void chained_del_op(void *table, uintptr_t key) { chained_del((chained_t *) table, key); }
+
+Table_t hash_table = {hash_create, hash_destroy, hash_put, hash_get, hash_del};
+Table_t chained_table = {chained_create, chained_destroy, chained_put_op, chained_get_op, chained_del_op};
+
+typedef struct {
+    double insert;
+    double hit;
+    double miss;
+    double del;
+} Timings_t;
+
+static double per_op(pn_timestamp_t start, long ops)
+{
+    return (double) (time_now() - start) * 1e6 / ops;
+}
+
+void *sink;
+
+static Timings_t time_table(const Table_t *ops, const Options_t *opts,
+                            const uintptr_t *keys, const uintptr_t *absent)
+{
+    Timings_t t;
+    long count = (long) opts->rounds * opts->key_count;
+    void *table = NULL;
+
+    pn_timestamp_t start = time_now();
+    for (int r = 0; r < opts->rounds; r++) {
+        if (table) ops->destroy(table);
+        table = ops->create();
+        for (int i = 0; i < opts->key_count; i++) ops->put(table, keys[i], (void *) keys);
+    }
+    t.insert = per_op(start, count);
+
+    start = time_now();
+    for (int r = 0; r < opts->rounds; r++)
+        for (int i = 0; i < opts->key_count; i++) sink = ops->get(table, keys[i]);
+    t.hit = per_op(start, count);
+
+    start = time_now();
+    for (int r = 0; r < opts->rounds; r++)
+        for (int i = 0; i < opts->key_count; i++) sink = ops->get(table, absent[i]);
+    t.miss = per_op(start, count);
+
+    // deleting and putting back keeps the table full for every round
+    start = time_now();
+    for (int r = 0; r < opts->rounds; r++) {
+        for (int i = 0; i < opts->key_count; i++) ops->del(table, keys[i]);
+        for (int i = 0; i < opts->key_count; i++) ops->put(table, keys[i], (void *) keys);
+    }
+    t.del = per_op(start, count * 2);
+
+    ops->destroy(table);
+    return t;
+}
+
+static void report(const char *name, Timings_t hash, Timings_t old)
+{
+    printf("%s keys, ns per operation:\n", name);
+    printf("  %-16s %10s %10s\n", "", "pn_hash", "chained");
+    printf("  %-16s %10.1f %10.1f\n", "insert", hash.insert, old.insert);
+    printf("  %-16s %10.1f %10.1f\n", "lookup, hit", hash.hit, old.hit);
+    printf("  %-16s %10.1f %10.1f\n", "lookup, miss", hash.miss, old.miss);
+    printf("  %-16s %10.1f %10.1f\n", "delete and put", hash.del, old.del);
+}
+
+int main(int argc, char** argv)
+{
+    Options_t opts;
+    parse_options( argc, argv, &opts );
+
+    uintptr_t *keys = (uintptr_t *) malloc(opts.key_count * sizeof(uintptr_t));
+    uintptr_t *absent = (uintptr_t *) malloc(opts.key_count * sizeof(uintptr_t));
+
+    // channels and handles: consecutive from zero
+    for (int i = 0; i < opts.key_count; i++) {
+        keys[i] = i;
+        absent[i] = opts.key_count + i;
+    }
+    report("consecutive", time_table(&hash_table, &opts, keys, absent),
+           time_table(&chained_table, &opts, keys, absent));
+
+    // delivery ids and name hashes: scattered over the whole range
+    unsigned long seed = 1;
+    for (int i = 0; i < opts.key_count; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        keys[i] = (uintptr_t) (seed >> 16) << 1;
+        absent[i] = keys[i] | 1;
+    }
+    report("scattered", time_table(&hash_table, &opts, keys, absent),
+           time_table(&chained_table, &opts, keys, absent));
+
+    free(keys);
+    free(absent);
+    return 0;
+}